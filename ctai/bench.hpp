@@ -0,0 +1,629 @@
+#pragma once
+
+#include "fib.hpp"
+#include "runtime.hpp"
+#include "trace.hpp"
+#include "profile.hpp"
+#include "snapshot.hpp"
+#include "decoded.hpp"
+#include "jit.hpp"
+#include "tier.hpp"
+#include "multicore.hpp"
+#include "scheduler.hpp"
+
+#include <memory>
+#include <chrono>
+#include <ostream>
+
+namespace bench
+{
+  struct result
+  {
+    std::string engine;
+    std::string name;
+    size_t amount_of_ram;
+    size_t instructions;
+    double seconds;
+  };
+
+  //Executes the whole program once and returns eax. reset, when given, is called before
+  //every run outside of the measured time and restores the state run starts from
+  struct runner
+  {
+    std::function<unit_t()> run;
+    std::function<void()> reset{};
+  };
+
+  //prepare is called once per benchmark, outside of the measured time. It returns an
+  //empty runner when the engine does not apply to the program
+  struct engine
+  {
+    std::string name;
+    std::function<runner(const runtime::machine&)> prepare;
+    bool matches_execute{ true }; // false when it gives programs other inputs than execute::execute
+  };
+
+  //Runner executing a fresh copy of m, made by reset, in place through execute
+  template <typename execute_t>
+  runner copying_runner(const runtime::machine& m, execute_t execute)
+  {
+    auto copy = std::make_shared<runtime::machine>(m);
+    return runner{
+      [copy, execute] { return execute(*copy); },
+      [&m, copy] { *copy = m; }
+    };
+  }
+
+  template <size_t amount_of_ram>
+  engine fixed_ram_engine()
+  {
+    return engine{
+      "execute/fixed_ram",
+      [](const runtime::machine& m) -> runner
+      {
+        if(m.ram.size() != amount_of_ram)
+        {
+          return {};
+        }
+
+        auto fixed = std::make_shared<machine<amount_of_ram>>();
+        std::copy(m.ram.begin(), m.ram.end(), fixed->ram.begin());
+        fixed->image_size = m.image_size;
+        fixed->esp() = m.esp();
+        fixed->eip() = m.eip();
+
+        auto copy = std::make_shared<machine<amount_of_ram>>(*fixed);
+        return runner{
+          [copy] { return execute::run(*copy); },
+          [fixed, copy] { *copy = *fixed; }
+        };
+      }
+    };
+  }
+
+  inline std::vector<engine> engines()
+  {
+    std::vector<engine> result;
+
+    result.push_back(engine{
+      "execute/runtime_ram",
+      [](const runtime::machine& m) -> runner
+      {
+        return copying_runner(m, [](runtime::machine& copy) { return execute::run(copy); });
+      }
+    });
+
+    //step/9 build: compile time sized machine executed at runtime
+    result.push_back(fixed_ram_engine<1024u>());
+    result.push_back(fixed_ram_engine<65536u>());
+
+    //Frame slots promoted to virtual registers
+    result.push_back(engine{
+      "execute/promoted",
+      [](const runtime::machine& m) -> runner
+      {
+        auto promoted = std::make_shared<runtime::machine>(promote::promote(m).m);
+        auto copy = std::make_shared<runtime::machine>(*promoted);
+        return runner{
+          [copy] { return execute::run(*copy); },
+          [promoted, copy] { *copy = *promoted; }
+        };
+      }
+    });
+
+    //Compiled once to x86-64, not applicable to programs which are not verified
+    result.push_back(engine{
+      "jit/x86_64",
+      [](const runtime::machine& m) -> runner
+      {
+        std::shared_ptr<const jit::code> compiled = jit::compile(m);
+        if(!compiled)
+        {
+          return {};
+        }
+
+        return copying_runner(m, [compiled](runtime::machine& copy) { return compiled->run(copy); });
+      }
+    });
+
+    //Every run starts cold, so it includes interpreting, verifying and compiling until
+    //loops are hot
+    result.push_back(engine{
+      "tier/x86_64",
+      [](const runtime::machine& m) -> runner
+      {
+        if(!jit::host_supported)
+        {
+          return {};
+        }
+
+        return copying_runner(m, [](runtime::machine& copy)
+        {
+          return tier::runner<runtime::machine>{ copy, tier::default_threshold }.run();
+        });
+      }
+    });
+
+    //Checked, from decoded instructions kept coherent with stores into code
+    result.push_back(engine{
+      "decoded/cache",
+      [](const runtime::machine& m) -> runner
+      {
+        return copying_runner(m, [](runtime::machine& copy) { return decoded::cache<runtime::machine>{ copy }.run(); });
+      }
+    });
+
+    result.push_back(engine{
+      "execute/checked",
+      [](const runtime::machine& m) -> runner
+      {
+        return copying_runner(m, [](runtime::machine& copy) { return execute::run_checked(copy); });
+      }
+    });
+
+    //Single core, every data access atomic
+    result.push_back(engine{
+      "multicore/core",
+      [](const runtime::machine& m) -> runner
+      {
+        return copying_runner(m, [](runtime::machine& copy) { return multicore::execute(copy); });
+      }
+    });
+
+    //Single machine resumed after every slice of 1000 instructions
+    result.push_back(engine{
+      "scheduler/round_robin",
+      [](const runtime::machine& m) -> runner
+      {
+        struct state
+        {
+          std::unique_ptr<scheduler::round_robin> scheduler;
+          size_t id{ 0u };
+        };
+
+        auto st = std::make_shared<state>();
+        return runner{
+          [st]
+          {
+            st->scheduler->run();
+            return st->scheduler->result(st->id);
+          },
+          [&m, st]
+          {
+            st->scheduler = std::make_unique<scheduler::round_robin>();
+            st->id = st->scheduler->add(m, execute::policy::unchecked);
+          }
+        };
+      }
+    });
+
+    //Ports with endless input and discarded output
+    result.push_back(engine{
+      "io/ports",
+      [](const runtime::machine& m) -> runner
+      {
+        auto ports = std::make_shared<io::ports>();
+        ports->refill = [](unit_t, io::ring_buffer& buffer)
+        {
+          const std::vector<unit_t> words(buffer.capacity() - buffer.size(), 1u);
+          buffer.write(words.data(), words.size());
+        };
+        ports->drain = [](unit_t, io::ring_buffer& buffer)
+        {
+          std::vector<unit_t> words(buffer.size());
+          buffer.read(words.data(), words.size());
+        };
+
+        return copying_runner(m, [ports](runtime::machine& copy)
+        {
+          copy.ports = ports.get();
+          return execute::run(copy);
+        });
+      },
+      false
+    });
+
+    result.push_back(engine{
+      "snapshot/cow_ram",
+      [](const runtime::machine& m) -> runner
+      {
+        auto cow = std::make_shared<snapshot::machine>(snapshot::from(m));
+        auto copy = std::make_shared<snapshot::machine>(*cow);
+        return runner{
+          [copy] { return execute::run(*copy); },
+          [cow, copy] { *copy = *cow; }
+        };
+      }
+    });
+
+    result.push_back(engine{
+      "trace/file",
+      [](const runtime::machine& m) -> runner
+      {
+        auto rec = std::make_shared<trace::recorder>("/dev/null");
+        return copying_runner(m, [rec](runtime::machine& copy) { return trace::run(copy, *rec); });
+      }
+    });
+
+    result.push_back(engine{
+      "trace/ring",
+      [](const runtime::machine& m) -> runner
+      {
+        auto ring = std::make_shared<std::unique_ptr<trace::ring<runtime::machine>>>();
+        auto copy = std::make_shared<runtime::machine>(m);
+        return runner{
+          [copy, ring] { return trace::run(*copy, **ring); },
+          [&m, copy, ring]
+          {
+            *copy = m;
+            *ring = std::make_unique<trace::ring<runtime::machine>>(m, 1u << 24);
+          }
+        };
+      }
+    });
+
+    result.push_back(engine{
+      "profile/heatmap",
+      [](const runtime::machine& m) -> runner
+      {
+        auto rec = std::make_shared<std::unique_ptr<profile::recorder>>();
+        auto copy = std::make_shared<runtime::machine>(m);
+        return runner{
+          [copy, rec] { return profile::run(*copy, **rec); },
+          [&m, copy, rec]
+          {
+            *copy = m;
+            *rec = std::make_unique<profile::recorder>(m.ram.size(), 1024u);
+          }
+        };
+      }
+    });
+
+    return result;
+  }
+
+  inline size_t count_instructions(runtime::machine m)
+  {
+    size_t count{ 1u }; //exit
+
+    while(execute::get_next_instruction(m) != instructions::instruction::exit)
+    {
+      if(execute::execute_next_instruction(m))
+      {
+        execute::adjust_eip(m);
+      }
+      ++count;
+    }
+
+    return count;
+  }
+
+  struct program
+  {
+    std::string name;
+    std::string source;
+  };
+
+  //Body repeated inside of a counted loop. ebp points to a few scratch words, ecx is the
+  //loop counter, zf is clear inside of the body
+  struct opcode_case
+  {
+    instructions::instruction instruction;
+    std::string name;
+    std::string body;
+    std::string setup{};
+  };
+
+  constexpr size_t body_repeat = 16u;
+  constexpr size_t loop_iterations = 20000u;
+
+  inline std::vector<opcode_case> opcode_cases()
+  {
+    using inst_t = instructions::instruction;
+
+    return {
+      { inst_t::je, "je", "je .end" },
+      { inst_t::jmp, "jmp", "jmp .next_@ :next_@" },
+      { inst_t::cmp, "cmp", "cmp eax , 7" },
+      { inst_t::add_reg_mem_ptr_reg_plus_val, "add_reg_mem_ptr_reg_plus_val", "add eax , [ ebp + 1 ]" },
+      { inst_t::sub_reg_val, "sub_reg_val", "sub eax , 1" },
+      { inst_t::mov_mem_reg_ptr_reg_plus_val, "mov_mem_reg_ptr_reg_plus_val", "mov [ ebp + 1 ] , eax" },
+      { inst_t::mov_mem_val_ptr_reg_plus_val, "mov_mem_val_ptr_reg_plus_val", "mov [ ebp + 1 ] , 5" },
+      { inst_t::mov_reg_mem_ptr_reg_plus_val, "mov_reg_mem_ptr_reg_plus_val", "mov eax , [ ebp + 1 ]" },
+      { inst_t::mov_reg_reg, "mov_reg_reg", "mov eax , ebx" },
+      { inst_t::mov_reg_val, "mov_reg_val", "mov eax , 5" },
+      { inst_t::inc, "inc", "inc eax" },
+      { inst_t::adc_reg_reg, "adc_reg_reg", "adc eax , ebx" },
+      { inst_t::sbb_reg_reg, "sbb_reg_reg", "sbb eax , ebx" },
+      { inst_t::add_reg_reg, "add_reg_reg", "add eax , ebx" },
+      { inst_t::addn, "addn", "addn ebx , edx , eax", "mov eax , 64 mov ebx , 512 mov edx , 600 " },
+      { inst_t::subn, "subn", "subn ebx , edx , eax", "mov eax , 64 mov ebx , 512 mov edx , 600 " },
+      { inst_t::xadd_mem_ptr_reg_plus_val_reg, "xadd_mem_ptr_reg_plus_val_reg", "xadd [ ebp + 1 ] , eax" },
+      { inst_t::cmpxchg_mem_ptr_reg_plus_val_reg, "cmpxchg_mem_ptr_reg_plus_val_reg", "cmpxchg [ ebp + 1 ] , ebx" },
+      { inst_t::fence, "fence", "fence" },
+      { inst_t::yield, "yield", "yield" },
+      { inst_t::in_reg_port, "in_reg_port", "in eax , 0" },
+      { inst_t::out_port_reg, "out_port_reg", "out 0 , eax" },
+      { inst_t::ins_reg_reg_port, "ins_reg_reg_port", "mov eax , 8 ins ebp , eax , 0" },
+      { inst_t::outs_port_reg_reg, "outs_port_reg_reg", "outs 0 , ebp , eax", "mov eax , 8 " },
+      { inst_t::copyn, "copyn", "copyn [ ebx + 0 ] , [ edx + 0 ] , eax", "mov eax , 64 mov ebx , 512 mov edx , 600 " },
+      { inst_t::filln, "filln", "filln [ ebx + 0 ] , ecx , eax", "mov eax , 64 mov ebx , 512 " },
+      { inst_t::cmpn, "cmpn", "cmpn [ ebx + 0 ] , [ edx + 0 ] , eax", "mov eax , 64 mov ebx , 512 mov edx , 600 " },
+      { inst_t::sumn, "sumn", "sumn edx , [ ebx + 0 ] , eax", "mov eax , 64 mov ebx , 512 " },
+    };
+  }
+
+  inline std::string counted_loop(const std::string& body, size_t iterations)
+  {
+    return "mov ebp , esp "
+           "sub ebp , 8 "
+           "mov ecx , 0 "
+           ":loop "
+           "cmp ecx , " + std::to_string(iterations) + " "
+           "je .end "
+           + body +
+           " inc ecx "
+           "jmp .loop "
+           ":end "
+           "exit";
+  }
+
+  inline std::string repeat(const std::string& body, size_t times)
+  {
+    std::string result;
+
+    for(size_t i = 0u; i < times; ++i)
+    {
+      auto instance = body;
+      for(auto pos = instance.find('@'); pos != std::string::npos; pos = instance.find('@'))
+      {
+        instance.replace(pos, 1u, std::to_string(i));
+      }
+
+      result += instance + " ";
+    }
+
+    return result;
+  }
+
+  inline std::vector<program> programs(size_t amount_of_ram)
+  {
+    std::vector<program> result;
+
+    result.push_back({ "loop_overhead", counted_loop("", loop_iterations) });
+
+    for(const auto& c : opcode_cases())
+    {
+      result.push_back({ "opcode/" + c.name, c.setup + counted_loop(repeat(c.body, body_repeat), loop_iterations) });
+    }
+
+    result.push_back({ "opcode/exit", "exit" });
+    result.push_back({ "fib", std::string{ asm_code.begin(), asm_code.end() } });
+
+    //Walks over upper half of ram with a 64 bytes stride, reading and writing every visited word
+    const auto first = std::to_string(amount_of_ram / 2u);
+    const auto last = std::to_string(amount_of_ram / 2u + (amount_of_ram / 2u - 16u) / 8u * 8u);
+
+    result.push_back({ "memory_bound", "mov ebx , " + first + " " + counted_loop(
+      "mov eax , [ ebx + 0 ] "
+      "mov [ ebx + 1 ] , eax "
+      "sub ebx , 18446744073709551608 " // ebx += 8
+      "cmp ebx , " + last + " "
+      "je .wrap_@ "
+      "jmp .next_@ "
+      ":wrap_@ "
+      "mov ebx , " + first + " "
+      ":next_@", loop_iterations * body_repeat) });
+
+    //As many words read and written as by memory_bound, moved by block instructions over
+    //the upper half of ram
+    const auto block = std::min<size_t>(amount_of_ram / 2u - 16u, 1024u);
+
+    result.push_back({ "memory_bulk", "mov ebx , " + first + " mov eax , " + std::to_string(block) + " " + counted_loop(
+      "sumn edx , [ ebx + 0 ] , eax "
+      "copyn [ ebx + 1 ] , [ ebx + 0 ] , eax", loop_iterations * body_repeat / block) });
+
+    //Conditional branch alternating between taken and not taken
+    result.push_back({ "branch_heavy", counted_loop(repeat(
+      "cmp edx , 0 "
+      "je .set_@ "
+      "mov edx , 0 "
+      "jmp .next_@ "
+      ":set_@ "
+      "mov edx , 1 "
+      ":next_@", body_repeat), loop_iterations) });
+
+    //Every copy of the body patches the immediate of its mov before executing it
+    result.push_back({ "self_modifying", "mov ebx , 2 " + counted_loop(repeat(
+      "mov [ ebx + .patch_@ ] , ecx "
+      ":patch_@ "
+      "mov edx , 0 "
+      "add eax , edx", body_repeat), loop_iterations) });
+
+    //Every copy of the body turns its mov into add before executing it and back after
+    result.push_back({ "self_modifying_opcode", "mov ebx , 0 " + counted_loop(repeat(
+      "jmp .patch_@ "
+      ":mov_@ "
+      "mov eax , ecx "
+      ":add_@ "
+      "add eax , ecx "
+      ":patch_@ "
+      "mov edx , [ ebx + .add_@ ] "
+      "mov [ ebx + .op_@ ] , edx "
+      ":op_@ "
+      "mov eax , ecx "
+      "mov edx , [ ebx + .mov_@ ] "
+      "mov [ ebx + .op_@ ] , edx", body_repeat), loop_iterations) });
+
+    for(auto& p : result)
+    {
+      //labels of single instance bodies
+      for(auto pos = p.source.find('@'); pos != std::string::npos; pos = p.source.find('@'))
+      {
+        p.source.replace(pos, 1u, "0");
+      }
+    }
+
+    return result;
+  }
+
+  //Least time between two reads of the clock, which every measured run includes
+  inline std::chrono::steady_clock::duration clock_overhead()
+  {
+    using clock = std::chrono::steady_clock;
+
+    auto least = clock::duration::max();
+    for(size_t i = 0u; i < 1000u; ++i)
+    {
+      const auto start = clock::now();
+      least = std::min(least, clock::now() - start);
+    }
+
+    return least;
+  }
+
+  //Only runs are measured, resets between them are not. Short runs after long resets
+  //stop at max_time of wall time. The clock overhead is taken off every run, or programs
+  //of a few instructions would measure mostly the clock
+  inline double measure(const runner& r, size_t& runs)
+  {
+    using clock = std::chrono::steady_clock;
+    constexpr auto min_time = std::chrono::milliseconds{ 200 };
+    constexpr auto max_time = std::chrono::seconds{ 2 };
+    static const auto overhead = clock_overhead();
+
+    runs = 0u;
+    volatile unit_t sink{};
+    clock::duration measured{};
+    const auto begin = clock::now();
+
+    while(measured < min_time && (runs == 0u || clock::now() - begin < max_time))
+    {
+      if(r.reset)
+      {
+        r.reset();
+      }
+
+      const auto start = clock::now();
+      sink = r.run();
+      measured += std::max(clock::now() - start - overhead, clock::duration::zero());
+      ++runs;
+    }
+
+    (void)sink;
+    return std::chrono::duration<double>(measured).count();
+  }
+
+  inline std::vector<result> run_all(const std::vector<size_t>& ram_sizes)
+  {
+    std::vector<result> results;
+
+    for(const auto amount_of_ram : ram_sizes)
+    {
+      for(const auto& p : programs(amount_of_ram))
+      {
+        const auto m = runtime::assembler{ amount_of_ram }.assemble(p.source);
+        const auto instructions = count_instructions(m);
+
+        for(const auto& e : engines())
+        {
+          const auto r = e.prepare(m);
+          if(!r.run)
+          {
+            continue;
+          }
+
+          size_t runs{ 0u };
+          const auto seconds = measure(r, runs);
+          results.push_back(result{ e.name, p.name, amount_of_ram, instructions * runs, seconds });
+        }
+      }
+    }
+
+    return results;
+  }
+
+  //One csv row per engine, program and amount of ram
+  inline void report(std::ostream& out, const std::vector<result>& results)
+  {
+    out << "engine,benchmark,amount_of_ram,instructions,seconds,ns_per_instruction,instructions_per_second\n";
+
+    for(const auto& r : results)
+    {
+      out << r.engine << ','
+          << r.name << ','
+          << r.amount_of_ram << ','
+          << r.instructions << ','
+          << r.seconds << ','
+          << r.seconds * 1e9 / static_cast<double>(r.instructions) << ','
+          << static_cast<double>(r.instructions) / r.seconds << '\n';
+    }
+  }
+
+  struct mismatch
+  {
+    std::string engine;
+    std::string name;
+    size_t amount_of_ram;
+    unit_t expected;
+    std::string result; // eax or the error the engine stopped with
+  };
+
+  //Runs every program once on every engine and compares eax with execute::execute
+  inline std::vector<mismatch> check_all(const std::vector<size_t>& ram_sizes, size_t& runs)
+  {
+    std::vector<mismatch> mismatches;
+    runs = 0u;
+
+    for(const auto amount_of_ram : ram_sizes)
+    {
+      for(const auto& p : programs(amount_of_ram))
+      {
+        const auto m = runtime::assembler{ amount_of_ram }.assemble(p.source);
+        const auto expected = execute::execute(m);
+
+        for(const auto& e : engines())
+        {
+          if(!e.matches_execute)
+          {
+            continue;
+          }
+
+          std::string result;
+
+          try
+          {
+            const auto r = e.prepare(m);
+            if(!r.run)
+            {
+              continue;
+            }
+
+            if(r.reset)
+            {
+              r.reset();
+            }
+
+            const auto value = r.run();
+            if(value == expected)
+            {
+              ++runs;
+              continue;
+            }
+
+            result = std::to_string(value);
+          }
+          catch(const std::exception& ex)
+          {
+            result = ex.what();
+          }
+
+          ++runs;
+          mismatches.push_back(mismatch{ e.name, p.name, amount_of_ram, expected, result });
+        }
+      }
+    }
+
+    return mismatches;
+  }
+}
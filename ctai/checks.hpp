@@ -0,0 +1,342 @@
+#pragma once
+
+#include "decoded.hpp"
+#include "runtime.hpp"
+#include "tier.hpp"
+#include "trace.hpp"
+
+#include <filesystem>
+#include <fstream>
+#include <functional>
+
+//Behaviour checked by ctai --check, next to the comparison of engines. A check throws
+//when the behaviour it covers is broken. What can be evaluated at compile time is
+//checked by static_asserts instead
+namespace checks
+{
+  struct check
+  {
+    std::string name;
+    std::function<void()> run;
+  };
+
+  struct failure
+  {
+    std::string name;
+    std::string what;
+  };
+
+  inline void expect(bool condition, const std::string& what)
+  {
+    if(!condition)
+    {
+      throw std::runtime_error{ what };
+    }
+  }
+
+  //f has to stop with an error containing message
+  template <typename f_t>
+  void expect_error(f_t f, std::string_view message)
+  {
+    try
+    {
+      f();
+    }
+    catch(const std::exception& e)
+    {
+      if(std::string_view{ e.what() }.find(message) == std::string_view::npos)
+      {
+        throw std::runtime_error{ "expected error \"" + std::string{ message } + "\", got \"" + e.what() + '"' };
+      }
+
+      return;
+    }
+
+    throw std::runtime_error{ "expected error \"" + std::string{ message } + "\"" };
+  }
+
+  //Registers, flags and ram
+  template <typename machine_t, typename machine2_t>
+  bool same_state(machine_t& a, machine2_t& b)
+  {
+    for(unit_t r = 0u; r <= static_cast<unit_t>(regs::reg::eip); ++r)
+    {
+      if(a.get_reg(r) != b.get_reg(r))
+      {
+        return false;
+      }
+    }
+
+    if(a.zf != b.zf || a.cf != b.cf || a.ram.size() != b.ram.size())
+    {
+      return false;
+    }
+
+    for(size_t i = 0u; i < a.ram.size(); ++i)
+    {
+      if(a.ram[i] != b.ram[i])
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  inline runtime::machine assemble(std::string_view source, size_t amount_of_ram = 1024u)
+  {
+    return runtime::assembler{ amount_of_ram }.assemble(source);
+  }
+
+  inline std::vector<check> assembler_checks()
+  {
+    return {
+      { "separators of instructions", []
+        {
+          expect_error([] { assemble("mov eax , 1\nmov eax x 7\nexit"); }, "line 2: expected ','");
+          expect_error([] { assemble("mov eax ] 7\nexit"); }, "line 1: expected ','");
+          expect_error([] { assemble("exit\nexit\nmov [ esp - 1 ] , 7"); }, "line 3: expected '+'");
+          expect_error([] { assemble("sumn eax , [ esp + 1 ) , ebx"); }, "line 1: expected ']'");
+          expect_error([] { assemble("copyn [ esp + 1 ] , esp + 2 ] , eax"); }, "line 1: expected '['");
+        } },
+      { "malformed programs", []
+        {
+          expect_error([] { assemble("mov eax , 1\nmove eax , 2"); }, "line 2: unknown instruction: move");
+          expect_error([] { assemble("mov eax , ebx\nmov eax , x"); }, "line 2: expected a number or a .label: x");
+          expect_error([] { assemble("inc 5"); }, "line 1: expected a register: 5");
+          expect_error([] { assemble("je .nowhere\nexit"); }, "line 1: unknown label: .nowhere");
+          expect_error([] { assemble("in eax , 99999"); }, "line 1: port out of range");
+          expect(assemble("mov eax , [ esp + 0 ]\nexit").ram[0] == instructions::instruction::mov_reg_mem_ptr_reg_plus_val, "well formed program rejected");
+        } },
+    };
+  }
+
+  //Stores, jumps and writes of every register
+  constexpr std::string_view traced_program =
+    "mov ebp , esp sub ebp , 8 mov ecx , 0 "
+    ":loop cmp ecx , 50 je .end "
+    "mov [ ebp + 1 ] , ecx add eax , [ ebp + 1 ] mov ebx , 3 filln [ ebp + 2 ] , ecx , ebx mov ebx , eax add edx , ebx inc ecx jmp .loop "
+    ":end exit";
+
+  inline std::vector<check> trace_checks()
+  {
+    return {
+      { "trace replays every step", []
+        {
+          const auto initial = assemble(traced_program);
+          trace::recorder rec;
+          auto executed = initial;
+          trace::run(executed, rec);
+
+          auto replayed = initial;
+          trace::replayer replayer{ rec.buffer() };
+          expect(replayer.replay(replayed, rec.steps() + 1u) == rec.steps(), "replay did not stop at the end of the trace");
+          expect(same_state(executed, replayed), "replayed state differs from the executed one");
+        } },
+      { "trace stops at given step", []
+        {
+          const auto initial = assemble(traced_program);
+          trace::recorder rec;
+          auto executed = initial;
+          trace::run(executed, rec);
+
+          auto stepped = initial;
+          for(size_t i = 0u; i < 100u; ++i)
+          {
+            if(execute::execute_next_instruction(stepped))
+            {
+              execute::adjust_eip(stepped);
+            }
+          }
+
+          auto replayed = initial;
+          expect(trace::replayer{ rec.buffer() }.replay(replayed, 100u) == 100u && same_state(stepped, replayed), "state after 100 steps differs");
+        } },
+      { "trace of another program", []
+        {
+          trace::recorder rec;
+          auto executed = assemble(traced_program);
+          trace::run(executed, rec);
+
+          auto other = assemble("mov eax , 1 exit");
+          expect_error([&] { trace::replayer{ rec.buffer() }.replay(other, rec.steps()); }, "trace does not match machine");
+        } },
+      { "truncated trace", []
+        {
+          trace::recorder rec;
+          auto executed = assemble(traced_program);
+          trace::run(executed, rec);
+
+          auto replayed = assemble(traced_program);
+          const auto records = rec.buffer();
+          expect_error([&] { trace::replayer{ records.substr(0u, records.size() - 1u) }.replay(replayed, rec.steps()); }, "truncated trace");
+        } },
+      { "not a trace", []
+        {
+          expect_error([] { trace::replayer{ "ctai" }; }, "not a trace");
+        } },
+      { "trace ring keeps the last steps", []
+        {
+          const auto initial = assemble(traced_program);
+          trace::ring<runtime::machine> ring{ initial, 64u };
+          auto executed = initial;
+          trace::run(executed, ring);
+
+          expect(ring.first_step() > 0u, "ring kept every step");
+
+          for(const auto step : { ring.first_step(), (ring.first_step() + ring.steps()) / 2u, ring.steps() })
+          {
+            auto stepped = initial;
+            for(size_t i = 0u; i < step; ++i)
+            {
+              if(execute::execute_next_instruction(stepped))
+              {
+                execute::adjust_eip(stepped);
+              }
+            }
+
+            auto kept = ring.at(step);
+            expect(same_state(stepped, kept), "state at step " + std::to_string(step) + " differs");
+          }
+
+          expect_error([&] { ring.at(ring.first_step() - 1u); }, "step not kept");
+        } },
+      { "trace ring file replays from the initial machine", []
+        {
+          const auto initial = assemble(traced_program);
+          trace::ring<runtime::machine> ring{ initial, 64u };
+          auto executed = initial;
+          trace::run(executed, ring);
+
+          const auto path = std::filesystem::temp_directory_path() / "ctai_ring_check.bin";
+          ring.write(path.string().c_str());
+          std::ifstream file{ path, std::ios::binary };
+          const std::string records{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+          std::filesystem::remove(path);
+
+          auto replayed = initial;
+          trace::replayer replayer{ records };
+          expect(replayer.first_step() == ring.first_step(), "file does not start at the first kept step");
+          expect(replayer.replay(replayed, ring.steps()) == ring.steps() && same_state(executed, replayed), "replayed state differs from the executed one");
+
+          auto early = initial;
+          expect_error([&] { trace::replayer{ records }.replay(early, ring.first_step() - 1u); }, "before the first step of the trace");
+        } },
+      { "trace ring of zero bytes", []
+        {
+          expect_error([] { trace::ring<runtime::machine>{ assemble("exit"), 0u }; }, "chunk size");
+        } },
+    };
+  }
+
+  inline std::vector<check> source_map_checks()
+  {
+    return {
+      { "source map of times", []
+        {
+          const auto map = runtime::map_source("jmp .s\n:d\ntimes 1000 dw 3\n:s\nexit\n");
+          const auto exit = map.find(1002u);
+
+          expect(exit != nullptr && exit->line == 5u && map.label(*exit) == "s", "exit after times not mapped to line 5 and :s");
+        } },
+    };
+  }
+
+  inline std::vector<check> decoded_checks()
+  {
+    return {
+      { "decoded code written past the image", []
+        {
+          //mov eax , 7 written at 900, run, patched to mov eax , 9 and run again
+          const auto w = [](auto v) { return std::to_string(static_cast<unit_t>(v)); };
+          const auto initial = assemble(
+            "mov ebx , 900 mov [ ebx + 0 ] , " + w(instructions::instruction::mov_reg_val) + " mov [ ebx + 1 ] , " + w(regs::reg::eax) + " "
+            "mov [ ebx + 2 ] , 7 mov [ ebx + 3 ] , " + w(instructions::instruction::jmp) + " mov [ ebx + 4 ] , .back jmp 900 "
+            ":back mov [ ebx + 2 ] , 9 cmp ecx , 1 je .end inc ecx jmp 900 :end exit");
+
+          auto checked = initial;
+          execute::run_checked(checked);
+
+          auto cached = initial;
+          decoded::cache<runtime::machine> cache{ cached };
+          cache.run();
+          expect(same_state(checked, cached) && cached.eax() == 9u, "decoded state differs from the checked one");
+          expect(cache.patches() == 2u, "patches: " + std::to_string(cache.patches()));
+        } },
+    };
+  }
+
+  //Loop of 5000 iterations whose body is given
+  inline std::string hot_loop(std::string_view body)
+  {
+    return "mov ebp , esp sub ebp , 8 mov ecx , 0 :loop cmp ecx , 5000 je .end " + std::string{ body } + " inc ecx jmp .loop :end exit";
+  }
+
+  inline std::vector<check> tier_checks()
+  {
+    const auto run = [](std::string_view source, size_t expected_loops)
+    {
+      const auto initial = assemble(source);
+      auto checked = initial;
+      execute::run_checked(checked);
+
+      auto tiered = initial;
+      tier::runner<runtime::machine> runner{ tiered, tier::default_threshold };
+      runner.run();
+      expect(same_state(checked, tiered), "tiered state differs from the checked one");
+      expect(runner.compiled_loops() == expected_loops, "compiled loops: " + std::to_string(runner.compiled_loops()));
+    };
+
+    if(!jit::host_supported)
+    {
+      return {};
+    }
+
+    return {
+      { "tier compiles hot loops", [run]
+        {
+          run(hot_loop("add eax , ecx mov [ ebp + 1 ] , eax mov ebx , 3 filln [ ebp + 2 ] , ecx , ebx"), 1u);
+        } },
+      { "tier interprets loops storing into code", [run]
+        {
+          run(hot_loop("mov ebx , 2 mov [ ebx + .patch ] , ecx :patch mov edx , 0 add eax , edx"), 0u);
+        } },
+      { "tier of an invalid program", []
+        {
+          auto tiered = assemble(hot_loop("mov eax , [ ecx + 2000 ]"));
+          expect_error([&] { tier::runner<runtime::machine>{ tiered, tier::default_threshold }.run(); }, "out of ram");
+        } },
+    };
+  }
+
+  inline std::vector<check> all()
+  {
+    std::vector<check> result;
+
+    for(auto&& group : { assembler_checks(), trace_checks(), source_map_checks(), decoded_checks(), tier_checks() })
+    {
+      result.insert(result.end(), group.begin(), group.end());
+    }
+
+    return result;
+  }
+
+  inline std::vector<failure> run_all()
+  {
+    std::vector<failure> failures;
+
+    for(const auto& c : all())
+    {
+      try
+      {
+        c.run();
+      }
+      catch(const std::exception& e)
+      {
+        failures.push_back(failure{ c.name, e.what() });
+      }
+    }
+
+    return failures;
+  }
+}
@@ -0,0 +1,475 @@
+#include "cli.hpp"
+#include "bench.hpp"
+#include "checks.hpp"
+#include "fib.hpp"
+#include "runtime.hpp"
+#include "object.hpp"
+#include "trace.hpp"
+#include "profile.hpp"
+#include "snapshot.hpp"
+#include "jit.hpp"
+#include "tier.hpp"
+#include "multicore.hpp"
+#include "scheduler.hpp"
+
+#include <iostream>
+#include <chrono>
+#include <fstream>
+
+namespace cli
+{
+  inline bool is_object_file(const char* path)
+  {
+    const runtime::mapped_file file{ path };
+    return object::is_object(file.view());
+  }
+
+  //Port 0 reads words from stdin, other ports have no input
+  inline void stdin_refill(unit_t port, io::ring_buffer& buffer)
+  {
+    if(port != 0u)
+    {
+      return;
+    }
+
+    std::vector<unit_t> words;
+    unit_t value;
+    while(words.size() < buffer.capacity() - buffer.size() && std::cin >> value)
+    {
+      words.push_back(value);
+    }
+
+    buffer.write(words.data(), words.size());
+  }
+
+  //Every port writes to stdout, a word per line
+  inline void stdout_drain(unit_t, io::ring_buffer& buffer)
+  {
+    std::vector<unit_t> words(buffer.size());
+    buffer.read(words.data(), words.size());
+
+    std::string text;
+    for(const auto w : words)
+    {
+      text += std::to_string(w);
+      text += '\n';
+    }
+
+    std::cout << text;
+  }
+
+  inline runtime::machine load(const char* path, size_t amount_of_ram)
+  {
+    return is_object_file(path)
+           ? object::load(path)
+           : runtime::load(path, amount_of_ram);
+  }
+
+  //Hottest lines with their text and hottest labels
+  inline std::string format_report(const profile::report& r, uint64_t total, std::string_view source)
+  {
+    constexpr size_t shown = 10u;
+
+    const auto percent = [&](uint64_t count)
+    {
+      return std::to_string(total == 0u ? 0u : count * 1000u / total / 10u) + '.' + std::to_string(total == 0u ? 0u : count * 1000u / total % 10u) + '%';
+    };
+
+    std::string text = "samples " + std::to_string(total) + '\n';
+
+    for(size_t i = 0u; i < std::min(shown, r.lines.size()); ++i)
+    {
+      const auto& l = r.lines[i];
+
+      //Text of the line, the source is not modified since it was assembled
+      size_t begin{ 0u };
+      for(size_t line = 1u; line < l.line; ++line)
+      {
+        begin = source.find('\n', begin) + 1u;
+      }
+      const auto end = std::min(source.find('\n', begin), source.size());
+
+      text += "line " + std::to_string(l.line) + ' ' + percent(l.samples) + ' ' + std::string{ source.substr(begin, end - begin) } + '\n';
+    }
+
+    for(size_t i = 0u; i < std::min(shown, r.labels.size()); ++i)
+    {
+      const auto& l = r.labels[i];
+      text += "label " + (l.label.empty() ? std::string{ "-" } : ':' + l.label) + ' ' + percent(l.samples) + '\n';
+    }
+
+    if(r.unmapped != 0u)
+    {
+      text += "unmapped " + percent(r.unmapped) + '\n';
+    }
+
+    return text;
+  }
+
+  int run(int argc, char* argv[])
+  {
+    const std::string_view command{ argv[1] };
+
+    if(command == "--io")
+    {
+      if(argc < 3)
+      {
+        throw std::runtime_error{ "usage: ctai --io <program> [amount_of_ram]" };
+      }
+
+      const size_t amount_of_ram = argc > 3 ? std::stoull(argv[3]) : 1024u;
+      auto m = load(argv[2], amount_of_ram);
+
+      io::ports ports;
+      ports.refill = stdin_refill;
+      ports.drain = stdout_drain;
+      m.ports = &ports;
+
+      verify::execute(std::move(m));
+      ports.flush();
+      return 0;
+    }
+
+    if(command == "--schedule")
+    {
+      if(argc < 4)
+      {
+        throw std::runtime_error{ "usage: ctai --schedule <program> <machines> [slice] [amount_of_ram]" };
+      }
+
+      const size_t machines = std::stoull(argv[3]);
+      const size_t slice = argc > 4 ? std::stoull(argv[4]) : 1000u;
+      const size_t amount_of_ram = argc > 5 ? std::stoull(argv[5]) : 1024u;
+
+      if(machines == 0u)
+      {
+        return 0;
+      }
+
+      const auto m = load(argv[2], amount_of_ram);
+
+      //Every machine gets its index in edx, so the proof has to hold for all of them
+      auto initial = verify::get_registers(m);
+      initial[static_cast<size_t>(regs::reg::edx)] = { 0u, machines - 1u };
+      const auto policy = verify::check(m, initial).policy();
+
+      scheduler::round_robin scheduler{ slice };
+      for(size_t i = 0u; i < machines; ++i)
+      {
+        auto copy = m;
+        copy.edx() = i;
+        scheduler.add(std::move(copy), policy);
+      }
+
+      scheduler.run();
+
+      for(size_t i = 0u; i < machines; ++i)
+      {
+        std::cout << i << ' ' << scheduler.result(i) << '\n';
+      }
+
+      return 0;
+    }
+
+    if(command == "--multicore")
+    {
+      if(argc < 3)
+      {
+        throw std::runtime_error{ "usage: ctai --multicore <program> [amount_of_ram]" };
+      }
+
+      const size_t amount_of_ram = argc > 3 ? std::stoull(argv[3]) : 1024u;
+      auto m = load(argv[2], amount_of_ram);
+
+      std::cout << multicore::execute(m) << '\n';
+      return 0;
+    }
+
+    if(command == "--verify")
+    {
+      if(argc < 3)
+      {
+        throw std::runtime_error{ "usage: ctai --verify <program> [amount_of_ram]" };
+      }
+
+      const size_t amount_of_ram = argc > 3 ? std::stoull(argv[3]) : 1024u;
+      const auto report = verify::check(load(argv[2], amount_of_ram));
+
+      std::cout << "code in range " << report.code_in_range
+                << " memory in range " << report.memory_in_range
+                << " writes code " << report.writes_code << '\n';
+
+      if(!report.verified())
+      {
+        std::cout << "not verified at " << report.failed_ip << ", executed checked\n";
+      }
+
+      return 0;
+    }
+
+    if(command == "--jit")
+    {
+      if(argc < 3)
+      {
+        throw std::runtime_error{ "usage: ctai --jit <program> [amount_of_ram]" };
+      }
+
+      const size_t amount_of_ram = argc > 3 ? std::stoull(argv[3]) : 1024u;
+      std::cout << jit::execute(promote::promote(load(argv[2], amount_of_ram)).m) << '\n';
+      return 0;
+    }
+
+    if(command == "--fib")
+    {
+      if(argc < 3)
+      {
+        throw std::runtime_error{ "usage: ctai --fib <n>" };
+      }
+
+      const auto n = std::stoull(argv[2]);
+      std::cout << verify::execute(fib_machine, execute::inputs{}.reg(regs::reg::edx, n)) << '\n';
+      return 0;
+    }
+
+    if(command == "--first-write")
+    {
+      if(argc < 4)
+      {
+        throw std::runtime_error{ "usage: ctai --first-write <program> <address> [amount_of_ram]" };
+      }
+
+      const size_t address = std::stoull(argv[3]);
+      const size_t amount_of_ram = argc > 4 ? std::stoull(argv[4]) : 1024u;
+      if(address >= amount_of_ram)
+      {
+        throw std::out_of_range{ "address out of ram: " + std::to_string(address) };
+      }
+
+      snapshot::timeline timeline{ snapshot::from(load(argv[2], amount_of_ram)), 1024u };
+      const auto initial = timeline.current().ram[address];
+      timeline.run();
+
+      const auto step = timeline.bisect([&](const auto& m) { return m.ram[address] != initial; });
+      if(!step)
+      {
+        std::cout << "never written\n";
+        return 0;
+      }
+
+      std::cout << "step " << *step << " eip " << timeline.current().eip() << '\n';
+      return 0;
+    }
+
+    if(command == "--trace")
+    {
+      if(argc < 4)
+      {
+        throw std::runtime_error{ "usage: ctai --trace <program> <trace.bin> [amount_of_ram] [chunk_bytes]" };
+      }
+
+      const size_t amount_of_ram = argc > 4 ? std::stoull(argv[4]) : 1024u;
+      auto m = load(argv[2], amount_of_ram);
+
+      if(argc <= 5)
+      {
+        trace::recorder rec{ argv[3] };
+        std::cout << trace::execute(std::move(m), rec) << '\n';
+        return 0;
+      }
+
+      //Keeps the last steps only, written also when the program stops with an error
+      trace::ring<runtime::machine> ring{ m, std::stoull(argv[5]) };
+      try
+      {
+        const auto result = trace::execute(std::move(m), ring);
+        ring.write(argv[3]);
+        std::cout << result << '\n';
+      }
+      catch(...)
+      {
+        ring.write(argv[3]);
+        throw;
+      }
+
+      return 0;
+    }
+
+    if(command == "--heatmap" || command == "--working-set")
+    {
+      if(argc < 3)
+      {
+        throw std::runtime_error{ "usage: ctai " + std::string{ command } + " <program> [" + (command == "--heatmap" ? "words_per_bucket" : "window") + "] [amount_of_ram]" };
+      }
+
+      const size_t param = argc > 3 ? std::stoull(argv[3]) : (command == "--heatmap" ? 1u : 1000u);
+      const size_t amount_of_ram = argc > 4 ? std::stoull(argv[4]) : 1024u;
+      const auto m = load(argv[2], amount_of_ram);
+
+      profile::recorder rec{ m.ram.size(), command == "--heatmap" ? 1000u : param };
+      profile::execute(m, rec);
+
+      std::string text;
+      if(command == "--heatmap")
+      {
+        text = "address,loads,stores,first_step,last_step\n";
+
+        const auto buckets = rec.buckets(param);
+        for(size_t i = 0u; i < buckets.size(); ++i)
+        {
+          const auto& b = buckets[i];
+          if(b.touched())
+          {
+            text += std::to_string(i * param) + ',' + std::to_string(b.loads) + ',' + std::to_string(b.stores) + ','
+                  + std::to_string(b.first_step) + ',' + std::to_string(b.last_step) + '\n';
+          }
+        }
+      }
+      else
+      {
+        text = "step,words\n";
+
+        const auto& ws = rec.working_set();
+        for(size_t i = 0u; i < ws.size(); ++i)
+        {
+          const auto end = std::min<uint64_t>((i + 1u) * rec.window(), rec.steps());
+          text += std::to_string(end) + ',' + std::to_string(ws[i]) + '\n';
+        }
+      }
+
+      std::cout << text;
+      return 0;
+    }
+
+    if(command == "--profile" || command == "--profile-timer")
+    {
+      const auto timed = command == "--profile-timer";
+      if(argc < 3)
+      {
+        throw std::runtime_error{ "usage: ctai " + std::string{ command } + " <program.asm> [" + (timed ? "interval_us" : "period") + "] [amount_of_ram]" };
+      }
+
+      if(is_object_file(argv[2]))
+      {
+        throw std::runtime_error{ "profiling needs the assembly source" };
+      }
+
+      const size_t param = argc > 3 ? std::stoull(argv[3]) : (timed ? 1000u : 101u);
+      const size_t amount_of_ram = argc > 4 ? std::stoull(argv[4]) : 1024u;
+
+      const runtime::mapped_file file{ argv[2] };
+      runtime::source_map map;
+      const auto m = runtime::assembler{ amount_of_ram }.assemble(file.view(), &map);
+
+      profile::samples samples{ m.ram.size() };
+      const auto result = timed
+                          ? profile::execute_timed(m, std::chrono::microseconds{ param }, samples)
+                          : profile::execute_sampled(m, param, samples);
+
+      std::cout << format_report(profile::summarize(samples, map), samples.total(), file.view())
+                << "eax " << result << '\n';
+      return 0;
+    }
+
+    if(command == "--replay")
+    {
+      if(argc < 5)
+      {
+        throw std::runtime_error{ "usage: ctai --replay <program> <trace.bin> <step> [amount_of_ram]" };
+      }
+
+      const size_t amount_of_ram = argc > 5 ? std::stoull(argv[5]) : 1024u;
+      auto m = load(argv[2], amount_of_ram);
+      const runtime::mapped_file records{ argv[3] };
+      trace::replayer replayer{ records.view() };
+
+      const auto replayed = replayer.replay(m, std::stoull(argv[4]));
+
+      std::cout << "step " << replayed
+                << " eip " << m.eip()
+                << " eax " << m.eax()
+                << " ebx " << m.ebx()
+                << " ecx " << m.ecx()
+                << " edx " << m.edx()
+                << " ebp " << m.ebp()
+                << " esp " << m.esp()
+                << " zf " << m.zf << '\n';
+      return 0;
+    }
+
+    if(command == "--check")
+    {
+      size_t runs{ 0u };
+      const auto mismatches = bench::check_all({ 1024u, 65536u, 1048576u }, runs);
+
+      for(const auto& m : mismatches)
+      {
+        std::cout << m.engine << ' ' << m.name << ' ' << m.amount_of_ram
+                  << " expected " << m.expected << " got " << m.result << '\n';
+      }
+
+      const auto checked = checks::all().size();
+      const auto failures = checks::run_all();
+
+      for(const auto& f : failures)
+      {
+        std::cout << "check " << f.name << ": " << f.what << '\n';
+      }
+
+      std::cout << runs << " runs, " << mismatches.size() << " mismatches\n"
+                << checked << " checks, " << failures.size() << " failed\n";
+      return mismatches.empty() && failures.empty() ? 0 : 1;
+    }
+
+    if(command == "--bench")
+    {
+      //Opened first, so a bad path is reported before the benchmarks run
+      std::ofstream file;
+      if(argc > 2)
+      {
+        file.open(argv[2]);
+        if(!file)
+        {
+          throw std::runtime_error{ std::string{ "can not create " } + argv[2] };
+        }
+      }
+
+      const auto results = bench::run_all({ 1024u, 65536u, 1048576u });
+
+      if(argc > 2)
+      {
+        bench::report(file, results);
+        file.close();
+
+        if(!file)
+        {
+          throw std::runtime_error{ std::string{ "can not write " } + argv[2] };
+        }
+      }
+      else
+      {
+        bench::report(std::cout, results);
+      }
+
+      return 0;
+    }
+
+    if(command == "--compile")
+    {
+      if(argc < 4)
+      {
+        throw std::runtime_error{ "usage: ctai --compile <program.asm> <program.ctai> [amount_of_ram]" };
+      }
+
+      const size_t amount_of_ram = argc > 4 ? std::stoull(argv[4]) : 1024u;
+      object::write(argv[3], runtime::load(argv[2], amount_of_ram));
+      return 0;
+    }
+
+    const size_t amount_of_ram = argc > 2 ? std::stoull(argv[2]) : 1024u;
+
+    auto m = promote::promote(load(argv[1], amount_of_ram)).m;
+    std::cout << tier::execute(std::move(m)) << '\n';
+
+    return 0;
+  }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+namespace cli
+{
+  //ctai <program.asm | program.ctai> [amount_of_ram]
+  //ctai --compile <program.asm> <program.ctai> [amount_of_ram]
+  //ctai --bench [results.csv]
+  //ctai --trace <program> <trace.bin> [amount_of_ram] [chunk_bytes]
+  //ctai --replay <program> <trace.bin> <step> [amount_of_ram]
+  //ctai --first-write <program> <address> [amount_of_ram]
+  //ctai --fib <n>
+  //ctai --check
+  //ctai --verify <program> [amount_of_ram]
+  //ctai --multicore <program> [amount_of_ram]
+  //ctai --schedule <program> <machines> [slice] [amount_of_ram]
+  //ctai --io <program> [amount_of_ram]
+  //ctai --jit <program> [amount_of_ram]
+  //ctai --heatmap <program> [words_per_bucket] [amount_of_ram]
+  //ctai --profile <program.asm> [period] [amount_of_ram]
+  //ctai --profile-timer <program.asm> [interval_us] [amount_of_ram]
+  //ctai --working-set <program> [window] [amount_of_ram]
+  int run(int argc, char* argv[]);
+}
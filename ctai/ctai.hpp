@@ -0,0 +1,5636 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <algorithm>
+#include <type_traits>
+#include <array>
+#include <string_view>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cstring>
+#include <functional>
+#include <concepts>
+#include <span>
+#include <utility>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+//unit used in machine for memory cells, registers etc.
+using unit_t = uint64_t;
+
+namespace traits
+{
+  template <typename... types>
+  constexpr auto all_true = std::conjunction<types...>::value;
+}
+
+namespace algo
+{
+  template <typename it_t, typename dit_t>
+  constexpr void copy(it_t first, it_t last, dit_t d_first)
+  {
+    while (first != last) 
+    {
+      *d_first++ = *first++;
+    }
+  }
+
+  template <typename it_t, typename value_t>
+  constexpr void fill(it_t first,it_t last, const value_t& value)
+  {
+    while (first != last) 
+    {
+      *first++ = value;
+    }
+  }
+
+  template <typename it_t, typename value_t>
+  constexpr size_t count(it_t first, it_t last, const value_t& value)
+  {
+    size_t result{ 0u };
+    while (first != last) 
+    {
+      result += *first++ == value;
+    }
+    return result;
+  }
+
+  template <typename it_t, typename it2_t>
+  constexpr bool equal(it_t first, it_t last, it2_t first2)
+  {
+    while(first != last)
+    {
+      if(!(*first++ == *first2++))
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  template <typename it_t>
+  constexpr void iter_swap(it_t lhs, it_t rhs)
+  {
+    const auto tmp = *rhs;
+    *rhs = *lhs;
+    *lhs = tmp;
+  }
+
+  template <typename it_t>
+  constexpr void reverse(it_t first, it_t last)
+  {
+    while ((first != last) && (first != --last)) 
+    {
+      iter_swap(first++, last);
+    }
+  }
+
+  template <typename it_t>
+  constexpr it_t next(it_t iterator, int n = 1)
+  {
+    return iterator + n;
+  }
+
+  template <typename it_t>
+  constexpr it_t prev(it_t iterator, int n = 1)
+  {
+    return next(iterator, -n);
+  }
+
+  template <typename it_t>
+  constexpr void advance(it_t &iterator, int n = 1)
+  {
+    iterator += n;
+  }
+
+  template <typename it_t, typename predicate_t>
+  constexpr auto find_if(it_t first, it_t last, predicate_t pred)
+  {
+    for(; first != last; ++first)
+    {
+      if(pred(*first))
+      {
+        return first;
+      }
+    }
+
+    return last;
+  }
+}
+
+template <typename ty, size_t n>
+class vector
+{
+public:
+  constexpr size_t size() const
+  {
+    return m_size;
+  }
+
+  constexpr auto begin()
+  {
+    return m_arr.begin();
+  }
+
+  constexpr auto begin() const
+  {
+    return m_arr.begin();
+  }
+
+  constexpr auto end()
+  {
+    return begin() + size();
+  }
+
+  constexpr auto end() const
+  {
+    return begin() + size();
+  }
+
+  constexpr auto front() const
+  {
+    return *begin();
+  }
+
+  constexpr auto push_back(const ty& val)
+  {
+    m_arr[m_size++] = val;
+  }
+
+  constexpr auto pop_back()
+  {
+    --m_size;
+  }
+
+  constexpr decltype(auto) operator[](size_t i)
+  {
+    return m_arr[i];
+  }
+
+  constexpr decltype(auto) operator[](size_t i) const
+  {
+    return m_arr[i];
+  }
+
+  template <size_t rhs_n>
+  constexpr auto operator==(const vector<ty, rhs_n>& rhs) const
+  {
+    return size() == rhs.size()
+        && algo::equal(begin(), end(), rhs.begin());
+  }
+
+  constexpr auto resize_to_reserved()
+  {
+    m_size = n;
+  }
+
+protected:
+  constexpr auto reserved_end()
+  {
+    return m_arr.end();
+  }
+  constexpr auto reserved_end() const
+  {
+    return m_arr.end();
+  }
+
+private:
+  std::array<ty, n> m_arr{};
+  size_t m_size{ 0u };
+};
+
+template <size_t n>
+class fixed_string : public vector<char, n>
+{
+private:
+  using base = vector<char, n>;
+
+public:
+  constexpr fixed_string()
+  {
+    algo::fill(base::begin(), base::reserved_end(), '\0');
+  }
+
+  template <typename... ts>
+  constexpr fixed_string(ts... args)
+  {
+    static_assert(traits::all_true<std::is_same<ts, char>...>);
+
+    for(const auto c : { args... })
+    {
+      base::push_back(c);
+    }
+  }
+};
+
+
+template <typename... ts>
+fixed_string(ts...) -> fixed_string<sizeof...(ts) + 1u>; // +1 for '\0'
+
+//lets runtime tokens (views into a source buffer) be compared with the tokens:: constants
+template <size_t n>
+constexpr bool operator==(std::string_view lhs, const vector<char, n>& rhs)
+{
+  return lhs.size() == rhs.size()
+      && algo::equal(lhs.begin(), lhs.end(), rhs.begin());
+}
+
+using string = fixed_string<10u>;
+
+template <typename T, T... args>
+constexpr auto operator"" _s()
+{
+  return fixed_string{ args... };
+}
+
+namespace algo
+{
+  template <typename string_t>
+  constexpr bool is_number(const string_t& str)
+  {
+    if(str.size() == 0u)
+    {
+      return false;
+    }
+
+    for(const char c : str)
+    {
+      if(c < '0' || c > '9')
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  template <typename string_t>
+  constexpr size_t stoui(const string_t& str)
+  {
+    if(!is_number(str))
+    {
+      throw std::invalid_argument{ "invalid number: " + std::string{ str.begin(), str.end() } };
+    }
+
+    size_t result{ 0u };
+
+    for(const char c : str)
+    {
+      const auto digit = static_cast<size_t>(c - '0');
+      if(result > (static_cast<size_t>(-1) - digit) / 10u)
+      {
+        throw std::out_of_range{ "number out of range: " + std::string{ str.begin(), str.end() } };
+      }
+
+      result *= 10u;
+      result += digit;
+    }
+
+    return result;
+  }
+}
+
+namespace tokens
+{
+  constexpr auto exit = "exit"_s;
+  constexpr auto mov = "mov"_s;
+  constexpr auto sub = "sub"_s;
+  constexpr auto add = "add"_s;
+  constexpr auto cmp = "cmp"_s;
+  constexpr auto je = "je"_s;
+  constexpr auto jmp = "jmp"_s;
+  constexpr auto inc = "inc"_s;
+  constexpr auto adc = "adc"_s;
+  constexpr auto sbb = "sbb"_s;
+  constexpr auto addn = "addn"_s;
+  constexpr auto subn = "subn"_s;
+  constexpr auto copyn = "copyn"_s;
+  constexpr auto filln = "filln"_s;
+  constexpr auto cmpn = "cmpn"_s;
+  constexpr auto sumn = "sumn"_s;
+  constexpr auto xadd = "xadd"_s;
+  constexpr auto cmpxchg = "cmpxchg"_s;
+  constexpr auto fence = "fence"_s;
+  constexpr auto spawn = "spawn"_s;
+  constexpr auto yield = "yield"_s;
+  constexpr auto in = "in"_s;
+  constexpr auto out = "out"_s;
+  constexpr auto ins = "ins"_s;
+  constexpr auto outs = "outs"_s;
+  constexpr auto dw = "dw"_s;
+  constexpr auto times = "times"_s;
+
+  constexpr auto comma = ","_s;
+  constexpr auto open_square_bracket = "["_s;
+  constexpr auto close_square_bracket = "]"_s;
+  constexpr auto plus = "+"_s;
+
+  constexpr auto eax = "eax"_s;
+  constexpr auto ebx = "ebx"_s;
+  constexpr auto ecx = "ecx"_s;
+  constexpr auto edx = "edx"_s;
+
+  constexpr auto esp = "esp"_s;
+  constexpr auto ebp = "ebp"_s;
+}
+
+template <size_t tokens_count>
+class tokenizer
+{
+public:
+
+  template <typename string_t>
+  constexpr auto tokenize(string_t str) const
+  {
+    using tokens_t = vector<string, tokens_count>;
+
+    tokens_t tokens;
+    auto iter = str.begin();
+
+    for(size_t i = 0u; i < tokens_count; ++i)
+    {
+      auto token = get_token(iter);
+      tokens.push_back(token);
+
+      algo::advance(iter, token.size() + 1u); //+1 to omit space
+    }
+
+    return tokens;
+  }
+
+private:
+  constexpr auto get_token(const char* ptr) const
+  {
+    string str;
+
+    while(*ptr != ' ' && *ptr != '\0')
+    {
+      str.push_back(*ptr++);
+    }
+
+    return str;
+  }
+};
+
+namespace regs
+{
+  using reg_t = unit_t;
+
+  enum class reg
+  {
+      eax,
+      ebx,
+      ecx,
+      edx,
+      ebp,
+      esp,
+
+      //Virtual registers. They have no names in assembly, memory words are promoted to
+      //them (see promote)
+      v0,
+      v1,
+      v2,
+      v3,
+      v4,
+      v5,
+      v6,
+      v7,
+
+      eip,
+
+      undef
+  };
+
+  constexpr size_t virtual_regs_count = static_cast<size_t>(reg::eip) - static_cast<size_t>(reg::v0);
+
+  template <typename reg_t>
+  constexpr auto to_unit_t(reg_t r)
+  {
+      return static_cast<unit_t>(r);
+  }
+
+  template <typename token_t>
+  constexpr reg token_to_reg(token_t token)
+  {
+      if(token == tokens::eax) return reg::eax;
+      if(token == tokens::ebx) return reg::ebx;
+      if(token == tokens::ecx) return reg::ecx;
+      if(token == tokens::edx) return reg::edx;
+      if(token == tokens::ebp) return reg::ebp;
+      if(token == tokens::esp) return reg::esp;
+
+      return reg::undef;
+  }
+}
+
+namespace instructions
+{
+  enum instruction
+  {
+    none,
+
+    je,                           // je ip
+    jmp,                          // jmp ip
+    cmp,                          // cmp reg , val
+    add_reg_mem_ptr_reg_plus_val, // add reg , [ reg2 + val ]
+    sub_reg_val,                  // sub reg , val
+    mov_mem_reg_ptr_reg_plus_val, // mov [ reg + val ] , reg2
+    mov_mem_val_ptr_reg_plus_val, // mov [ reg + val ] , val2
+    mov_reg_mem_ptr_reg_plus_val, // mov reg , [ reg2 + val ]
+    mov_reg_reg,                  // mov reg , reg2
+    mov_reg_val,                  // mov reg , val
+    inc,                          // inc reg
+    exit,                         // exit
+    adc_reg_reg,                  // adc reg , reg2
+    sbb_reg_reg,                  // sbb reg , reg2
+    addn,                         // addn reg , reg2 , reg3
+    subn,                         // subn reg , reg2 , reg3
+    xadd_mem_ptr_reg_plus_val_reg,    // xadd [ reg + val ] , reg2
+    cmpxchg_mem_ptr_reg_plus_val_reg, // cmpxchg [ reg + val ] , reg2
+    fence,                        // fence
+    spawn_reg_ip,                 // spawn reg , ip
+    yield,                        // yield
+    in_reg_port,                  // in reg , port
+    out_port_reg,                 // out port , reg
+    ins_reg_reg_port,             // ins reg , reg2 , port
+    outs_port_reg_reg,            // outs port , reg , reg2
+    add_reg_reg,                  // add reg , reg2
+    copyn,                        // copyn [ reg + val ] , [ reg2 + val2 ] , reg3
+    filln,                        // filln [ reg + val ] , reg2 , reg3
+    cmpn,                         // cmpn [ reg + val ] , [ reg2 + val2 ] , reg3
+    sumn,                         // sumn reg , [ reg2 + val ] , reg3
+
+    instruction_count
+  };
+
+  constexpr size_t get_ip_change(instruction inst)
+  {
+    switch(inst)
+    {
+      case je: return 2u;                           // je ip
+      case jmp: return 2u;                          // jmp ip
+      case cmp: return 3u;                          // cmp reg val
+      case add_reg_mem_ptr_reg_plus_val: return 4u; // add reg reg2 val
+      case sub_reg_val: return 3u;                  // sub reg val
+      case mov_mem_reg_ptr_reg_plus_val: return 4u; // mov reg val reg2
+      case mov_mem_val_ptr_reg_plus_val: return 4u; // mov reg val val2
+      case mov_reg_mem_ptr_reg_plus_val: return 4u; // mov reg reg2 val
+      case mov_reg_reg: return 3u;                  // mov reg reg2
+      case mov_reg_val: return 3u;                  // mov reg val
+      case inc: return 2u;                          // inc reg
+      case exit: return 1u;                         // exit
+      case adc_reg_reg: return 3u;                  // adc reg reg2
+      case sbb_reg_reg: return 3u;                  // sbb reg reg2
+      case addn: return 4u;                         // addn reg reg2 reg3
+      case subn: return 4u;                         // subn reg reg2 reg3
+      case xadd_mem_ptr_reg_plus_val_reg: return 4u;    // xadd reg val reg2
+      case cmpxchg_mem_ptr_reg_plus_val_reg: return 4u; // cmpxchg reg val reg2
+      case fence: return 1u;                        // fence
+      case spawn_reg_ip: return 3u;                 // spawn reg ip
+      case yield: return 1u;                        // yield
+      case in_reg_port: return 3u;                  // in reg port
+      case out_port_reg: return 3u;                 // out port reg
+      case ins_reg_reg_port: return 4u;             // ins reg reg2 port
+      case outs_port_reg_reg: return 4u;            // outs port reg reg2
+      case add_reg_reg: return 3u;                  // add reg reg2
+      case copyn: return 6u;                        // copyn reg val reg2 val2 reg3
+      case filln: return 5u;                        // filln reg val reg2 reg3
+      case cmpn: return 6u;                         // cmpn reg val reg2 val2 reg3
+      case sumn: return 5u;                         // sumn reg reg2 val reg3
+
+      default: return 0u;
+    }
+  }
+
+  constexpr size_t get_token_count(instruction inst)
+  {
+    switch(inst)
+    {
+      case je: return 2u;                           // je ip
+      case jmp: return 2u;                          // jmp ip
+      case cmp: return 4u;                          // cmp reg , val
+      case add_reg_mem_ptr_reg_plus_val: return 8u; // add reg , [ reg2 + val ]
+      case sub_reg_val: return 4u;                  // sub reg , val
+      case mov_mem_reg_ptr_reg_plus_val: return 8u; // mov [ reg + val ] , reg2
+      case mov_mem_val_ptr_reg_plus_val: return 8u; // mov [ reg + val ] , val2
+      case mov_reg_mem_ptr_reg_plus_val: return 8u; // mov reg , [ reg2 + val ]
+      case mov_reg_reg: return 4u;                  // mov reg , reg2
+      case mov_reg_val: return 4u;                  // mov reg , val
+      case inc: return 2u;                          // inc reg
+      case exit: return 1u;                         // exit
+      case adc_reg_reg: return 4u;                  // adc reg , reg2
+      case sbb_reg_reg: return 4u;                  // sbb reg , reg2
+      case addn: return 6u;                         // addn reg , reg2 , reg3
+      case subn: return 6u;                         // subn reg , reg2 , reg3
+      case xadd_mem_ptr_reg_plus_val_reg: return 8u;    // xadd [ reg + val ] , reg2
+      case cmpxchg_mem_ptr_reg_plus_val_reg: return 8u; // cmpxchg [ reg + val ] , reg2
+      case fence: return 1u;                        // fence
+      case spawn_reg_ip: return 4u;                 // spawn reg , ip
+      case yield: return 1u;                        // yield
+      case in_reg_port: return 4u;                  // in reg , port
+      case out_port_reg: return 4u;                 // out port , reg
+      case ins_reg_reg_port: return 6u;             // ins reg , reg2 , port
+      case outs_port_reg_reg: return 6u;            // outs port , reg , reg2
+      case add_reg_reg: return 4u;                  // add reg , reg2
+      case copyn: return 14u;                       // copyn [ reg + val ] , [ reg2 + val2 ] , reg3
+      case filln: return 10u;                       // filln [ reg + val ] , reg2 , reg3
+      case cmpn: return 14u;                        // cmpn [ reg + val ] , [ reg2 + val2 ] , reg3
+      case sumn: return 10u;                        // sumn reg , [ reg2 + val ] , reg3
+
+      default: return 500u;
+    }
+  }
+
+  using operand_tokens = std::array<size_t, 5u>;
+
+  //Index of the token of every operand word, in order of the words in ram
+  constexpr operand_tokens get_operand_tokens(instruction inst)
+  {
+    switch(inst)
+    {
+      case je: return { 1u };                           // je ip
+      case jmp: return { 1u };                          // jmp ip
+      case cmp: return { 1u, 3u };                      // cmp reg , val
+      case add_reg_mem_ptr_reg_plus_val: return { 1u, 4u, 6u }; // add reg , [ reg2 + val ]
+      case sub_reg_val: return { 1u, 3u };              // sub reg , val
+      case mov_mem_reg_ptr_reg_plus_val: return { 2u, 4u, 7u }; // mov [ reg + val ] , reg2
+      case mov_mem_val_ptr_reg_plus_val: return { 2u, 4u, 7u }; // mov [ reg + val ] , val2
+      case mov_reg_mem_ptr_reg_plus_val: return { 1u, 4u, 6u }; // mov reg , [ reg2 + val ]
+      case mov_reg_reg: return { 1u, 3u };              // mov reg , reg2
+      case mov_reg_val: return { 1u, 3u };              // mov reg , val
+      case inc: return { 1u };                          // inc reg
+      case adc_reg_reg: return { 1u, 3u };              // adc reg , reg2
+      case sbb_reg_reg: return { 1u, 3u };              // sbb reg , reg2
+      case addn: return { 1u, 3u, 5u };                 // addn reg , reg2 , reg3
+      case subn: return { 1u, 3u, 5u };                 // subn reg , reg2 , reg3
+      case xadd_mem_ptr_reg_plus_val_reg: return { 2u, 4u, 7u };    // xadd [ reg + val ] , reg2
+      case cmpxchg_mem_ptr_reg_plus_val_reg: return { 2u, 4u, 7u }; // cmpxchg [ reg + val ] , reg2
+      case spawn_reg_ip: return { 1u, 3u };             // spawn reg , ip
+      case in_reg_port: return { 1u, 3u };              // in reg , port
+      case out_port_reg: return { 1u, 3u };             // out port , reg
+      case ins_reg_reg_port: return { 1u, 3u, 5u };     // ins reg , reg2 , port
+      case outs_port_reg_reg: return { 1u, 3u, 5u };    // outs port , reg , reg2
+      case add_reg_reg: return { 1u, 3u };              // add reg , reg2
+      case copyn: return { 2u, 4u, 8u, 10u, 13u };      // copyn [ reg + val ] , [ reg2 + val2 ] , reg3
+      case filln: return { 2u, 4u, 7u, 9u };            // filln [ reg + val ] , reg2 , reg3
+      case cmpn: return { 2u, 4u, 8u, 10u, 13u };       // cmpn [ reg + val ] , [ reg2 + val2 ] , reg3
+      case sumn: return { 1u, 4u, 6u, 9u };             // sumn reg , [ reg2 + val ] , reg3
+
+      default: return {};
+    }
+  }
+
+  //Offset from the instruction word of the word assembled from given token, 0 when the
+  //token is not an operand
+  constexpr size_t get_operand_slot(instruction inst, size_t token_index)
+  {
+    const auto tokens = get_operand_tokens(inst);
+
+    for(size_t i = 0u; i < tokens.size(); ++i)
+    {
+      if(tokens[i] != 0u && tokens[i] == token_index)
+      {
+        return i + 1u;
+      }
+    }
+
+    return 0u;
+  }
+
+  constexpr bool operand_tokens_match_ip_changes()
+  {
+    for(size_t opcode = instruction::none + 1u; opcode < instruction::instruction_count; ++opcode)
+    {
+      const auto inst = static_cast<instruction>(opcode);
+      const auto tokens = get_operand_tokens(inst);
+      const auto words = 1u + static_cast<size_t>(tokens.size() - algo::count(tokens.begin(), tokens.end(), 0u));
+
+      if(words != get_ip_change(inst))
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  static_assert(operand_tokens_match_ip_changes(), "operand tokens of an instruction do not match its ip change");
+
+  //Tokens after the mnemonic, one character each: the separator the token has to be,
+  //or _ for an operand
+  constexpr std::string_view get_operand_pattern(instruction inst)
+  {
+    switch(inst)
+    {
+      case je: return "_";                                // je ip
+      case jmp: return "_";                               // jmp ip
+      case cmp: return "_,_";                             // cmp reg , val
+      case add_reg_mem_ptr_reg_plus_val: return "_,[_+_]"; // add reg , [ reg2 + val ]
+      case sub_reg_val: return "_,_";                     // sub reg , val
+      case mov_mem_reg_ptr_reg_plus_val: return "[_+_],_"; // mov [ reg + val ] , reg2
+      case mov_mem_val_ptr_reg_plus_val: return "[_+_],_"; // mov [ reg + val ] , val2
+      case mov_reg_mem_ptr_reg_plus_val: return "_,[_+_]"; // mov reg , [ reg2 + val ]
+      case mov_reg_reg: return "_,_";                     // mov reg , reg2
+      case mov_reg_val: return "_,_";                     // mov reg , val
+      case inc: return "_";                               // inc reg
+      case adc_reg_reg: return "_,_";                     // adc reg , reg2
+      case sbb_reg_reg: return "_,_";                     // sbb reg , reg2
+      case addn: return "_,_,_";                          // addn reg , reg2 , reg3
+      case subn: return "_,_,_";                          // subn reg , reg2 , reg3
+      case xadd_mem_ptr_reg_plus_val_reg: return "[_+_],_";    // xadd [ reg + val ] , reg2
+      case cmpxchg_mem_ptr_reg_plus_val_reg: return "[_+_],_"; // cmpxchg [ reg + val ] , reg2
+      case spawn_reg_ip: return "_,_";                    // spawn reg , ip
+      case in_reg_port: return "_,_";                     // in reg , port
+      case out_port_reg: return "_,_";                    // out port , reg
+      case ins_reg_reg_port: return "_,_,_";              // ins reg , reg2 , port
+      case outs_port_reg_reg: return "_,_,_";             // outs port , reg , reg2
+      case add_reg_reg: return "_,_";                     // add reg , reg2
+      case copyn: return "[_+_],[_+_],_";                 // copyn [ reg + val ] , [ reg2 + val2 ] , reg3
+      case filln: return "[_+_],_,_";                     // filln [ reg + val ] , reg2 , reg3
+      case cmpn: return "[_+_],[_+_],_";                  // cmpn [ reg + val ] , [ reg2 + val2 ] , reg3
+      case sumn: return "_,[_+_],_";                      // sumn reg , [ reg2 + val ] , reg3
+
+      default: return {};
+    }
+  }
+
+  constexpr bool operand_patterns_match_operand_tokens()
+  {
+    for(size_t opcode = instruction::none + 1u; opcode < instruction::instruction_count; ++opcode)
+    {
+      const auto inst = static_cast<instruction>(opcode);
+      const auto pattern = get_operand_pattern(inst);
+
+      if(pattern.size() + 1u != get_token_count(inst))
+      {
+        return false;
+      }
+
+      for(size_t i = 0u; i < pattern.size(); ++i)
+      {
+        if((pattern[i] == '_') != (get_operand_slot(inst, i + 1u) != 0u))
+        {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  static_assert(operand_patterns_match_operand_tokens(), "operand pattern of an instruction does not match its operand tokens");
+
+  constexpr size_t get_max_token_count()
+  {
+    size_t max{ 0u };
+
+    for(size_t instruction_opcode_val = instruction::none + 1u;
+        instruction_opcode_val < instruction::instruction_count;
+        ++instruction_opcode_val)
+    {
+      const auto count = get_token_count(static_cast<instruction>(instruction_opcode_val));
+      if(count > max)
+      {
+        max = count;
+      }
+    }
+
+    return max;
+  }
+
+  constexpr size_t get_max_eip_change()
+  {
+    size_t max{ 0u };
+
+    for(size_t instruction_opcode_val = 0u; 
+        instruction_opcode_val < instruction::instruction_count; 
+        ++instruction_opcode_val)
+    {
+      const auto change = get_ip_change(static_cast<instruction>(instruction_opcode_val));
+      if(change > max)
+      {
+        max = change;
+      }
+    }
+
+    return max;
+  }
+
+  template <typename token_t>
+  constexpr auto is_register(const token_t& token)
+  {
+    return token == tokens::eax ||
+      token == tokens::ebx ||
+      token == tokens::ecx ||
+      token == tokens::edx ||
+      token == tokens::ebp ||
+      token == tokens::esp;
+  }
+
+  template <typename token_it_t>
+  constexpr auto get_next_instruction(token_it_t token_it)
+  {
+    if(auto token = *token_it; token == tokens::je) return instruction::je;
+    else if(token == tokens::jmp) return instruction::jmp;
+    else if(token == tokens::add)
+    {
+      return is_register(*algo::next(token_it, 3))
+             ? instruction::add_reg_reg                   // add reg , reg2
+             : instruction::add_reg_mem_ptr_reg_plus_val; // add reg , [ reg2 + val ]
+    }
+    else if(token == tokens::sub) return instruction::sub_reg_val;
+    else if(token == tokens::inc) return instruction::inc;
+    else if(token == tokens::exit) return instruction::exit;
+    else if(token == tokens::cmp) return instruction::cmp;
+    else if(token == tokens::adc) return instruction::adc_reg_reg;
+    else if(token == tokens::sbb) return instruction::sbb_reg_reg;
+    else if(token == tokens::addn) return instruction::addn;
+    else if(token == tokens::subn) return instruction::subn;
+    else if(token == tokens::copyn) return instruction::copyn;
+    else if(token == tokens::filln) return instruction::filln;
+    else if(token == tokens::cmpn) return instruction::cmpn;
+    else if(token == tokens::sumn) return instruction::sumn;
+    else if(token == tokens::xadd) return instruction::xadd_mem_ptr_reg_plus_val_reg;
+    else if(token == tokens::cmpxchg) return instruction::cmpxchg_mem_ptr_reg_plus_val_reg;
+    else if(token == tokens::fence) return instruction::fence;
+    else if(token == tokens::spawn) return instruction::spawn_reg_ip;
+    else if(token == tokens::yield) return instruction::yield;
+    else if(token == tokens::in) return instruction::in_reg_port;
+    else if(token == tokens::out) return instruction::out_port_reg;
+    else if(token == tokens::ins) return instruction::ins_reg_reg_port;
+    else if(token == tokens::outs) return instruction::outs_port_reg_reg;
+    else if(token == tokens::mov)
+    {
+      auto next_token = *algo::next(token_it);
+
+      if(next_token == tokens::open_square_bracket) // mov [
+      {
+        auto token_after_comma = *algo::next(token_it, 7);
+        if(is_register(token_after_comma)) 
+        {
+          return instruction::mov_mem_reg_ptr_reg_plus_val;// mov [ reg + val ] , reg2
+        }
+        else
+        {
+          return instruction::mov_mem_val_ptr_reg_plus_val;// mov [ reg + val ] , val2
+        }
+      }
+      else if(is_register(next_token)) // mov reg
+      {
+        auto token_after_comma = *algo::next(token_it, 3);
+
+        if(is_register(token_after_comma))
+        {
+          return instruction::mov_reg_reg; // mov reg , reg2
+        }
+        else if(token_after_comma == tokens::open_square_bracket)
+        {
+          return instruction::mov_reg_mem_ptr_reg_plus_val; //mov reg , [ reg2 + val ]
+        }
+        else
+        {
+          return instruction::mov_reg_val; // mov reg , val
+        }
+      }
+    }
+    
+    return instruction::none;
+  }
+}
+
+namespace labels
+{
+  struct label_metadata
+  {
+    constexpr label_metadata() = default;
+
+    constexpr label_metadata(string name, size_t ip)
+      : name{ name }
+      , ip{ ip }
+    {}
+
+    string name{};
+    size_t ip{ 0u };
+  };
+
+  template <typename token_t>
+  constexpr string label_name_from_token(token_t token)
+  {
+    auto it = algo::next(token.begin());
+    string name;
+
+    while(*it != '\0')
+    {
+      name.push_back(*it++);
+    }
+
+    return name;
+  }
+
+  template <typename labels_t, typename token_t>
+  constexpr size_t get_label_ip(const token_t& token, const labels_t& labels)
+  {
+    const auto pred = [label_name = label_name_from_token(token)](const auto& label_metadata)
+    {
+      return label_name == label_metadata.name;
+    };
+
+    const auto found = algo::find_if(labels.begin(), labels.end(), pred);
+
+    return found == labels.end()
+           ? static_cast<size_t>(-1)
+           : found->ip;
+  }
+}
+
+//Host I/O. Every port has an input and an output ring buffer. Programs read input with
+//in/ins and write output with out/outs, the host refills and drains the buffers in
+//batches when they run empty or full
+namespace io
+{
+  class ring_buffer
+  {
+  public:
+    explicit ring_buffer(size_t capacity = 4096u)
+      : m_words(capacity)
+    {}
+
+    size_t size() const { return m_tail - m_head; }
+    size_t capacity() const { return m_words.size(); }
+    bool empty() const { return size() == 0u; }
+    bool full() const { return size() == capacity(); }
+
+    //Both return amount of words copied, limited by words or free space in the buffer
+    size_t write(const unit_t* src, size_t count)
+    {
+      count = std::min(count, capacity() - size());
+
+      for(size_t copied = 0u; copied < count;)
+      {
+        const auto pos = (m_tail + copied) % capacity();
+        const auto chunk = std::min(count - copied, capacity() - pos);
+        std::copy(src + copied, src + copied + chunk, m_words.begin() + static_cast<std::ptrdiff_t>(pos));
+        copied += chunk;
+      }
+
+      m_tail += count;
+      return count;
+    }
+
+    size_t read(unit_t* dest, size_t count)
+    {
+      count = std::min(count, size());
+
+      for(size_t copied = 0u; copied < count;)
+      {
+        const auto pos = (m_head + copied) % capacity();
+        const auto chunk = std::min(count - copied, capacity() - pos);
+        const auto first = m_words.begin() + static_cast<std::ptrdiff_t>(pos);
+        std::copy(first, first + static_cast<std::ptrdiff_t>(chunk), dest + copied);
+        copied += chunk;
+      }
+
+      m_head += count;
+      return count;
+    }
+
+  private:
+    std::vector<unit_t> m_words;
+    size_t m_head{ 0u }; //both only grow, positions are taken modulo capacity
+    size_t m_tail{ 0u };
+  };
+
+  class ports
+  {
+  public:
+    static constexpr size_t max_ports = 8u;
+
+    //Called with the port and its buffer. refill may leave the input empty, which is end of stream
+    using handler_t = std::function<void(unit_t, ring_buffer&)>;
+
+    explicit ports(size_t capacity = 4096u)
+    {
+      for(size_t i = 0u; i < max_ports; ++i)
+      {
+        m_inputs.emplace_back(capacity);
+        m_outputs.emplace_back(capacity);
+      }
+    }
+
+    ring_buffer& input(unit_t port) { return m_inputs[check(port)]; }
+    ring_buffer& output(unit_t port) { return m_outputs[check(port)]; }
+
+    //Returns false at end of stream
+    bool in(unit_t port, unit_t& value)
+    {
+      return read(port, &value, 1u) == 1u;
+    }
+
+    void out(unit_t port, unit_t value)
+    {
+      write(port, &value, 1u);
+    }
+
+    //Returns words read, less than count only at end of stream
+    size_t read(unit_t port, unit_t* dest, size_t count)
+    {
+      auto& buffer = input(port);
+      size_t done{ 0u };
+
+      while(done < count)
+      {
+        if(buffer.empty() && refill)
+        {
+          refill(port, buffer);
+        }
+
+        const auto chunk = buffer.read(dest + done, count - done);
+        if(chunk == 0u)
+        {
+          break;
+        }
+
+        done += chunk;
+      }
+
+      return done;
+    }
+
+    void write(unit_t port, const unit_t* src, size_t count)
+    {
+      auto& buffer = output(port);
+
+      for(size_t done = 0u; done < count;)
+      {
+        if(buffer.full())
+        {
+          if(!drain)
+          {
+            throw std::runtime_error{ "output of port " + std::to_string(port) + " is full" };
+          }
+
+          drain(port, buffer);
+
+          if(buffer.full())
+          {
+            throw std::runtime_error{ "output of port " + std::to_string(port) + " is not drained" };
+          }
+        }
+
+        done += buffer.write(src + done, count - done);
+      }
+    }
+
+    //Drains what is left in the outputs
+    void flush()
+    {
+      for(size_t i = 0u; i < max_ports && drain; ++i)
+      {
+        if(!m_outputs[i].empty())
+        {
+          drain(i, m_outputs[i]);
+        }
+      }
+    }
+
+    handler_t refill;
+    handler_t drain;
+
+  private:
+    static size_t check(unit_t port)
+    {
+      if(port >= max_ports)
+      {
+        throw std::out_of_range{ "port out of range: " + std::to_string(port) };
+      }
+
+      return port;
+    }
+
+    std::vector<ring_buffer> m_inputs;
+    std::vector<ring_buffer> m_outputs;
+  };
+
+  //Word of the instruction holding its port, 0 for instructions without one
+  constexpr size_t get_port_word(instructions::instruction inst)
+  {
+    using inst_t = instructions::instruction;
+
+    switch(inst)
+    {
+      case inst_t::in_reg_port: return 2u;       // in reg port
+      case inst_t::out_port_reg: return 1u;      // out port reg
+      case inst_t::ins_reg_reg_port: return 3u;  // ins reg reg2 port
+      case inst_t::outs_port_reg_reg: return 1u; // outs port reg reg2
+      default: return 0u;
+    }
+  }
+}
+
+//ram_t is the memory storage: vector<unit_t, n> for compile time machines,
+//std::vector<unit_t> for machines sized at runtime
+template <typename ram_t>
+class basic_machine
+{
+public:
+  using reg_t = unit_t;
+
+  constexpr basic_machine()
+  {
+    ram.resize_to_reserved();
+    regs_vals.resize_to_reserved();
+    init_regs();
+  }
+
+  constexpr explicit basic_machine(ram_t initial_ram)
+    : ram{ std::move(initial_ram) }
+  {
+    regs_vals.resize_to_reserved();
+    init_regs();
+  }
+
+  constexpr basic_machine(const basic_machine& rhs)
+    : ram{ rhs.ram }
+    , zf{ rhs.zf }
+    , cf{ rhs.cf }
+    , image_size{ rhs.image_size }
+    , ports{ rhs.ports }
+    , regs_vals{ rhs.regs_vals }
+  {}
+
+  constexpr basic_machine(basic_machine&&) = default;
+  constexpr basic_machine& operator=(const basic_machine&) = default;
+  constexpr basic_machine& operator=(basic_machine&&) = default;
+
+  template <typename reg_t>
+  constexpr reg_t get_reg(reg_t r)
+  {
+    return reg_ref(r);
+  }
+
+  template <typename reg_t>
+  constexpr reg_t get_reg(reg_t r) const
+  {
+    return reg_ref(r);
+  }
+
+  template <typename reg_t>
+  constexpr void set_reg(reg_t r, reg_t val)
+  {
+    reg_ref(r) = val;
+  }
+
+  constexpr reg_t& eax() { return reg_ref(regs::reg::eax); }
+  constexpr const reg_t& eax() const { return reg_ref(regs::reg::eax); }
+  constexpr reg_t& ebx() { return reg_ref(regs::reg::ebx); }
+  constexpr const reg_t& ebx() const { return reg_ref(regs::reg::ebx); }
+  constexpr reg_t& ecx() { return reg_ref(regs::reg::ecx); }
+  constexpr const reg_t& ecx() const { return reg_ref(regs::reg::ecx); }
+  constexpr reg_t& edx() { return reg_ref(regs::reg::edx); }
+  constexpr const reg_t& edx() const { return reg_ref(regs::reg::edx); }
+  constexpr reg_t& ebp() { return reg_ref(regs::reg::ebp); }
+  constexpr const reg_t& ebp() const { return reg_ref(regs::reg::ebp); }
+  constexpr reg_t& esp() { return reg_ref(regs::reg::esp); }
+  constexpr const reg_t& esp() const { return reg_ref(regs::reg::esp); }
+  constexpr reg_t& eip() { return reg_ref(regs::reg::eip); }
+  constexpr const reg_t& eip() const { return reg_ref(regs::reg::eip); }
+
+  ram_t ram;
+  bool zf{false};
+  bool cf{false};
+  size_t image_size{ 0u }; //words at the beginning of ram written by the assembler
+  io::ports* ports{ nullptr }; //not owned. Without ports in reads nothing and out discards
+
+private:
+  constexpr void init_regs()
+  {
+    eax() = ebx() = ecx() = edx() = ebp() = esp() = eip() = 0u;
+  }
+
+  template <typename register_t>
+  constexpr decltype(auto) reg_ref(register_t r)
+  {
+    return regs_vals[static_cast<size_t>(r)];
+  }
+
+  template <typename register_t>
+  constexpr decltype(auto) reg_ref(register_t r) const
+  {
+    return regs_vals[static_cast<size_t>(r)];
+  }
+
+  vector<reg_t, static_cast<size_t>(regs::reg::undef)> regs_vals{};
+};
+
+template <size_t amount_of_ram>
+using machine = basic_machine<vector<unit_t, amount_of_ram>>;
+
+
+namespace assemble
+{
+  //Label operands are assembled as 0 and patched by the assemblers
+  template <typename token_t>
+  constexpr unit_t get_value(const token_t& token)
+  {
+    if(token.size() != 0u && token.front() == '.')
+    {
+      return 0u;
+    }
+
+    if(!algo::is_number(token))
+    {
+      throw std::invalid_argument{ "expected a number or a .label: " + std::string{ token.begin(), token.end() } };
+    }
+
+    return algo::stoui(token);
+  }
+
+  template <typename token_t>
+  constexpr regs::reg get_reg(const token_t& token)
+  {
+    const auto reg = regs::token_to_reg(token);
+    if(reg == regs::reg::undef)
+    {
+      throw std::invalid_argument{ "expected a register: " + std::string{ token.begin(), token.end() } };
+    }
+
+    return reg;
+  }
+
+  template <typename token_t>
+  constexpr unit_t get_port(token_t token)
+  {
+    const auto port = algo::stoui(token);
+    if(port >= io::ports::max_ports)
+    {
+      throw std::invalid_argument{ "port out of range: " + std::to_string(port) };
+    }
+
+    return port;
+  }
+
+  //Opcodes of already decoded instruction at token_it
+  template <typename token_it_t>
+  constexpr auto get_next_opcodes(token_it_t &token_it, instructions::instruction instruction)
+  {
+    using opcodes_t = vector<unit_t, instructions::get_max_eip_change()>;
+    using inst_t = instructions::instruction;
+
+    opcodes_t opcodes;
+    algo::fill(opcodes.begin(), opcodes.end(), instructions::instruction::none);
+
+    opcodes.push_back(instruction);
+
+    const auto pattern = instructions::get_operand_pattern(instruction);
+    for(size_t i = 0u; i < pattern.size(); ++i)
+    {
+      const auto& token = *algo::next(token_it, static_cast<int>(i + 1u));
+      if(pattern[i] != '_' && !(token.size() == 1u && token.front() == pattern[i]))
+      {
+        throw std::invalid_argument{ std::string{ "expected '" } + pattern[i] + "'" };
+      }
+    }
+
+    switch(instruction)
+    {
+      case inst_t::exit: //exit
+      break;
+
+      case inst_t::je: // je pointer
+      {
+        const auto ip = get_value(*algo::next(token_it));
+        opcodes.push_back(ip);
+      }break;
+
+      case inst_t::jmp: // jmp pointer
+      {
+        const auto ip = get_value(*algo::next(token_it));
+        opcodes.push_back(ip);
+      }break;
+
+      case inst_t::add_reg_mem_ptr_reg_plus_val: // add reg , [ reg2 + val ]
+      {
+        const auto reg = get_reg(*algo::next(token_it));
+        const auto reg2 = get_reg(*algo::next(token_it, 4));
+        const auto val = get_value(*algo::next(token_it, 6));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(regs::to_unit_t(reg2));
+        opcodes.push_back(val);
+      }break;
+
+      case inst_t::sub_reg_val: // sub reg , val
+      {
+        const auto reg = get_reg(*algo::next(token_it));
+        const auto val = get_value(*algo::next(token_it, 3));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(val);
+      }break;
+
+      case inst_t::inc: // inc reg
+      {
+        const auto reg = get_reg(*algo::next(token_it));
+        opcodes.push_back(regs::to_unit_t(reg));
+      }break;
+
+      case inst_t::cmp: // cmp reg , val
+      {
+        const auto reg = get_reg(*algo::next(token_it));
+        const auto val = get_value(*algo::next(token_it, 3));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(val);
+      }break;
+
+      case inst_t::mov_mem_reg_ptr_reg_plus_val: // mov [ reg + val ] , reg2
+      {
+        const auto reg = get_reg(*algo::next(token_it, 2));
+        const auto val = get_value(*algo::next(token_it, 4));
+        const auto reg2 = get_reg(*algo::next(token_it, 7));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(val);
+        opcodes.push_back(regs::to_unit_t(reg2));
+      }break;
+
+      case inst_t::mov_mem_val_ptr_reg_plus_val: // mov [ reg + val ] , val2
+      {
+        const auto reg = get_reg(*algo::next(token_it, 2));
+        const auto val = get_value(*algo::next(token_it, 4));
+        const auto val2 = get_value(*algo::next(token_it, 7));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(val);
+        opcodes.push_back(val2);
+      }break;
+
+      case inst_t::mov_reg_mem_ptr_reg_plus_val: // mov reg , [ reg2 + val ]
+      {
+        const auto reg = get_reg(*algo::next(token_it));
+        const auto reg2 = get_reg(*algo::next(token_it, 4));
+        const auto val = get_value(*algo::next(token_it, 6));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(regs::to_unit_t(reg2));
+        opcodes.push_back(val);
+      }break;
+
+      case inst_t::mov_reg_reg: // mov reg , reg2
+      {
+        const auto reg = get_reg(*algo::next(token_it));
+        const auto reg2 = get_reg(*algo::next(token_it, 3));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(regs::to_unit_t(reg2));
+      }break;
+
+      case inst_t::mov_reg_val: // mov reg , val
+      {
+        const auto reg = get_reg(*algo::next(token_it));
+        const auto val = get_value(*algo::next(token_it, 3));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(val);
+      }break;
+
+      case inst_t::adc_reg_reg: // adc reg , reg2
+      case inst_t::sbb_reg_reg: // sbb reg , reg2
+      case inst_t::add_reg_reg: // add reg , reg2
+      {
+        const auto reg = get_reg(*algo::next(token_it));
+        const auto reg2 = get_reg(*algo::next(token_it, 3));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(regs::to_unit_t(reg2));
+      }break;
+
+      case inst_t::addn: // addn reg , reg2 , reg3
+      case inst_t::subn: // subn reg , reg2 , reg3
+      {
+        const auto reg = get_reg(*algo::next(token_it));
+        const auto reg2 = get_reg(*algo::next(token_it, 3));
+        const auto reg3 = get_reg(*algo::next(token_it, 5));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(regs::to_unit_t(reg2));
+        opcodes.push_back(regs::to_unit_t(reg3));
+      }break;
+
+      case inst_t::xadd_mem_ptr_reg_plus_val_reg: // xadd [ reg + val ] , reg2
+      case inst_t::cmpxchg_mem_ptr_reg_plus_val_reg: // cmpxchg [ reg + val ] , reg2
+      {
+        const auto reg = get_reg(*algo::next(token_it, 2));
+        const auto val = get_value(*algo::next(token_it, 4));
+        const auto reg2 = get_reg(*algo::next(token_it, 7));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(val);
+        opcodes.push_back(regs::to_unit_t(reg2));
+      }break;
+
+      case inst_t::fence: // fence
+      case inst_t::yield: // yield
+      break;
+
+      case inst_t::spawn_reg_ip: // spawn reg , ip
+      {
+        const auto reg = get_reg(*algo::next(token_it));
+        const auto ip = get_value(*algo::next(token_it, 3));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(ip);
+      }break;
+
+      case inst_t::in_reg_port: // in reg , port
+      {
+        const auto reg = get_reg(*algo::next(token_it));
+        const auto port = get_port(*algo::next(token_it, 3));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(port);
+      }break;
+
+      case inst_t::out_port_reg: // out port , reg
+      {
+        const auto port = get_port(*algo::next(token_it));
+        const auto reg = get_reg(*algo::next(token_it, 3));
+
+        opcodes.push_back(port);
+        opcodes.push_back(regs::to_unit_t(reg));
+      }break;
+
+      case inst_t::ins_reg_reg_port: // ins reg , reg2 , port
+      {
+        const auto reg = get_reg(*algo::next(token_it));
+        const auto reg2 = get_reg(*algo::next(token_it, 3));
+        const auto port = get_port(*algo::next(token_it, 5));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(regs::to_unit_t(reg2));
+        opcodes.push_back(port);
+      }break;
+
+      case inst_t::outs_port_reg_reg: // outs port , reg , reg2
+      {
+        const auto port = get_port(*algo::next(token_it));
+        const auto reg = get_reg(*algo::next(token_it, 3));
+        const auto reg2 = get_reg(*algo::next(token_it, 5));
+
+        opcodes.push_back(port);
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(regs::to_unit_t(reg2));
+      }break;
+
+      case inst_t::copyn: // copyn [ reg + val ] , [ reg2 + val2 ] , reg3
+      case inst_t::cmpn: // cmpn [ reg + val ] , [ reg2 + val2 ] , reg3
+      {
+        const auto reg = get_reg(*algo::next(token_it, 2));
+        const auto val = get_value(*algo::next(token_it, 4));
+        const auto reg2 = get_reg(*algo::next(token_it, 8));
+        const auto val2 = get_value(*algo::next(token_it, 10));
+        const auto reg3 = get_reg(*algo::next(token_it, 13));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(val);
+        opcodes.push_back(regs::to_unit_t(reg2));
+        opcodes.push_back(val2);
+        opcodes.push_back(regs::to_unit_t(reg3));
+      }break;
+
+      case inst_t::filln: // filln [ reg + val ] , reg2 , reg3
+      {
+        const auto reg = get_reg(*algo::next(token_it, 2));
+        const auto val = get_value(*algo::next(token_it, 4));
+        const auto reg2 = get_reg(*algo::next(token_it, 7));
+        const auto reg3 = get_reg(*algo::next(token_it, 9));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(val);
+        opcodes.push_back(regs::to_unit_t(reg2));
+        opcodes.push_back(regs::to_unit_t(reg3));
+      }break;
+
+      case inst_t::sumn: // sumn reg , [ reg2 + val ] , reg3
+      {
+        const auto reg = get_reg(*algo::next(token_it));
+        const auto reg2 = get_reg(*algo::next(token_it, 4));
+        const auto val = get_value(*algo::next(token_it, 6));
+        const auto reg3 = get_reg(*algo::next(token_it, 9));
+
+        opcodes.push_back(regs::to_unit_t(reg));
+        opcodes.push_back(regs::to_unit_t(reg2));
+        opcodes.push_back(val);
+        opcodes.push_back(regs::to_unit_t(reg3));
+      }break;
+
+      default:
+      break;
+    }
+
+    const auto token_count = instructions::get_token_count(instruction);
+    algo::advance(token_it, token_count);
+
+    return opcodes;
+  }
+
+  template <typename token_it_t>
+  constexpr auto get_next_opcodes(token_it_t &token_it)
+  {
+    return get_next_opcodes(token_it, instructions::get_next_instruction(token_it));
+  }
+
+  //Data written into the image as it is:
+  //  dw val           one word, val is a number or a label reference
+  //  times n dw val   n words of val, which has to be a number
+  struct directive
+  {
+    constexpr bool valid() const
+    {
+      return token_count != 0u;
+    }
+
+    size_t token_count{ 0u }; // 0 when the tokens are an instruction
+    size_t words{ 0u };
+  };
+
+  template <typename token_t>
+  constexpr bool is_label_reference(const token_t& token)
+  {
+    return token.size() > 1u && token.front() == '.';
+  }
+
+  template <typename token_it_t>
+  constexpr directive get_directive(token_it_t token_it)
+  {
+    if(*token_it == tokens::dw)
+    {
+      const auto& value = *algo::next(token_it);
+      if(!algo::is_number(value) && !is_label_reference(value))
+      {
+        throw std::invalid_argument{ "expected dw val" };
+      }
+
+      return { 2u, 1u };
+    }
+
+    if(*token_it == tokens::times)
+    {
+      if(!algo::is_number(*algo::next(token_it)) || !(*algo::next(token_it, 2) == tokens::dw) || !algo::is_number(*algo::next(token_it, 3)))
+      {
+        throw std::invalid_argument{ "expected times n dw val" };
+      }
+
+      return { 4u, static_cast<size_t>(algo::stoui(*algo::next(token_it))) };
+    }
+
+    return {};
+  }
+
+  //Assembles in one walk of the tokens. A reference to a label that is not declared yet is
+  //recorded with the word it was assembled into and patched when the label is declared
+  template <size_t amount_of_ram, size_t labels_count, size_t references_count>
+  class assembler
+  {
+  public:
+    template <typename tokens_t>
+    constexpr auto assemble(const tokens_t& tokens) const
+    {
+      machine<amount_of_ram> m;
+
+      vector<labels::label_metadata, labels_count> declared;
+      vector<labels::label_metadata, references_count> forward_references; // ip of the word to patch
+
+      size_t ip{ 0u };
+      auto token_it = tokens.begin();
+      while(token_it != tokens.end())
+      {
+        if(token_it->front() == ':')
+        {
+          if(labels::get_label_ip(*token_it, declared) != static_cast<size_t>(-1))
+          {
+            throw std::invalid_argument{ "duplicate label" };
+          }
+
+          const auto name = labels::label_name_from_token(*token_it);
+          declared.push_back(labels::label_metadata(name, ip));
+
+          for(size_t i = 0u; i < forward_references.size();)
+          {
+            if(forward_references[i].name == name)
+            {
+              m.ram[forward_references[i].ip] = ip;
+              forward_references[i] = forward_references[forward_references.size() - 1u];
+              forward_references.pop_back();
+            }
+            else
+            {
+              ++i;
+            }
+          }
+
+          algo::advance(token_it);
+          continue;
+        }
+
+        if(const auto d = get_directive(token_it); d.valid())
+        {
+          const auto& value = *algo::next(token_it, static_cast<int>(d.token_count - 1u));
+
+          if(d.words > amount_of_ram - ip)
+          {
+            throw std::invalid_argument{ "program does not fit in ram" };
+          }
+
+          if(value.front() != '.')
+          {
+            algo::fill(m.ram.begin() + ip, m.ram.begin() + ip + d.words, algo::stoui(value));
+          }
+          else if(const auto label_ip = labels::get_label_ip(value, declared); label_ip != static_cast<size_t>(-1))
+          {
+            m.ram[ip] = label_ip;
+          }
+          else
+          {
+            forward_references.push_back(labels::label_metadata(labels::label_name_from_token(value), ip));
+          }
+
+          ip += d.words;
+          algo::advance(token_it, static_cast<int>(d.token_count));
+          continue;
+        }
+
+        const auto instruction_it = token_it;
+        const auto instruction = instructions::get_next_instruction(instruction_it);
+
+        const auto opcodes = get_next_opcodes(token_it, instruction);
+        if(opcodes.size() > amount_of_ram - ip)
+        {
+          throw std::invalid_argument{ "program does not fit in ram" };
+        }
+
+        algo::copy(opcodes.begin(), opcodes.end(), m.ram.begin() + ip);
+
+        for(size_t i = 1u; i < instructions::get_token_count(instruction); ++i)
+        {
+          const auto& token = *algo::next(instruction_it, static_cast<int>(i));
+          const auto slot = instructions::get_operand_slot(instruction, i);
+
+          if(token.front() != '.' || slot == 0u)
+          {
+            continue;
+          }
+
+          if(const auto label_ip = labels::get_label_ip(token, declared); label_ip != static_cast<size_t>(-1))
+          {
+            m.ram[ip + slot] = label_ip;
+          }
+          else
+          {
+            forward_references.push_back(labels::label_metadata(labels::label_name_from_token(token), ip + slot));
+          }
+        }
+
+        ip += opcodes.size();
+      }
+
+      if(forward_references.size() != 0u)
+      {
+        throw std::invalid_argument{ "unknown label" };
+      }
+
+      m.image_size = ip;
+      m.esp() = amount_of_ram - 1;
+      m.eip() = 0u;
+
+      return m;
+    }
+  };
+
+  //Same image in machine with different amount of ram. Stack moves to the new top of ram
+  template <size_t new_amount_of_ram, typename ram_t>
+  constexpr auto resize(const basic_machine<ram_t>& m)
+  {
+    if(m.image_size > new_amount_of_ram)
+    {
+      throw std::invalid_argument{ "program does not fit in ram" };
+    }
+
+    machine<new_amount_of_ram> result;
+
+    for(size_t i = 0u; i < m.image_size; ++i)
+    {
+      result.ram[i] = m.ram[i];
+    }
+
+    result.image_size = m.image_size;
+    result.esp() = new_amount_of_ram - 1;
+    result.eip() = m.eip();
+
+    return result;
+  }
+}
+
+//Native implementations of bulk instructions, used at runtime on plain ram
+namespace kernels
+{
+  constexpr unit_t add_with_carry(unit_t lhs, unit_t rhs, bool& carry)
+  {
+    const auto sum = lhs + rhs;
+    const auto result = sum + carry;
+    carry = sum < lhs || result < sum;
+    return result;
+  }
+
+  constexpr unit_t sub_with_borrow(unit_t lhs, unit_t rhs, bool& borrow)
+  {
+    const auto diff = lhs - rhs;
+    const auto result = diff - borrow;
+    borrow = rhs > lhs || borrow > diff;
+    return result;
+  }
+
+  //dest[0, count) += src[0, count). Returns carry out
+  inline bool add_n(unit_t* dest, const unit_t* src, size_t count)
+  {
+#if defined(__x86_64__)
+    unsigned char carry{ 0u };
+    for(size_t i = 0u; i < count; ++i)
+    {
+      unsigned long long result;
+      carry = _addcarry_u64(carry, dest[i], src[i], &result);
+      dest[i] = result;
+    }
+    return carry != 0u;
+#else
+    bool carry{ false };
+    for(size_t i = 0u; i < count; ++i)
+    {
+      dest[i] = add_with_carry(dest[i], src[i], carry);
+    }
+    return carry;
+#endif
+  }
+
+  //dest[0, count) -= src[0, count). Returns borrow out
+  inline bool sub_n(unit_t* dest, const unit_t* src, size_t count)
+  {
+#if defined(__x86_64__)
+    unsigned char borrow{ 0u };
+    for(size_t i = 0u; i < count; ++i)
+    {
+      unsigned long long result;
+      borrow = _subborrow_u64(borrow, dest[i], src[i], &result);
+      dest[i] = result;
+    }
+    return borrow != 0u;
+#else
+    bool borrow{ false };
+    for(size_t i = 0u; i < count; ++i)
+    {
+      dest[i] = sub_with_borrow(dest[i], src[i], borrow);
+    }
+    return borrow;
+#endif
+  }
+
+  //Wrapping sum of src[0, count)
+  inline unit_t sum_n(const unit_t* src, size_t count)
+  {
+    unit_t sum{ 0u };
+    size_t i{ 0u };
+
+#if defined(__x86_64__)
+    //Two independent accumulators of two words each
+    auto acc = _mm_setzero_si128();
+    auto acc2 = _mm_setzero_si128();
+    for(; i + 4u <= count; i += 4u)
+    {
+      acc = _mm_add_epi64(acc, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)));
+      acc2 = _mm_add_epi64(acc2, _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 2u)));
+    }
+
+    acc = _mm_add_epi64(acc, acc2);
+    sum = static_cast<unit_t>(_mm_cvtsi128_si64(acc)) + static_cast<unit_t>(_mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc)));
+#endif
+
+    for(; i < count; ++i)
+    {
+      sum += src[i];
+    }
+
+    return sum;
+  }
+}
+
+namespace execute
+{
+  template <typename machine_t>
+  constexpr auto get_next_instruction(machine_t& machine)
+  {
+    return static_cast<instructions::instruction>(machine.ram[machine.eip()]);
+  }
+
+  //Data accesses of instructions. Opcodes and operands are fetched from ram directly,
+  //everything an instruction reads or writes goes through load and store, so machines
+  //may customise them by providing load/store members. Ram types whose operator[]
+  //does not return a reference provide a store member
+  template <typename machine_t>
+  constexpr unit_t load(machine_t& machine, size_t address)
+  {
+    if constexpr(requires { machine.load(address); })
+    {
+      return machine.load(address);
+    }
+    else
+    {
+      return machine.ram[address];
+    }
+  }
+
+  template <typename machine_t>
+  constexpr void store(machine_t& machine, size_t address, unit_t value)
+  {
+    if constexpr(requires { machine.store(address, value); })
+    {
+      machine.store(address, value);
+    }
+    else if constexpr(requires { machine.ram.store(address, value); })
+    {
+      machine.ram.store(address, value);
+    }
+    else
+    {
+      machine.ram[address] = value;
+    }
+  }
+
+  template <typename machine_t>
+  constexpr io::ports* get_ports(machine_t& machine)
+  {
+    if constexpr(requires { machine.ports; })
+    {
+      return machine.ports;
+    }
+    else
+    {
+      return nullptr;
+    }
+  }
+
+  //Read-modify-write accesses. Machines executed by several threads provide atomic ones,
+  //others get plain load and store
+  template <typename machine_t>
+  constexpr unit_t exchange_add(machine_t& machine, size_t address, unit_t value)
+  {
+    if constexpr(requires { machine.exchange_add(address, value); })
+    {
+      return machine.exchange_add(address, value);
+    }
+    else
+    {
+      const auto old = load(machine, address);
+      store(machine, address, old + value);
+      return old;
+    }
+  }
+
+  //On failure expected receives the value in ram
+  template <typename machine_t>
+  constexpr bool compare_exchange(machine_t& machine, size_t address, unit_t& expected, unit_t desired)
+  {
+    if constexpr(requires { machine.compare_exchange(address, expected, desired); })
+    {
+      return machine.compare_exchange(address, expected, desired);
+    }
+    else
+    {
+      const auto current = load(machine, address);
+      if(current != expected)
+      {
+        expected = current;
+        return false;
+      }
+
+      store(machine, address, desired);
+      return true;
+    }
+  }
+
+  template <typename machine_t>
+  constexpr void fence(machine_t& machine)
+  {
+    if constexpr(requires { machine.fence(); })
+    {
+      machine.fence();
+    }
+  }
+
+  //Starts a new core at ip with copy of registers of the spawning one and its own stack.
+  //Machines without cores can not run it
+  template <typename machine_t>
+  constexpr void spawn(machine_t& machine, unit_t ip, unit_t esp)
+  {
+    if constexpr(requires { machine.spawn(ip, esp); })
+    {
+      machine.spawn(ip, esp);
+    }
+    else
+    {
+      throw std::runtime_error{ "spawn needs --multicore" };
+    }
+  }
+
+  //View of a machine which reports data accesses to observer_t before performing them.
+  //Observers with on_set_reg also get every register write with the value it replaces
+  template <typename machine_t, typename observer_t>
+  class observed
+  {
+  public:
+    constexpr observed(machine_t& machine, observer_t& observer)
+      : ram{ machine.ram }
+      , zf{ machine.zf }
+      , cf{ machine.cf }
+      , ports{ get_ports(machine) }
+      , m_machine{ machine }
+      , m_observer{ observer }
+    {}
+
+    template <typename reg_t>
+    constexpr reg_t get_reg(reg_t r)
+    {
+      return m_machine.get_reg(r);
+    }
+
+    template <typename reg_t>
+    constexpr void set_reg(reg_t r, reg_t val)
+    {
+      if constexpr(requires { m_observer.on_set_reg(r, val, val); })
+      {
+        m_observer.on_set_reg(r, m_machine.get_reg(r), val);
+      }
+
+      m_machine.set_reg(r, val);
+    }
+
+    constexpr decltype(auto) eip() { return m_machine.eip(); }
+
+    constexpr unit_t load(size_t address)
+    {
+      m_observer.on_load(address);
+      return execute::load(m_machine, address);
+    }
+
+    constexpr void store(size_t address, unit_t value)
+    {
+      m_observer.on_store(address, value);
+      execute::store(m_machine, address, value);
+    }
+
+    constexpr void fence()
+    {
+      execute::fence(m_machine);
+    }
+
+    constexpr void spawn(unit_t ip, unit_t esp)
+    {
+      execute::spawn(m_machine, ip, esp);
+    }
+
+    decltype(machine_t::ram)& ram;
+    bool& zf;
+    bool& cf;
+    io::ports* ports;
+
+  private:
+    machine_t& m_machine;
+    observer_t& m_observer;
+  };
+
+  //Machines whose ram is a plain array of words, without customised data accesses.
+  //Bulk instructions run on them with native kernels
+  template <typename machine_t>
+  constexpr bool has_plain_ram = !requires(machine_t& m) { m.load(0u); }
+                              && !requires(machine_t& m) { m.store(0u, 0u); }
+                              && !requires(machine_t& m) { m.ram.store(0u, 0u); }
+                              && requires(machine_t& m) { { &m.ram[0] } -> std::convertible_to<unit_t*>; };
+
+  //Returns words read into ram at address, less than count at end of stream
+  template <typename machine_t>
+  constexpr size_t read_port(machine_t& machine, unit_t port, size_t address, size_t count)
+  {
+    const auto ports = get_ports(machine);
+    if(ports == nullptr)
+    {
+      return 0u;
+    }
+
+    if constexpr(has_plain_ram<machine_t>)
+    {
+      return ports->read(port, &machine.ram[0] + address, count);
+    }
+    else
+    {
+      size_t done{ 0u };
+      for(unit_t value; done < count && ports->in(port, value); ++done)
+      {
+        store(machine, address + done, value);
+      }
+
+      return done;
+    }
+  }
+
+  template <typename machine_t>
+  constexpr void write_port(machine_t& machine, unit_t port, size_t address, size_t count)
+  {
+    const auto ports = get_ports(machine);
+    if(ports == nullptr)
+    {
+      return;
+    }
+
+    if constexpr(has_plain_ram<machine_t>)
+    {
+      ports->write(port, &machine.ram[0] + address, count);
+    }
+    else
+    {
+      for(size_t i = 0u; i < count; ++i)
+      {
+        ports->out(port, load(machine, address + i));
+      }
+    }
+  }
+
+  //Multi word numbers, least significant word first. Returns carry out
+  template <typename machine_t>
+  constexpr bool add_words(machine_t& machine, size_t dest, size_t src, size_t count)
+  {
+    if constexpr(has_plain_ram<machine_t>)
+    {
+      if(!std::is_constant_evaluated())
+      {
+        return kernels::add_n(&machine.ram[0] + dest, &machine.ram[0] + src, count);
+      }
+    }
+
+    bool carry{ false };
+    for(size_t i = 0u; i < count; ++i)
+    {
+      store(machine, dest + i, kernels::add_with_carry(load(machine, dest + i), load(machine, src + i), carry));
+    }
+
+    return carry;
+  }
+
+  //Returns borrow out
+  template <typename machine_t>
+  constexpr bool sub_words(machine_t& machine, size_t dest, size_t src, size_t count)
+  {
+    if constexpr(has_plain_ram<machine_t>)
+    {
+      if(!std::is_constant_evaluated())
+      {
+        return kernels::sub_n(&machine.ram[0] + dest, &machine.ram[0] + src, count);
+      }
+    }
+
+    bool borrow{ false };
+    for(size_t i = 0u; i < count; ++i)
+    {
+      store(machine, dest + i, kernels::sub_with_borrow(load(machine, dest + i), load(machine, src + i), borrow));
+    }
+
+    return borrow;
+  }
+
+  //Block instructions. Plain ram uses native kernels at runtime and algo:: at compile time,
+  //other machines see every word through load and store
+
+  //Ranges may overlap, the destination gets the source as it was before the copy
+  template <typename machine_t>
+  constexpr void copy_words(machine_t& machine, size_t dest, size_t src, size_t count)
+  {
+    if(dest == src || count == 0u)
+    {
+      return;
+    }
+
+    if constexpr(has_plain_ram<machine_t>)
+    {
+      const auto ram = &machine.ram[0];
+      if(!std::is_constant_evaluated())
+      {
+        std::memmove(ram + dest, ram + src, count * sizeof(unit_t));
+        return;
+      }
+
+      if(dest < src || dest >= src + count)
+      {
+        algo::copy(ram + src, ram + src + count, ram + dest);
+        return;
+      }
+    }
+
+    if(dest < src)
+    {
+      for(size_t i = 0u; i < count; ++i)
+      {
+        store(machine, dest + i, load(machine, src + i));
+      }
+    }
+    else
+    {
+      for(size_t i = count; i > 0u; --i)
+      {
+        store(machine, dest + i - 1u, load(machine, src + i - 1u));
+      }
+    }
+  }
+
+  template <typename machine_t>
+  constexpr void fill_words(machine_t& machine, size_t dest, unit_t value, size_t count)
+  {
+    if constexpr(has_plain_ram<machine_t>)
+    {
+      const auto ram = &machine.ram[0];
+      if(!std::is_constant_evaluated())
+      {
+        std::fill_n(ram + dest, count, value);
+      }
+      else
+      {
+        algo::fill(ram + dest, ram + dest + count, value);
+      }
+    }
+    else
+    {
+      for(size_t i = 0u; i < count; ++i)
+      {
+        store(machine, dest + i, value);
+      }
+    }
+  }
+
+  //True when both ranges hold the same words
+  template <typename machine_t>
+  constexpr bool compare_words(machine_t& machine, size_t lhs, size_t rhs, size_t count)
+  {
+    if constexpr(has_plain_ram<machine_t>)
+    {
+      const auto ram = &machine.ram[0];
+      if(!std::is_constant_evaluated())
+      {
+        return count == 0u || std::memcmp(ram + lhs, ram + rhs, count * sizeof(unit_t)) == 0;
+      }
+
+      return algo::equal(ram + lhs, ram + lhs + count, ram + rhs);
+    }
+    else
+    {
+      for(size_t i = 0u; i < count; ++i)
+      {
+        if(load(machine, lhs + i) != load(machine, rhs + i))
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+  }
+
+  template <typename machine_t>
+  constexpr unit_t sum_words(machine_t& machine, size_t src, size_t count)
+  {
+    if constexpr(has_plain_ram<machine_t>)
+    {
+      if(!std::is_constant_evaluated())
+      {
+        return kernels::sum_n(&machine.ram[0] + src, count);
+      }
+    }
+
+    unit_t sum{ 0u };
+    for(size_t i = 0u; i < count; ++i)
+    {
+      sum += load(machine, src + i);
+    }
+
+    return sum;
+  }
+
+  template <typename machine_t>
+  constexpr bool execute_next_instruction(machine_t& machine)
+  {
+    using inst_t = instructions::instruction;
+
+    const auto instruction = get_next_instruction(machine);
+    const auto ip = machine.eip();
+
+    switch(instruction)
+    {
+      case inst_t::je: // je pointer
+      {
+        if(machine.zf)
+        {
+          const auto new_ip = machine.ram[ip + 1];
+          machine.eip() = new_ip;
+          return false;
+        }
+      }break;
+
+      case inst_t::jmp: // jmp pointer
+      {
+        const auto new_ip = machine.ram[ip + 1];
+        machine.eip() = new_ip;
+        return false;
+      }break;
+
+      case inst_t::add_reg_mem_ptr_reg_plus_val: // add reg reg2 val
+      {
+        const auto reg = machine.ram[ip + 1];
+        const auto reg_val = machine.get_reg(reg);
+        const auto reg2_val = machine.get_reg(machine.ram[ip + 2]);
+        const auto val = machine.ram[ip + 3];
+
+        const auto mem_ptr = reg2_val + val;
+        const auto val_to_add = load(machine, mem_ptr);
+
+        const auto new_reg_val = reg_val + val_to_add;
+        machine.set_reg(reg, new_reg_val);
+        machine.cf = new_reg_val < reg_val;
+      }break;
+
+      case inst_t::sub_reg_val: // sub reg val
+      {
+        const auto reg = machine.ram[ip + 1];
+        const auto reg_val = machine.get_reg(reg);
+        const auto val = machine.ram[ip + 2];
+
+        const auto new_reg_val = reg_val - val;
+        machine.set_reg(reg, new_reg_val);
+        machine.cf = val > reg_val;
+      }break;
+
+      case inst_t::inc: // inc reg
+      {
+        const auto reg = machine.ram[ip + 1];
+        const auto reg_val = machine.get_reg(reg);
+
+        machine.set_reg(reg, reg_val + 1);
+      }break;
+
+      case inst_t::cmp: // cmp reg val
+      {
+        const auto reg = machine.ram[ip + 1];
+        const auto reg_val = machine.get_reg(reg);
+        const auto val = machine.ram[ip + 2];
+
+        machine.zf = reg_val == val;
+      }break;
+
+      case inst_t::mov_mem_reg_ptr_reg_plus_val: // mov [ reg + val ] , reg2
+      {
+        const auto reg = machine.ram[ip + 1];
+        const auto reg_val = machine.get_reg(reg);
+        const auto val = machine.ram[ip + 2];
+        const auto reg2 = machine.ram[ip + 3];
+        const auto reg2_val = machine.get_reg(reg2);
+
+        const auto mem_ptr = reg_val + val;
+        store(machine, mem_ptr, reg2_val);
+      }break;
+
+      case inst_t::mov_mem_val_ptr_reg_plus_val: // mov [ reg + val ] , val2
+      {
+        const auto reg = machine.ram[ip + 1];
+        const auto reg_val = machine.get_reg(reg);
+        const auto val = machine.ram[ip + 2];
+        const auto val2 = machine.ram[ip + 3];
+
+        const auto mem_ptr = reg_val + val;
+        store(machine, mem_ptr, val2);
+      }break;
+
+      case inst_t::mov_reg_mem_ptr_reg_plus_val: // mov reg , [ reg2 + val ]
+      {
+        const auto reg = machine.ram[ip + 1];
+        const auto reg2 = machine.ram[ip + 2];
+        const auto reg2_val = machine.get_reg(reg2);
+        const auto val = machine.ram[ip + 3];
+
+        const auto mem_ptr = reg2_val + val;
+        const auto new_reg_val = load(machine, mem_ptr);
+        machine.set_reg(reg, new_reg_val);
+      }break;
+
+      case inst_t::mov_reg_reg: // mov reg , reg2
+      {
+        const auto reg = machine.ram[ip + 1];
+        const auto reg2 = machine.ram[ip + 2];
+        const auto reg2_val = machine.get_reg(reg2);
+
+        machine.set_reg(reg, reg2_val);
+      }break;
+
+      case inst_t::mov_reg_val: // mov reg , val
+      {
+        const auto reg = machine.ram[ip + 1];
+        const auto val = machine.ram[ip + 2];
+
+        machine.set_reg(reg, val);
+      }break;
+
+      case inst_t::add_reg_reg: // add reg , reg2
+      {
+        const auto reg = machine.ram[ip + 1];
+        const auto reg_val = machine.get_reg(reg);
+        const auto reg2_val = machine.get_reg(machine.ram[ip + 2]);
+
+        const auto new_reg_val = reg_val + reg2_val;
+        machine.set_reg(reg, new_reg_val);
+        machine.cf = new_reg_val < reg_val;
+      }break;
+
+      case inst_t::adc_reg_reg: // adc reg , reg2
+      {
+        const auto reg = machine.ram[ip + 1];
+        const auto reg_val = machine.get_reg(reg);
+        const auto reg2_val = machine.get_reg(machine.ram[ip + 2]);
+
+        bool carry = machine.cf;
+        machine.set_reg(reg, kernels::add_with_carry(reg_val, reg2_val, carry));
+        machine.cf = carry;
+      }break;
+
+      case inst_t::sbb_reg_reg: // sbb reg , reg2
+      {
+        const auto reg = machine.ram[ip + 1];
+        const auto reg_val = machine.get_reg(reg);
+        const auto reg2_val = machine.get_reg(machine.ram[ip + 2]);
+
+        bool borrow = machine.cf;
+        machine.set_reg(reg, kernels::sub_with_borrow(reg_val, reg2_val, borrow));
+        machine.cf = borrow;
+      }break;
+
+      case inst_t::addn: // addn reg , reg2 , reg3
+      case inst_t::subn: // subn reg , reg2 , reg3
+      {
+        const auto dest = machine.get_reg(machine.ram[ip + 1]);
+        const auto src = machine.get_reg(machine.ram[ip + 2]);
+        const auto count = machine.get_reg(machine.ram[ip + 3]);
+
+        machine.cf = instruction == inst_t::addn
+                     ? add_words(machine, dest, src, count)
+                     : sub_words(machine, dest, src, count);
+      }break;
+
+      case inst_t::xadd_mem_ptr_reg_plus_val_reg: // xadd [ reg + val ] , reg2
+      {
+        const auto reg_val = machine.get_reg(machine.ram[ip + 1]);
+        const auto val = machine.ram[ip + 2];
+        const auto reg2 = machine.ram[ip + 3];
+
+        const auto mem_ptr = reg_val + val;
+        machine.set_reg(reg2, exchange_add(machine, mem_ptr, machine.get_reg(reg2)));
+      }break;
+
+      case inst_t::cmpxchg_mem_ptr_reg_plus_val_reg: // cmpxchg [ reg + val ] , reg2
+      {
+        const auto reg_val = machine.get_reg(machine.ram[ip + 1]);
+        const auto val = machine.ram[ip + 2];
+        const auto reg2_val = machine.get_reg(machine.ram[ip + 3]);
+        const auto eax = regs::to_unit_t(regs::reg::eax);
+
+        const auto mem_ptr = reg_val + val;
+        auto expected = machine.get_reg(eax);
+        machine.zf = compare_exchange(machine, mem_ptr, expected, reg2_val);
+        machine.set_reg(eax, expected);
+      }break;
+
+      case inst_t::fence: // fence
+      {
+        fence(machine);
+      }break;
+
+      case inst_t::spawn_reg_ip: // spawn reg , ip
+      {
+        const auto esp = machine.get_reg(machine.ram[ip + 1]);
+        const auto new_ip = machine.ram[ip + 2];
+
+        spawn(machine, new_ip, esp);
+      }break;
+
+      case inst_t::yield: // yield. Schedulers switch to another machine after it
+      break;
+
+      case inst_t::in_reg_port: // in reg , port
+      {
+        const auto reg = machine.ram[ip + 1];
+        const auto port = machine.ram[ip + 2];
+        const auto ports = get_ports(machine);
+
+        unit_t value{ 0u };
+        machine.zf = ports == nullptr || !ports->in(port, value); //end of stream
+        if(!machine.zf)
+        {
+          machine.set_reg(reg, value);
+        }
+      }break;
+
+      case inst_t::out_port_reg: // out port , reg
+      {
+        const auto port = machine.ram[ip + 1];
+        const auto reg_val = machine.get_reg(machine.ram[ip + 2]);
+
+        if(const auto ports = get_ports(machine); ports != nullptr)
+        {
+          ports->out(port, reg_val);
+        }
+      }break;
+
+      case inst_t::ins_reg_reg_port: // ins reg , reg2 , port
+      {
+        const auto address = machine.get_reg(machine.ram[ip + 1]);
+        const auto reg2 = machine.ram[ip + 2];
+        const auto port = machine.ram[ip + 3];
+
+        const auto count = read_port(machine, port, address, machine.get_reg(reg2));
+        machine.set_reg(reg2, count);
+        machine.zf = count == 0u;
+      }break;
+
+      case inst_t::outs_port_reg_reg: // outs port , reg , reg2
+      {
+        const auto port = machine.ram[ip + 1];
+        const auto address = machine.get_reg(machine.ram[ip + 2]);
+        const auto count = machine.get_reg(machine.ram[ip + 3]);
+
+        write_port(machine, port, address, count);
+      }break;
+
+      case inst_t::copyn: // copyn [ reg + val ] , [ reg2 + val2 ] , reg3
+      case inst_t::cmpn: // cmpn [ reg + val ] , [ reg2 + val2 ] , reg3
+      {
+        const auto dest = machine.get_reg(machine.ram[ip + 1]) + machine.ram[ip + 2];
+        const auto src = machine.get_reg(machine.ram[ip + 3]) + machine.ram[ip + 4];
+        const auto count = machine.get_reg(machine.ram[ip + 5]);
+
+        if(instruction == inst_t::copyn)
+        {
+          copy_words(machine, dest, src, count);
+        }
+        else
+        {
+          machine.zf = compare_words(machine, dest, src, count);
+        }
+      }break;
+
+      case inst_t::filln: // filln [ reg + val ] , reg2 , reg3
+      {
+        const auto dest = machine.get_reg(machine.ram[ip + 1]) + machine.ram[ip + 2];
+        const auto value = machine.get_reg(machine.ram[ip + 3]);
+        const auto count = machine.get_reg(machine.ram[ip + 4]);
+
+        fill_words(machine, dest, value, count);
+      }break;
+
+      case inst_t::sumn: // sumn reg , [ reg2 + val ] , reg3
+      {
+        const auto reg = machine.ram[ip + 1];
+        const auto src = machine.get_reg(machine.ram[ip + 2]) + machine.ram[ip + 3];
+        const auto count = machine.get_reg(machine.ram[ip + 4]);
+
+        machine.set_reg(reg, sum_words(machine, src, count));
+      }break;
+
+      default:
+      break;
+    }
+
+    return true;
+  }
+
+  template <typename machine_t>
+  constexpr void adjust_eip(machine_t& machine)
+  {
+    const auto instruction = get_next_instruction(machine);
+    const auto eip_change = instructions::get_ip_change(instruction);
+    machine.eip() += eip_change;
+  }
+
+  //Executes the machine in place, it is left at its exit
+  template <typename machine_t>
+  constexpr auto run(machine_t& machine)
+  {
+    while(get_next_instruction(machine) != instructions::instruction::exit)
+    {
+      const auto need_to_change_eip = execute_next_instruction(machine);
+      if(need_to_change_eip)
+      {
+        adjust_eip(machine);
+      }
+    }
+
+    return machine.eax();
+  }
+
+  template <typename machine_t>
+  constexpr auto execute(machine_t machine)
+  {
+    return run(machine);
+  }
+
+  struct reg_input
+  {
+    regs::reg r{ regs::reg::undef };
+    unit_t value{ 0u };
+  };
+
+  struct ram_input
+  {
+    size_t address{ 0u };
+    std::span<const unit_t> values{};
+  };
+
+  //Caller data written into a copy of the machine before it is executed.
+  //Ram values are not copied, they have to outlive the inputs
+  class inputs
+  {
+  public:
+    static constexpr size_t max_ram_inputs = 8u;
+
+    constexpr inputs& reg(regs::reg r, unit_t value)
+    {
+      if(r >= regs::reg::eip)
+      {
+        throw std::invalid_argument{ "invalid input register" };
+      }
+
+      //A register given again replaces its value
+      for(auto& in : m_regs)
+      {
+        if(in.r == r)
+        {
+          in.value = value;
+          return *this;
+        }
+      }
+
+      m_regs.push_back(reg_input{ r, value });
+      return *this;
+    }
+
+    constexpr inputs& ram(size_t address, std::span<const unit_t> values)
+    {
+      if(m_ram.size() == max_ram_inputs)
+      {
+        throw std::out_of_range{ "too many ram inputs, at most " + std::to_string(max_ram_inputs) };
+      }
+
+      m_ram.push_back(ram_input{ address, values });
+      return *this;
+    }
+
+    template <typename machine_t>
+    constexpr void seed(machine_t& machine) const
+    {
+      for(const auto& in : m_regs)
+      {
+        machine.set_reg(regs::to_unit_t(in.r), in.value);
+      }
+
+      for(const auto& in : m_ram)
+      {
+        if(in.address > machine.ram.size() || in.values.size() > machine.ram.size() - in.address)
+        {
+          throw std::out_of_range{ "ram input out of ram: " + std::to_string(in.address) };
+        }
+
+        for(size_t i = 0u; i < in.values.size(); ++i)
+        {
+          store(machine, in.address + i, in.values[i]);
+        }
+      }
+    }
+
+  private:
+    vector<reg_input, static_cast<size_t>(regs::reg::eip)> m_regs;
+    vector<ram_input, max_ram_inputs> m_ram;
+  };
+
+  //View of a machine which bounds checks registers, data accesses and instruction fetches.
+  //A violation throws, so at compile time it is reported where it happens
+  template <typename machine_t>
+  class checked
+  {
+  public:
+    constexpr explicit checked(machine_t& machine)
+      : ram{ machine.ram }
+      , zf{ machine.zf }
+      , cf{ machine.cf }
+      , ports{ get_ports(machine) }
+      , m_machine{ machine }
+    {}
+
+    template <typename reg_t>
+    constexpr reg_t get_reg(reg_t r)
+    {
+      check_reg(r);
+      return m_machine.get_reg(r);
+    }
+
+    template <typename reg_t>
+    constexpr void set_reg(reg_t r, reg_t val)
+    {
+      check_reg(r);
+      m_machine.set_reg(r, val);
+    }
+
+    constexpr decltype(auto) eip() { return m_machine.eip(); }
+
+    constexpr unit_t load(size_t address)
+    {
+      check_address(address);
+      return execute::load(m_machine, address);
+    }
+
+    constexpr void store(size_t address, unit_t value)
+    {
+      check_address(address);
+      execute::store(m_machine, address, value);
+    }
+
+    constexpr unit_t exchange_add(size_t address, unit_t value)
+    {
+      check_address(address);
+      return execute::exchange_add(m_machine, address, value);
+    }
+
+    constexpr bool compare_exchange(size_t address, unit_t& expected, unit_t desired)
+    {
+      check_address(address);
+      return execute::compare_exchange(m_machine, address, expected, desired);
+    }
+
+    constexpr void fence()
+    {
+      execute::fence(m_machine);
+    }
+
+    constexpr void spawn(unit_t ip, unit_t esp)
+    {
+      execute::spawn(m_machine, ip, esp);
+    }
+
+    //Whole instruction at eip is in ram and has a valid opcode
+    constexpr void check_fetch() const
+    {
+      const auto ip = m_machine.eip();
+      if(ip >= ram.size())
+      {
+        throw std::out_of_range{ "eip out of ram: " + std::to_string(ip) };
+      }
+
+      const auto size = instructions::get_ip_change(static_cast<instructions::instruction>(ram[ip]));
+      if(size == 0u || ip + size > ram.size())
+      {
+        throw std::out_of_range{ "invalid instruction at " + std::to_string(ip) };
+      }
+    }
+
+    decltype(machine_t::ram)& ram;
+    bool& zf;
+    bool& cf;
+    io::ports* ports;
+
+  private:
+    template <typename reg_t>
+    constexpr void check_reg(reg_t r) const
+    {
+      if(static_cast<size_t>(r) >= static_cast<size_t>(regs::reg::undef))
+      {
+        throw std::out_of_range{ "invalid register " + std::to_string(static_cast<size_t>(r)) };
+      }
+    }
+
+    constexpr void check_address(size_t address) const
+    {
+      if(address >= ram.size())
+      {
+        throw std::out_of_range{ "access out of ram: " + std::to_string(address) };
+      }
+    }
+
+    machine_t& m_machine;
+  };
+
+  //Executes the machine checked in place, it is left at its exit or at the violation
+  template <typename machine_t>
+  constexpr auto run_checked(machine_t& machine)
+  {
+    checked<machine_t> view{ machine };
+
+    for(view.check_fetch(); get_next_instruction(machine) != instructions::instruction::exit; view.check_fetch())
+    {
+      if(execute_next_instruction(view))
+      {
+        adjust_eip(machine);
+      }
+    }
+
+    return machine.eax();
+  }
+
+  template <typename machine_t>
+  constexpr auto execute_checked(machine_t machine)
+  {
+    return run_checked(machine);
+  }
+
+  //Unchecked execution is only safe for programs proven in range, see verify::check
+  enum class policy
+  {
+    checked,
+    unchecked
+  };
+
+  template <typename machine_t>
+  constexpr auto execute(machine_t machine, policy p)
+  {
+    return p == policy::unchecked
+           ? execute(std::move(machine))
+           : execute_checked(std::move(machine));
+  }
+
+  //Executes an already assembled machine on new data, e.g. a constexpr machine
+  //assembled at compile time. Nothing is proven about the seeded machine, so it runs
+  //checked, verify::execute runs it unchecked when it can be
+  template <typename machine_t>
+  constexpr auto execute(machine_t machine, const inputs& in)
+  {
+    in.seed(machine);
+    return execute_checked(std::move(machine));
+  }
+}
+
+//Static memory footprint. Registers are tracked over all paths of the control flow graph
+//as constants, offsets from the initial esp or unknown. For programs addressing ram only
+//through such registers, it gives the minimal amount of ram they need
+namespace footprint
+{
+  constexpr size_t regs_count = static_cast<size_t>(regs::reg::eip);
+
+  struct abstract_reg
+  {
+    enum class kind
+    {
+      constant,
+      stack,   //value is offset from initial esp
+      unknown
+    };
+
+    constexpr bool operator==(const abstract_reg&) const = default;
+
+    kind k{ kind::unknown };
+    unit_t value{ 0u };
+  };
+
+  using abstract_regs = std::array<abstract_reg, regs_count>;
+
+  struct result
+  {
+    //One word for esp itself, even when stack is not used
+    constexpr size_t required_ram() const
+    {
+      return std::max(image_size, absolute_end) + 1u - min_stack_offset;
+    }
+
+    bool bounded{ false };
+    size_t image_size{ 0u };
+    size_t absolute_begin{ static_cast<size_t>(-1) }; //lowest absolute address accessed
+    size_t absolute_end{ 0u };         //one past the highest absolute address accessed
+    long long min_stack_offset{ 0 };   //lowest accessed address relative to initial esp
+  };
+
+  template <typename machine_t>
+  class analyzer
+  {
+  public:
+    //ram_limit bounds accepted addresses. It may exceed ram of the machine, when the machine
+    //is only a provisional image of the program. Registers in unknown_regs, a bit per register,
+    //may hold anything at the entry
+    constexpr analyzer(const machine_t& m, size_t ram_limit, unsigned unknown_regs = 0u)
+      : m_machine{ m }
+      , m_ram_limit{ ram_limit }
+      , m_states(m.ram.size())
+      , m_visited(m.ram.size(), 0u)
+      , m_queued(m.ram.size(), 0u)
+    {
+      m_result.image_size = m.image_size;
+
+      abstract_regs initial{};
+      for(size_t i = 0u; i < regs_count; ++i)
+      {
+        const auto unknown = (unknown_regs >> i) & 1u;
+        initial[i] = unknown ? abstract_reg{} : abstract_reg{ abstract_reg::kind::constant, m.get_reg(static_cast<unit_t>(i)) };
+      }
+      initial[static_cast<size_t>(regs::reg::esp)] = { abstract_reg::kind::stack, 0u };
+
+      enqueue(m.eip(), initial);
+    }
+
+    constexpr result analyze()
+    {
+      m_result.bounded = true;
+
+      while(!m_worklist.empty() && m_result.bounded)
+      {
+        const auto ip = m_worklist.back();
+        m_worklist.pop_back();
+        m_queued[ip] = 0u;
+
+        step(ip);
+      }
+
+      return m_result;
+    }
+
+  private:
+    constexpr void step(size_t ip)
+    {
+      using inst_t = instructions::instruction;
+      using kind = abstract_reg::kind;
+
+      const auto inst = static_cast<inst_t>(m_machine.ram[ip]);
+      const auto size = instructions::get_ip_change(inst);
+
+      if(size == 0u || ip + size > m_machine.image_size)
+      {
+        m_result.bounded = false;
+        return;
+      }
+
+      const auto word = [&](size_t i) { return m_machine.ram[ip + i]; };
+      auto regs = m_states[ip];
+      auto reg = [&regs](unit_t r) -> abstract_reg& { return regs[static_cast<size_t>(r)]; };
+      const auto next = ip + size;
+
+      switch(inst)
+      {
+        case inst_t::exit:
+        return;
+
+        case inst_t::jmp:
+          enqueue(word(1), regs);
+        return;
+
+        case inst_t::je:
+          enqueue(word(1), regs);
+        break;
+
+        case inst_t::cmp:
+        break;
+
+        case inst_t::add_reg_mem_ptr_reg_plus_val: // add reg reg2 val
+          access(reg(word(2)), word(3), 1u);
+          reg(word(1)) = {};
+        break;
+
+        case inst_t::sub_reg_val: // sub reg val
+          reg(word(1)).value -= word(2);
+        break;
+
+        case inst_t::inc: // inc reg
+          reg(word(1)).value += 1u;
+        break;
+
+        case inst_t::mov_mem_reg_ptr_reg_plus_val: // mov reg val reg2
+        case inst_t::mov_mem_val_ptr_reg_plus_val: // mov reg val val2
+          access(reg(word(1)), word(2), 1u);
+        break;
+
+        case inst_t::mov_reg_mem_ptr_reg_plus_val: // mov reg reg2 val
+          access(reg(word(2)), word(3), 1u);
+          reg(word(1)) = {};
+        break;
+
+        case inst_t::mov_reg_reg: // mov reg reg2
+          reg(word(1)) = reg(word(2));
+        break;
+
+        case inst_t::mov_reg_val: // mov reg val
+          reg(word(1)) = { kind::constant, word(2) };
+        break;
+
+        case inst_t::adc_reg_reg: // adc reg reg2
+        case inst_t::sbb_reg_reg: // sbb reg reg2
+        case inst_t::add_reg_reg: // add reg reg2
+          reg(word(1)) = {};
+        break;
+
+        case inst_t::addn: // addn reg reg2 reg3
+        case inst_t::subn: // subn reg reg2 reg3
+        {
+          const auto count = reg(word(3));
+          if(count.k != kind::constant)
+          {
+            m_result.bounded = false;
+            return;
+          }
+
+          access(reg(word(1)), 0u, count.value);
+          access(reg(word(2)), 0u, count.value);
+        }break;
+
+        case inst_t::xadd_mem_ptr_reg_plus_val_reg: // xadd reg val reg2
+          access(reg(word(1)), word(2), 1u);
+          reg(word(3)) = {};
+        break;
+
+        case inst_t::cmpxchg_mem_ptr_reg_plus_val_reg: // cmpxchg reg val reg2
+          access(reg(word(1)), word(2), 1u);
+          reg(regs::to_unit_t(regs::reg::eax)) = {};
+        break;
+
+        case inst_t::fence:
+        case inst_t::yield:
+        case inst_t::out_port_reg:
+        break;
+
+        case inst_t::in_reg_port: // in reg port
+          reg(word(1)) = {};
+        break;
+
+        case inst_t::ins_reg_reg_port: // ins reg reg2 port
+        case inst_t::outs_port_reg_reg: // outs port reg reg2
+        {
+          const auto is_ins = inst == inst_t::ins_reg_reg_port;
+          const auto address = reg(word(is_ins ? 1 : 2));
+          const auto count = reg(word(is_ins ? 2 : 3));
+
+          if(count.k != kind::constant)
+          {
+            m_result.bounded = false;
+            return;
+          }
+
+          access(address, 0u, count.value);
+
+          if(is_ins)
+          {
+            reg(word(2)) = {};
+          }
+        }break;
+
+        case inst_t::copyn: // copyn reg val reg2 val2 reg3
+        case inst_t::cmpn: // cmpn reg val reg2 val2 reg3
+        {
+          const auto count = reg(word(5));
+          if(count.k != kind::constant)
+          {
+            m_result.bounded = false;
+            return;
+          }
+
+          access(reg(word(1)), word(2), count.value);
+          access(reg(word(3)), word(4), count.value);
+        }break;
+
+        case inst_t::filln: // filln reg val reg2 reg3
+        case inst_t::sumn: // sumn reg reg2 val reg3
+        {
+          const auto is_fill = inst == inst_t::filln;
+          const auto count = reg(word(4));
+          if(count.k != kind::constant)
+          {
+            m_result.bounded = false;
+            return;
+          }
+
+          access(reg(word(is_fill ? 1 : 2)), word(is_fill ? 2 : 3), count.value);
+
+          if(!is_fill)
+          {
+            reg(word(1)) = {};
+          }
+        }break;
+
+        case inst_t::spawn_reg_ip: // spawn reg ip
+        {
+          auto child = regs;
+          child[static_cast<size_t>(regs::reg::esp)] = reg(word(1));
+          enqueue(word(2), child);
+        }break;
+
+        default:
+          m_result.bounded = false;
+        return;
+      }
+
+      enqueue(next, regs);
+    }
+
+    constexpr void access(const abstract_reg& base, unit_t offset, unit_t count)
+    {
+      using kind = abstract_reg::kind;
+
+      if(count == 0u)
+      {
+        return;
+      }
+
+      if(base.k == kind::constant)
+      {
+        const auto first = base.value + offset;
+        const auto last = first + count;
+
+        if(last < first || last > m_ram_limit)
+        {
+          m_result.bounded = false;
+          return;
+        }
+
+        m_result.absolute_begin = std::min<size_t>(m_result.absolute_begin, first);
+        m_result.absolute_end = std::max<size_t>(m_result.absolute_end, last);
+      }
+      else if(base.k == kind::stack)
+      {
+        const auto first = static_cast<long long>(base.value + offset);
+        const auto last = first + static_cast<long long>(count) - 1;
+
+        if(last > 0 || first < -static_cast<long long>(m_ram_limit))
+        {
+          m_result.bounded = false; //above initial esp, or absurdly deep
+          return;
+        }
+
+        m_result.min_stack_offset = std::min(m_result.min_stack_offset, first);
+      }
+      else
+      {
+        m_result.bounded = false;
+      }
+    }
+
+    constexpr void enqueue(size_t ip, const abstract_regs& regs)
+    {
+      if(ip >= m_machine.ram.size())
+      {
+        m_result.bounded = false;
+        return;
+      }
+
+      if(m_visited[ip])
+      {
+        auto changed = false;
+
+        for(size_t i = 0u; i < regs_count; ++i)
+        {
+          if(!(m_states[ip][i] == regs[i]) && m_states[ip][i].k != abstract_reg::kind::unknown)
+          {
+            m_states[ip][i] = {};
+            changed = true;
+          }
+        }
+
+        if(!changed)
+        {
+          return;
+        }
+      }
+      else
+      {
+        m_visited[ip] = 1u;
+        m_states[ip] = regs;
+      }
+
+      if(!m_queued[ip])
+      {
+        m_queued[ip] = 1u;
+        m_worklist.push_back(ip);
+      }
+    }
+
+    const machine_t& m_machine;
+    size_t m_ram_limit;
+    std::vector<abstract_regs> m_states;
+    std::vector<uint8_t> m_visited;
+    std::vector<uint8_t> m_queued;
+    std::vector<size_t> m_worklist;
+    result m_result;
+  };
+
+  template <typename machine_t>
+  constexpr result analyze(const machine_t& m, size_t ram_limit, unsigned unknown_regs = 0u)
+  {
+    return analyzer<machine_t>{ m, ram_limit, unknown_regs }.analyze();
+  }
+
+  template <typename machine_t>
+  constexpr result analyze(const machine_t& m)
+  {
+    return analyze(m, m.ram.size());
+  }
+}
+
+//Intermediate representation. Instructions with typed operands grouped into basic blocks.
+//It is lifted from an assembled machine, so jump targets are the ones resolved by labels,
+//and lowered back to the ram encoding
+namespace ir
+{
+  enum class operand_kind
+  {
+    none,
+    reg,    // one word, register
+    imm,    // one word, value
+    mem,    // two words, [ reg + value ]
+    target  // one word, ip in ram. Index of a block in the ir
+  };
+
+  constexpr size_t max_operands = 3u;
+
+  using operand_layout = std::array<operand_kind, max_operands>;
+
+  //Operands in order of their words in ram
+  constexpr operand_layout get_operand_layout(instructions::instruction inst)
+  {
+    using inst_t = instructions::instruction;
+    using k = operand_kind;
+
+    switch(inst)
+    {
+      case inst_t::je: return { k::target };                      // je ip
+      case inst_t::jmp: return { k::target };                     // jmp ip
+      case inst_t::cmp: return { k::reg, k::imm };                // cmp reg val
+      case inst_t::add_reg_mem_ptr_reg_plus_val: return { k::reg, k::mem }; // add reg reg2 val
+      case inst_t::sub_reg_val: return { k::reg, k::imm };        // sub reg val
+      case inst_t::mov_mem_reg_ptr_reg_plus_val: return { k::mem, k::reg }; // mov reg val reg2
+      case inst_t::mov_mem_val_ptr_reg_plus_val: return { k::mem, k::imm }; // mov reg val val2
+      case inst_t::mov_reg_mem_ptr_reg_plus_val: return { k::reg, k::mem }; // mov reg reg2 val
+      case inst_t::mov_reg_reg: return { k::reg, k::reg };        // mov reg reg2
+      case inst_t::mov_reg_val: return { k::reg, k::imm };        // mov reg val
+      case inst_t::inc: return { k::reg };                        // inc reg
+      case inst_t::adc_reg_reg: return { k::reg, k::reg };        // adc reg reg2
+      case inst_t::sbb_reg_reg: return { k::reg, k::reg };        // sbb reg reg2
+      case inst_t::addn: return { k::reg, k::reg, k::reg };       // addn reg reg2 reg3
+      case inst_t::subn: return { k::reg, k::reg, k::reg };       // subn reg reg2 reg3
+      case inst_t::xadd_mem_ptr_reg_plus_val_reg: return { k::mem, k::reg };    // xadd reg val reg2
+      case inst_t::cmpxchg_mem_ptr_reg_plus_val_reg: return { k::mem, k::reg }; // cmpxchg reg val reg2
+      case inst_t::spawn_reg_ip: return { k::reg, k::target };    // spawn reg ip
+      case inst_t::in_reg_port: return { k::reg, k::imm };        // in reg port
+      case inst_t::out_port_reg: return { k::imm, k::reg };       // out port reg
+      case inst_t::ins_reg_reg_port: return { k::reg, k::reg, k::imm };  // ins reg reg2 port
+      case inst_t::outs_port_reg_reg: return { k::imm, k::reg, k::reg }; // outs port reg reg2
+      case inst_t::add_reg_reg: return { k::reg, k::reg };        // add reg reg2
+      case inst_t::copyn: return { k::mem, k::mem, k::reg };      // copyn reg val reg2 val2 reg3
+      case inst_t::filln: return { k::mem, k::reg, k::reg };      // filln reg val reg2 reg3
+      case inst_t::cmpn: return { k::mem, k::mem, k::reg };       // cmpn reg val reg2 val2 reg3
+      case inst_t::sumn: return { k::reg, k::mem, k::reg };       // sumn reg reg2 val reg3
+
+      default: return {};
+    }
+  }
+
+  constexpr size_t get_operand_words(operand_kind kind)
+  {
+    switch(kind)
+    {
+      case operand_kind::none: return 0u;
+      case operand_kind::mem: return 2u;
+      default: return 1u;
+    }
+  }
+
+  constexpr bool layouts_match_ip_changes()
+  {
+    for(size_t opcode = instructions::instruction::none + 1u;
+        opcode < instructions::instruction::instruction_count;
+        ++opcode)
+    {
+      const auto inst = static_cast<instructions::instruction>(opcode);
+
+      size_t words{ 1u };
+      for(const auto kind : get_operand_layout(inst))
+      {
+        words += get_operand_words(kind);
+      }
+
+      if(words != instructions::get_ip_change(inst))
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  static_assert(layouts_match_ip_changes(), "operand layout of an instruction does not match its ip change");
+
+  struct operand
+  {
+    operand_kind kind{ operand_kind::none };
+    unit_t reg{ 0u };   // reg, mem
+    unit_t value{ 0u }; // imm, mem offset, target
+  };
+
+  struct instruction
+  {
+    constexpr size_t size() const
+    {
+      return instructions::get_ip_change(opcode);
+    }
+
+    constexpr bool is_jump() const
+    {
+      return opcode == instructions::instruction::je || opcode == instructions::instruction::jmp;
+    }
+
+    //Nothing executes after it in the same block
+    constexpr bool ends_block() const
+    {
+      return is_jump() || opcode == instructions::instruction::exit;
+    }
+
+    constexpr bool falls_through() const
+    {
+      return opcode != instructions::instruction::jmp && opcode != instructions::instruction::exit;
+    }
+
+    instructions::instruction opcode{ instructions::instruction::none };
+    std::array<operand, max_operands> operands{};
+    size_t address{ 0u }; // ip in the lifted machine
+  };
+
+  constexpr size_t no_block = static_cast<size_t>(-1);
+
+  struct block
+  {
+    size_t first{ 0u }; // index of the first instruction
+    size_t count{ 0u };
+    size_t address{ 0u };
+    size_t target{ no_block };      // block jumped to by the last instruction. Blocks started by spawn are not successors
+    size_t fallthrough{ no_block }; // block executed next when the last instruction does not jump
+  };
+
+  template <typename ram_t>
+  constexpr instruction decode(const ram_t& ram, size_t ip)
+  {
+    instruction result;
+    result.opcode = static_cast<instructions::instruction>(ram[ip]);
+    result.address = ip;
+
+    const auto layout = get_operand_layout(result.opcode);
+    auto word = ip + 1u;
+
+    for(size_t i = 0u; i < max_operands; ++i)
+    {
+      auto& op = result.operands[i];
+      op.kind = layout[i];
+
+      switch(op.kind)
+      {
+        case operand_kind::reg: op.reg = ram[word]; break;
+        case operand_kind::mem: op.reg = ram[word]; op.value = ram[word + 1u]; break;
+        case operand_kind::imm:
+        case operand_kind::target: op.value = ram[word]; break;
+        default: break;
+      }
+
+      word += get_operand_words(op.kind);
+    }
+
+    return result;
+  }
+
+  //Targets are written as they are, so they have to be ips already. Returns words written
+  template <typename it_t>
+  constexpr size_t encode(const instruction& inst, it_t dest)
+  {
+    auto it = dest;
+    *it++ = inst.opcode;
+
+    for(const auto& op : inst.operands)
+    {
+      switch(op.kind)
+      {
+        case operand_kind::reg: *it++ = op.reg; break;
+        case operand_kind::mem: *it++ = op.reg; *it++ = op.value; break;
+        case operand_kind::imm:
+        case operand_kind::target: *it++ = op.value; break;
+        default: break;
+      }
+    }
+
+    return static_cast<size_t>(it - dest);
+  }
+
+  //Storage is allocated during constant evaluation, so a program is built and lowered
+  //within one constexpr function
+  struct program
+  {
+    constexpr const instruction& last(const block& b) const
+    {
+      return instructions[b.first + b.count - 1u];
+    }
+
+    std::vector<instruction> instructions;
+    std::vector<block> blocks;
+    size_t entry{ 0u };
+    bool valid{ false }; // false when the code could not be lifted, e.g. it runs past the image
+  };
+
+  //Only code reachable from eip is lifted, so words of the image which are never executed
+  //do not become instructions
+  template <typename machine_t>
+  class lifter
+  {
+  public:
+    constexpr explicit lifter(const machine_t& m)
+      : m_machine{ m }
+      , m_image_size{ std::min<size_t>(m.image_size, m.ram.size()) }
+      , m_starts(m_image_size, 0u)
+      , m_leader(m_image_size, 0u)
+      , m_block_at(m_image_size, no_block)
+    {}
+
+    constexpr program lift()
+    {
+      program p;
+      p.valid = discover() && build_blocks(p);
+
+      if(p.valid)
+      {
+        resolve_targets(p);
+        p.entry = m_block_at[m_machine.eip()];
+      }
+
+      return p;
+    }
+
+  private:
+    constexpr bool discover()
+    {
+      using inst_t = instructions::instruction;
+
+      m_valid = true;
+      branch_to(m_machine.eip());
+
+      while(!m_worklist.empty() && m_valid)
+      {
+        const auto ip = m_worklist.back();
+        m_worklist.pop_back();
+
+        const auto inst = static_cast<inst_t>(m_machine.ram[ip]);
+        const auto size = instructions::get_ip_change(inst);
+
+        if(size == 0u || ip + size > m_image_size)
+        {
+          return false;
+        }
+
+        const auto next = ip + size;
+
+        switch(inst)
+        {
+          case inst_t::exit:
+          break;
+
+          case inst_t::jmp:
+            branch_to(m_machine.ram[ip + 1u]);
+          break;
+
+          case inst_t::je:
+            branch_to(m_machine.ram[ip + 1u]);
+            branch_to(next);
+          break;
+
+          case inst_t::spawn_reg_ip:
+            branch_to(m_machine.ram[ip + 2u]);
+            visit(next);
+          break;
+
+          default:
+            visit(next);
+          break;
+        }
+      }
+
+      return m_valid;
+    }
+
+    constexpr void branch_to(size_t ip)
+    {
+      if(ip < m_image_size)
+      {
+        m_leader[ip] = true;
+      }
+
+      visit(ip);
+    }
+
+    constexpr void visit(size_t ip)
+    {
+      if(ip >= m_image_size)
+      {
+        m_valid = false;
+      }
+      else if(!m_starts[ip])
+      {
+        m_starts[ip] = true;
+        m_worklist.push_back(ip);
+      }
+    }
+
+    //Instructions in order of their ips. A block ends after a jump or exit and before a leader
+    constexpr bool build_blocks(program& p)
+    {
+      size_t end_of_previous{ 0u };
+      bool previous_ends_block{ true };
+
+      for(size_t ip = 0u; ip < m_image_size; ++ip)
+      {
+        if(!m_starts[ip])
+        {
+          continue;
+        }
+
+        if(ip < end_of_previous)
+        {
+          return false; // jump into the middle of an instruction
+        }
+
+        const auto inst = decode(m_machine.ram, ip);
+
+        if(previous_ends_block || m_leader[ip])
+        {
+          if(!p.blocks.empty() && p.last(p.blocks.back()).falls_through())
+          {
+            p.blocks.back().fallthrough = p.blocks.size();
+          }
+
+          m_block_at[ip] = p.blocks.size();
+          p.blocks.push_back(block{ p.instructions.size(), 0u, ip });
+        }
+
+        p.instructions.push_back(inst);
+        ++p.blocks.back().count;
+
+        end_of_previous = ip + inst.size();
+        previous_ends_block = inst.ends_block();
+      }
+
+      return true;
+    }
+
+    constexpr void resolve_targets(program& p) const
+    {
+      for(auto& inst : p.instructions)
+      {
+        for(auto& op : inst.operands)
+        {
+          if(op.kind == operand_kind::target)
+          {
+            op.value = m_block_at[op.value];
+          }
+        }
+      }
+
+      for(auto& b : p.blocks)
+      {
+        const auto& inst = p.last(b);
+
+        if(inst.is_jump())
+        {
+          b.target = inst.operands[0].value;
+        }
+      }
+    }
+
+    const machine_t& m_machine;
+    size_t m_image_size;
+    std::vector<uint8_t> m_starts;
+    std::vector<uint8_t> m_leader;
+    std::vector<size_t> m_block_at;
+    std::vector<size_t> m_worklist;
+    bool m_valid{ true };
+  };
+
+  template <typename machine_t>
+  constexpr program lift(const machine_t& m)
+  {
+    return lifter<machine_t>{ m }.lift();
+  }
+
+  //A jmp is added after a block whose fallthrough is not the next one
+  constexpr bool needs_jump(const program& p, size_t index)
+  {
+    const auto fallthrough = p.blocks[index].fallthrough;
+    return fallthrough != no_block && fallthrough != index + 1u;
+  }
+
+  //Ips of the blocks laid out in their order in the program, followed by the end of the code
+  constexpr std::vector<size_t> get_block_addresses(const program& p)
+  {
+    const auto jmp_size = instructions::get_ip_change(instructions::instruction::jmp);
+
+    std::vector<size_t> addresses;
+    size_t ip{ 0u };
+
+    for(size_t i = 0u; i < p.blocks.size(); ++i)
+    {
+      addresses.push_back(ip);
+
+      const auto& b = p.blocks[i];
+      for(size_t j = b.first; j < b.first + b.count; ++j)
+      {
+        ip += p.instructions[j].size();
+      }
+
+      ip += needs_jump(p, i) ? jmp_size : 0u;
+    }
+
+    addresses.push_back(ip);
+    return addresses;
+  }
+
+  //Writes code at the beginning of ram of m, which has to fit it, and points eip at the
+  //entry. The rest of ram and other registers are left as they are. Returns words written
+  template <typename machine_t>
+  constexpr size_t lower(const program& p, machine_t& m)
+  {
+    const auto addresses = get_block_addresses(p);
+    auto dest = m.ram.begin();
+
+    for(size_t i = 0u; i < p.blocks.size(); ++i)
+    {
+      const auto& b = p.blocks[i];
+
+      for(size_t j = b.first; j < b.first + b.count; ++j)
+      {
+        auto inst = p.instructions[j];
+
+        for(auto& op : inst.operands)
+        {
+          if(op.kind == operand_kind::target)
+          {
+            op.value = addresses[op.value];
+          }
+        }
+
+        dest += encode(inst, dest);
+      }
+
+      if(needs_jump(p, i))
+      {
+        instruction jmp{ instructions::instruction::jmp };
+        jmp.operands[0] = { operand_kind::target, 0u, addresses[b.fallthrough] };
+
+        dest += encode(jmp, dest);
+      }
+    }
+
+    m.eip() = p.blocks.size() > 0u ? addresses[p.entry] : 0u;
+
+    return addresses.back();
+  }
+
+  template <size_t amount_of_ram>
+  constexpr machine<amount_of_ram> lower(const program& p)
+  {
+    machine<amount_of_ram> m;
+
+    m.image_size = lower(p, m);
+    m.esp() = amount_of_ram - 1;
+
+    return m;
+  }
+}
+
+//Partial evaluation. Instructions depending only on known registers and ram are executed
+//at compile time, the rest is emitted as a residual block. The residual block is placed
+//in words the program provably never accesses, starts the specialized machine and jumps
+//back to the original code where evaluation stopped: on exit, on a conditional jump
+//depending on unknown data or when fuel ran out. When the program does not access its
+//image, the code still reachable is moved right after the residual block instead.
+//Before every emitted instruction, known values it reads are materialized with movs.
+namespace partial
+{
+  //Parts of the initial machine which will be supplied at runtime
+  struct unknown_inputs
+  {
+    constexpr unknown_inputs& reg(regs::reg r)
+    {
+      regs_mask |= 1u << static_cast<unsigned>(r);
+      return *this;
+    }
+
+    constexpr unknown_inputs& ram(size_t first, size_t last)
+    {
+      ram_first = first;
+      ram_last = last;
+      return *this;
+    }
+
+    unsigned regs_mask{ 0u };
+    size_t ram_first{ 0u }; //[ram_first, ram_last)
+    size_t ram_last{ 0u };
+  };
+
+  template <size_t amount_of_ram>
+  struct result
+  {
+    machine<amount_of_ram> m;
+    bool specialized{ false };
+    size_t folded{ 0u };         //instructions executed at compile time
+    size_t residual_words{ 0u };
+  };
+
+  constexpr size_t regs_count = static_cast<size_t>(regs::reg::eip);
+
+  struct knowledge
+  {
+    bool known{ false };
+    bool consistent{ false }; //value at runtime equals the known one
+  };
+
+  //What an instruction reads and writes
+  struct effects
+  {
+    unsigned reads_regs{ 0u };
+    unsigned writes_regs{ 0u };
+    bool reads_zf{ false };
+    bool writes_zf{ false };
+    bool reads_cf{ false };
+    bool writes_cf{ false };
+    bool reads_mem{ false };
+    bool writes_mem{ false };
+    unit_t mem_reg{ 0u };     //[ mem_reg + mem_offset ]
+    unit_t mem_offset{ 0u };
+    bool bulk{ false };       //addn/subn: reg, reg2, reg3 are the first three operands
+    bool barrier{ false };    //fence, spawn, ports: other cores may observe the state. Block copies
+                              //and fills of copyn, filln, cmpn and sumn are not tracked either
+  };
+
+  template <typename machine_t>
+  constexpr effects get_effects(const machine_t& m, size_t ip)
+  {
+    using inst_t = instructions::instruction;
+
+    const auto word = [&](size_t i) { return m.ram[ip + i]; };
+    const auto bit = [](unit_t reg) { return 1u << static_cast<unsigned>(reg); };
+
+    effects e;
+
+    switch(static_cast<inst_t>(word(0)))
+    {
+      case inst_t::je:
+        e.reads_zf = true;
+      break;
+
+      case inst_t::cmp: // cmp reg val
+        e.reads_regs = bit(word(1));
+        e.writes_zf = true;
+      break;
+
+      case inst_t::add_reg_mem_ptr_reg_plus_val: // add reg reg2 val
+        e.reads_regs = bit(word(1)) | bit(word(2));
+        e.writes_regs = bit(word(1));
+        e.writes_cf = true;
+        e.reads_mem = true;
+        e.mem_reg = word(2);
+        e.mem_offset = word(3);
+      break;
+
+      case inst_t::sub_reg_val: // sub reg val
+      case inst_t::inc: // inc reg
+        e.reads_regs = bit(word(1));
+        e.writes_regs = bit(word(1));
+        e.writes_cf = word(0) == inst_t::sub_reg_val;
+      break;
+
+      case inst_t::mov_mem_reg_ptr_reg_plus_val: // mov reg val reg2
+        e.reads_regs = bit(word(1)) | bit(word(3));
+        e.writes_mem = true;
+        e.mem_reg = word(1);
+        e.mem_offset = word(2);
+      break;
+
+      case inst_t::mov_mem_val_ptr_reg_plus_val: // mov reg val val2
+        e.reads_regs = bit(word(1));
+        e.writes_mem = true;
+        e.mem_reg = word(1);
+        e.mem_offset = word(2);
+      break;
+
+      case inst_t::mov_reg_mem_ptr_reg_plus_val: // mov reg reg2 val
+        e.reads_regs = bit(word(2));
+        e.writes_regs = bit(word(1));
+        e.reads_mem = true;
+        e.mem_reg = word(2);
+        e.mem_offset = word(3);
+      break;
+
+      case inst_t::mov_reg_reg: // mov reg reg2
+        e.reads_regs = bit(word(2));
+        e.writes_regs = bit(word(1));
+      break;
+
+      case inst_t::mov_reg_val: // mov reg val
+        e.writes_regs = bit(word(1));
+      break;
+
+      case inst_t::adc_reg_reg: // adc reg reg2
+      case inst_t::sbb_reg_reg: // sbb reg reg2
+        e.reads_regs = bit(word(1)) | bit(word(2));
+        e.writes_regs = bit(word(1));
+        e.reads_cf = true;
+        e.writes_cf = true;
+      break;
+
+      case inst_t::add_reg_reg: // add reg reg2
+        e.reads_regs = bit(word(1)) | bit(word(2));
+        e.writes_regs = bit(word(1));
+        e.writes_cf = true;
+      break;
+
+      case inst_t::addn: // addn reg reg2 reg3
+      case inst_t::subn: // subn reg reg2 reg3
+        e.reads_regs = bit(word(1)) | bit(word(2)) | bit(word(3));
+        e.writes_cf = true;
+        e.reads_mem = true;
+        e.writes_mem = true;
+        e.bulk = true;
+      break;
+
+      case inst_t::xadd_mem_ptr_reg_plus_val_reg: // xadd reg val reg2
+        e.reads_regs = bit(word(1)) | bit(word(3));
+        e.writes_regs = bit(word(3));
+        e.reads_mem = true;
+        e.writes_mem = true;
+        e.mem_reg = word(1);
+        e.mem_offset = word(2);
+      break;
+
+      case inst_t::cmpxchg_mem_ptr_reg_plus_val_reg: // cmpxchg reg val reg2
+      {
+        const auto eax = bit(regs::to_unit_t(regs::reg::eax));
+        e.reads_regs = bit(word(1)) | bit(word(3)) | eax;
+        e.writes_regs = eax;
+        e.writes_zf = true;
+        e.reads_mem = true;
+        e.writes_mem = true;
+        e.mem_reg = word(1);
+        e.mem_offset = word(2);
+      }break;
+
+      case inst_t::fence:
+      case inst_t::spawn_reg_ip:
+      case inst_t::in_reg_port:
+      case inst_t::out_port_reg:
+      case inst_t::ins_reg_reg_port:
+      case inst_t::outs_port_reg_reg:
+      case inst_t::copyn:
+      case inst_t::filln:
+      case inst_t::cmpn:
+      case inst_t::sumn:
+        e.barrier = true;
+      break;
+
+      default:
+      break;
+    }
+
+    return e;
+  }
+
+  template <size_t amount_of_ram>
+  class evaluator
+  {
+  public:
+    constexpr evaluator(const machine<amount_of_ram>& m, unknown_inputs inputs)
+      : m_original{ m }
+      , m_known{ m }
+      , m_footprint{ footprint::analyze(m, amount_of_ram, inputs.regs_mask) }
+    {
+      for(size_t i = 0u; i < amount_of_ram; ++i)
+      {
+        const auto unknown = i >= inputs.ram_first && i < inputs.ram_last;
+        m_ram[i] = { !unknown, !unknown };
+      }
+
+      for(size_t i = 0u; i < regs_count; ++i)
+      {
+        const auto unknown = (inputs.regs_mask & (1u << i)) != 0u;
+        m_regs[i] = { !unknown, !unknown };
+      }
+
+      //The residual block goes to words the program never accesses: above its image and
+      //absolute addresses, below its stack. Programs whose accesses are not bounded, or
+      //whose stack or code is not known, are not specialized
+      const auto esp_unknown = (inputs.regs_mask >> static_cast<unsigned>(regs::reg::esp)) & 1u;
+      const auto code_unknown = inputs.ram_first < m.image_size && inputs.ram_first < inputs.ram_last;
+      const auto stack_bottom = static_cast<long long>(m.esp()) + m_footprint.min_stack_offset;
+
+      m_failed = !m_footprint.bounded || esp_unknown || code_unknown;
+      m_start = std::max<size_t>(m.image_size, m_footprint.absolute_end);
+      m_limit = stack_bottom < 0 ? 0u : static_cast<size_t>(stack_bottom);
+    }
+
+    constexpr result<amount_of_ram> evaluate(size_t fuel)
+    {
+      while(fuel-- > 0u && step())
+      {}
+
+      //A copy right before the stop point is left to the original code
+      if(m_last_copy.valid && !m_failed)
+      {
+        m_code.resize(m_last_copy.code_size);
+        m_regs = m_last_copy.regs;
+        m_zf = m_last_copy.zf;
+        m_cf = m_last_copy.cf;
+        m_known.eip() = m_last_copy.ip;
+      }
+
+      const auto stop_ip = m_known.eip();
+      flush_all();
+      emit({ instructions::instruction::jmp, stop_ip });
+
+      //Specializing is pointless when nothing has been folded
+      if(m_failed || m_folded == 0u)
+      {
+        return { m_original, false, 0u, 0u };
+      }
+
+      auto m = m_original;
+      if(compact(m, stop_ip))
+      {
+        return { m, true, m_folded, m_code.size() };
+      }
+
+      if(m_start + m_code.size() > m_limit)
+      {
+        return { m_original, false, 0u, 0u };
+      }
+
+      algo::copy(m_code.begin(), m_code.end(), m.ram.begin() + m_start);
+      m.eip() = m_start;
+      m.image_size = m_start + m_code.size();
+
+      return { m, true, m_folded, m_code.size() };
+    }
+
+  private:
+    //Programs which never access their image get only the residual block followed by the
+    //code reachable from where evaluation stopped, laid out from address 0. Code evaluated
+    //at compile time and not reachable any more is dropped
+    constexpr bool compact(machine<amount_of_ram>& m, size_t stop_ip) const
+    {
+      const auto image_size = m_original.image_size;
+      if(m_footprint.absolute_begin < image_size || m_limit < image_size)
+      {
+        return false;
+      }
+
+      auto original = m_original;
+      original.eip() = stop_ip;
+      const auto rest = ir::lift(original);
+      if(!rest.valid)
+      {
+        return false;
+      }
+
+      //Residual block without its jmp back falls through to the entry of the rest
+      ir::program p;
+      ir::block head{};
+      const auto residual_end = m_code.size() - instructions::get_ip_change(instructions::instruction::jmp);
+
+      for(size_t ip = 0u; ip < residual_end; ip += p.instructions.back().size())
+      {
+        p.instructions.push_back(ir::decode(m_code, ip));
+        ++head.count;
+      }
+
+      const size_t shift = head.count > 0u ? 1u : 0u;
+      if(head.count > 0u)
+      {
+        head.fallthrough = rest.entry + shift;
+        p.blocks.push_back(head);
+      }
+
+      for(auto inst : rest.instructions)
+      {
+        for(auto& op : inst.operands)
+        {
+          op.value += op.kind == ir::operand_kind::target ? shift : 0u;
+        }
+
+        p.instructions.push_back(inst);
+      }
+
+      for(auto b : rest.blocks)
+      {
+        b.first += head.count;
+        b.target += b.target != ir::no_block ? shift : 0u;
+        b.fallthrough += b.fallthrough != ir::no_block ? shift : 0u;
+        p.blocks.push_back(b);
+      }
+
+      p.entry = head.count > 0u ? 0u : rest.entry;
+      p.valid = true;
+
+      const auto end = ir::get_block_addresses(p).back();
+      if(end > m_limit || end > m_footprint.absolute_begin)
+      {
+        return false;
+      }
+
+      for(size_t i = 0u; i < image_size; ++i)
+      {
+        m.ram[i] = 0u;
+      }
+
+      ir::lower(p, m);
+      m.image_size = end;
+      return true;
+    }
+
+    //Returns false when evaluation has to stop at current eip
+    constexpr bool step()
+    {
+      using inst_t = instructions::instruction;
+
+      const auto ip = m_known.eip();
+      const auto inst = execute::get_next_instruction(m_known);
+      const auto size = instructions::get_ip_change(inst);
+
+      if(size == 0u || inst == inst_t::exit || ip + size > amount_of_ram)
+      {
+        return false;
+      }
+
+      for(auto i = ip; i < ip + size; ++i)
+      {
+        if(!m_ram[i].known)
+        {
+          return false; //code depends on runtime data
+        }
+      }
+
+      const auto e = get_effects(m_known, ip);
+
+      if(e.barrier)
+      {
+        return false;
+      }
+
+      if(all_known(e))
+      {
+        fold(e);
+        return true;
+      }
+
+      if(inst == inst_t::je || inst == inst_t::jmp)
+      {
+        return false;
+      }
+
+      emit_instruction(e, ip, size);
+      return !m_failed;
+    }
+
+    constexpr bool all_known(const effects& e) const
+    {
+      for(size_t i = 0u; i < regs_count; ++i)
+      {
+        if((e.reads_regs & (1u << i)) != 0u && !m_regs[i].known)
+        {
+          return false;
+        }
+      }
+
+      if((e.reads_zf && !m_zf.known) || (e.reads_cf && !m_cf.known))
+      {
+        return false;
+      }
+
+      if(e.bulk)
+      {
+        const auto count = bulk_reg_val(2);
+        return ram_known(bulk_reg_val(0), count) && ram_known(bulk_reg_val(1), count);
+      }
+
+      if(e.reads_mem)
+      {
+        return ram_known(mem_address(e), 1u);
+      }
+
+      return true;
+    }
+
+    struct stores_observer
+    {
+      constexpr void on_load(size_t)
+      {}
+
+      //Called before the store, a word keeps holding its runtime value when it is stored again
+      constexpr void on_store(size_t address, unit_t value)
+      {
+        if(address < amount_of_ram)
+        {
+          const auto same = self.m_ram[address].known && self.m_known.ram[address] == value;
+          self.m_ram[address] = { true, same && self.m_ram[address].consistent };
+        }
+      }
+
+      evaluator& self;
+    };
+
+    constexpr void fold(const effects& e)
+    {
+      std::array<unit_t, regs_count> before{};
+      for(size_t i = 0u; i < regs_count; ++i)
+      {
+        before[i] = m_known.get_reg(static_cast<unit_t>(i));
+      }
+      const auto zf_before = m_known.zf;
+      const auto cf_before = m_known.cf;
+
+      stores_observer observer{ *this };
+      execute::observed<machine<amount_of_ram>, stores_observer> view{ m_known, observer };
+      if(execute::execute_next_instruction(view))
+      {
+        execute::adjust_eip(m_known);
+      }
+
+      for(size_t i = 0u; i < regs_count; ++i)
+      {
+        if((e.writes_regs & (1u << i)) != 0u)
+        {
+          const auto same = m_regs[i].known && before[i] == m_known.get_reg(static_cast<unit_t>(i));
+          m_regs[i] = { true, same && m_regs[i].consistent };
+        }
+      }
+
+      if(e.writes_zf)
+      {
+        m_zf = { true, m_zf.known && m_zf.consistent && zf_before == m_known.zf };
+      }
+
+      if(e.writes_cf)
+      {
+        m_cf = { true, m_cf.known && m_cf.consistent && cf_before == m_known.cf };
+      }
+
+      ++m_folded;
+      m_last_copy.valid = false;
+    }
+
+    constexpr void emit_instruction(const effects& e, size_t ip, size_t size)
+    {
+      for(size_t i = 0u; i < regs_count; ++i)
+      {
+        if((e.reads_regs & (1u << i)) != 0u)
+        {
+          materialize_reg(i);
+        }
+      }
+
+      if(e.reads_cf)
+      {
+        materialize_cf();
+      }
+
+      const auto bulk_known = e.bulk && m_regs[bulk_reg(0)].known && m_regs[bulk_reg(1)].known && m_regs[bulk_reg(2)].known;
+      const auto address_known = !e.bulk && m_regs[e.mem_reg].known;
+
+      if(bulk_known)
+      {
+        materialize_ram(bulk_reg_val(0), bulk_reg_val(2));
+        materialize_ram(bulk_reg_val(1), bulk_reg_val(2));
+      }
+      else if(address_known && e.reads_mem)
+      {
+        materialize_ram(mem_address(e), 1u);
+      }
+      else if(e.reads_mem || e.writes_mem)
+      {
+        flush_ram();
+      }
+
+      m_last_copy = { !e.writes_mem, ip, m_code.size(), m_regs, m_zf, m_cf };
+
+      for(size_t i = 0u; i < size; ++i)
+      {
+        emit_word(m_known.ram[ip + i]);
+      }
+
+      for(size_t i = 0u; i < regs_count; ++i)
+      {
+        if((e.writes_regs & (1u << i)) != 0u)
+        {
+          m_regs[i] = {};
+        }
+      }
+
+      if(e.writes_zf)
+      {
+        m_zf = {};
+      }
+
+      if(e.writes_cf)
+      {
+        m_cf = {};
+      }
+
+      if(bulk_known)
+      {
+        forget_ram(bulk_reg_val(0), bulk_reg_val(2));
+      }
+      else if(address_known && e.writes_mem)
+      {
+        forget_ram(mem_address(e), 1u);
+      }
+      else if(e.writes_mem)
+      {
+        forget_ram(0u, amount_of_ram);
+      }
+
+      m_known.eip() = ip + size;
+    }
+
+    constexpr void flush_all()
+    {
+      flush_ram();
+      materialize_cf();
+      materialize_zf();
+
+      for(size_t i = 0u; i < regs_count; ++i)
+      {
+        materialize_reg(i);
+      }
+    }
+
+    constexpr void flush_ram()
+    {
+      materialize_ram(0u, amount_of_ram);
+    }
+
+    constexpr void materialize_reg(size_t i)
+    {
+      if(m_regs[i].known && !m_regs[i].consistent)
+      {
+        emit({ instructions::instruction::mov_reg_val, i, reg_val(i) });
+        m_regs[i].consistent = true;
+      }
+    }
+
+    constexpr void materialize_ram(size_t first, size_t count)
+    {
+      for(auto i = first; i < first + count && i < amount_of_ram; ++i)
+      {
+        if(m_ram[i].known && !m_ram[i].consistent)
+        {
+          const auto base = base_reg();
+          emit({ instructions::instruction::mov_mem_val_ptr_reg_plus_val, base, i - reg_val(base), m_known.ram[i] });
+          m_ram[i].consistent = true;
+        }
+      }
+    }
+
+    //Only cmp sets zf
+    constexpr void materialize_zf()
+    {
+      if(m_zf.known && !m_zf.consistent)
+      {
+        const auto base = base_reg();
+        emit({ instructions::instruction::cmp, base, m_known.zf ? reg_val(base) : reg_val(base) + 1u });
+        m_zf.consistent = true;
+      }
+    }
+
+    //sub sets cf on borrow and does not touch zf
+    constexpr void materialize_cf()
+    {
+      using inst_t = instructions::instruction;
+
+      if(m_cf.known && !m_cf.consistent)
+      {
+        const auto base = base_reg();
+
+        if(m_known.cf)
+        {
+          emit({ inst_t::mov_reg_val, base, 0u });
+          emit({ inst_t::sub_reg_val, base, 1u });
+          emit({ inst_t::mov_reg_val, base, reg_val(base) });
+        }
+        else
+        {
+          emit({ inst_t::sub_reg_val, base, 0u });
+        }
+
+        m_cf.consistent = true;
+      }
+    }
+
+    //Known register holding its value at runtime, used to address ram and set flags
+    constexpr size_t base_reg()
+    {
+      for(size_t i = 0u; i < regs_count; ++i)
+      {
+        if(m_regs[i].known && m_regs[i].consistent)
+        {
+          return i;
+        }
+      }
+
+      for(size_t i = 0u; i < regs_count; ++i)
+      {
+        if(m_regs[i].known)
+        {
+          materialize_reg(i);
+          return i;
+        }
+      }
+
+      m_failed = true;
+      return 0u;
+    }
+
+    constexpr void emit(std::initializer_list<unit_t> words)
+    {
+      for(const auto w : words)
+      {
+        emit_word(w);
+      }
+    }
+
+    constexpr void emit_word(unit_t word)
+    {
+      if(m_code.size() >= amount_of_ram)
+      {
+        m_failed = true;
+        return;
+      }
+
+      m_code.push_back(word);
+    }
+
+    constexpr void forget_ram(size_t first, size_t count)
+    {
+      for(auto i = first; i < first + count && i < amount_of_ram; ++i)
+      {
+        m_ram[i] = {};
+      }
+    }
+
+    constexpr bool ram_known(size_t first, size_t count) const
+    {
+      for(auto i = first; i < first + count; ++i)
+      {
+        if(i >= amount_of_ram || !m_ram[i].known)
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    constexpr unit_t reg_val(size_t i) const
+    {
+      return m_known.get_reg(static_cast<unit_t>(i));
+    }
+
+    constexpr unit_t bulk_reg(size_t operand) const
+    {
+      return m_known.ram[m_known.eip() + 1u + operand];
+    }
+
+    constexpr unit_t bulk_reg_val(size_t operand) const
+    {
+      return reg_val(bulk_reg(operand));
+    }
+
+    constexpr size_t mem_address(const effects& e) const
+    {
+      return reg_val(e.mem_reg) + e.mem_offset;
+    }
+
+    machine<amount_of_ram> m_original;
+    machine<amount_of_ram> m_known;    //known values, eip of the next instruction to evaluate
+    std::vector<unit_t> m_code;        //residual block, placed at m_start unless compacted
+    std::array<knowledge, amount_of_ram> m_ram{};
+    std::array<knowledge, regs_count> m_regs{};
+    knowledge m_zf{ true, true };
+    knowledge m_cf{ true, true };
+    footprint::result m_footprint;
+    size_t m_start{ 0u };  //first word of the residual block
+    size_t m_limit{ 0u };  //the residual block ends below it
+    size_t m_folded{ 0u };
+    bool m_failed{ false };
+
+    //State before the last copied instruction, it is dropped when evaluation stops right after it
+    struct last_copy
+    {
+      bool valid{ false };
+      size_t ip{ 0u };
+      size_t code_size{ 0u };
+      std::array<knowledge, regs_count> regs{};
+      knowledge zf{};
+      knowledge cf{};
+    };
+
+    last_copy m_last_copy;
+  };
+
+  template <size_t amount_of_ram>
+  constexpr auto specialize(const machine<amount_of_ram>& m, unknown_inputs inputs, size_t fuel = 1u << 16u)
+  {
+    return evaluator<amount_of_ram>{ m, inputs }.evaluate(fuel);
+  }
+}
+
+//Promotes words of ram, which are accessed only by single word loads and stores at
+//statically known addresses, to virtual registers. Addresses are known by propagating
+//constant register values over the control flow graph, e.g. [ ebp + 2 ] after mov ebp , esp.
+//Promoted words are loaded once at the entry and are not written back to ram
+namespace promote
+{
+  constexpr size_t regs_count = static_cast<size_t>(regs::reg::eip);
+
+  struct known
+  {
+    constexpr bool operator==(const known&) const = default;
+
+    bool is_known{ false };
+    unit_t value{ 0u };
+  };
+
+  using known_regs = std::array<known, regs_count>;
+
+  template <typename machine_t>
+  struct result
+  {
+    machine_t m;
+    size_t promoted{ 0u };  //words moved to virtual registers
+    size_t rewritten{ 0u }; //loads and stores turned into register moves
+  };
+
+  struct slot
+  {
+    unit_t address{ 0u };
+    size_t accesses{ 0u };
+    bool read{ false };
+    bool promotable{ true };
+    size_t base{ regs_count }; //register known at the entry, to load the slot with
+  };
+
+  //Words accessed by addn, subn, ins, outs and block instructions. Slots they overlap are not promoted
+  struct range
+  {
+    unit_t first{ 0u };
+    unit_t count{ 0u };
+  };
+
+  template <typename machine_t>
+  class promoter
+  {
+  public:
+    constexpr promoter(const machine_t& m, const partial::unknown_inputs& unknown)
+      : m_machine{ m }
+      , m_program{ ir::lift(m) }
+    {
+      for(size_t i = 0u; i < regs_count; ++i)
+      {
+        const auto is_input = (unknown.regs_mask >> i) & 1u;
+        m_initial[i] = { !is_input, m.get_reg(static_cast<unit_t>(i)) };
+      }
+    }
+
+    constexpr result<machine_t> promote()
+    {
+      result<machine_t> r{ m_machine };
+
+      if(!m_program.valid || !propagate() || !collect())
+      {
+        return r;
+      }
+
+      const auto chosen = choose();
+      if(chosen.empty())
+      {
+        return r;
+      }
+
+      r.rewritten = rewrite(chosen);
+      add_prologue(chosen);
+
+      const auto end = ir::get_block_addresses(m_program).back();
+      const auto image_size = std::min<size_t>(m_machine.image_size, m_machine.ram.size());
+
+      //Code may grow over words no instruction accesses
+      if(end >= m_machine.ram.size() || (end > image_size && end > m_lowest_access))
+      {
+        return r;
+      }
+
+      ir::lower(m_program, r.m);
+      for(auto i = end; i < image_size; ++i)
+      {
+        r.m.ram[i] = instructions::instruction::none;
+      }
+
+      r.m.image_size = std::max(image_size, end);
+      r.promoted = chosen.size();
+
+      return r;
+    }
+
+  private:
+    static constexpr auto virtual_reg(size_t index)
+    {
+      return static_cast<unit_t>(regs::reg::v0) + index;
+    }
+
+    //Registers known after the instruction. False for instructions sharing memory with
+    //other cores and for programs already using virtual registers
+    static constexpr bool transfer(const ir::instruction& inst, known_regs& regs)
+    {
+      using inst_t = instructions::instruction;
+
+      const auto& op = inst.operands;
+      auto reg = [&regs](unit_t r) -> known& { return regs[static_cast<size_t>(r)]; };
+
+      for(const auto& o : op)
+      {
+        const auto has_reg = o.kind == ir::operand_kind::reg || o.kind == ir::operand_kind::mem;
+        if(has_reg && o.reg >= virtual_reg(0u))
+        {
+          return false;
+        }
+      }
+
+      switch(inst.opcode)
+      {
+        case inst_t::mov_reg_val: // mov reg val
+          reg(op[0].reg) = { true, op[1].value };
+        break;
+
+        case inst_t::mov_reg_reg: // mov reg reg2
+          reg(op[0].reg) = reg(op[1].reg);
+        break;
+
+        case inst_t::sub_reg_val: // sub reg val
+          reg(op[0].reg).value -= reg(op[0].reg).is_known ? op[1].value : 0u;
+        break;
+
+        case inst_t::inc: // inc reg
+          reg(op[0].reg).value += reg(op[0].reg).is_known ? 1u : 0u;
+        break;
+
+        case inst_t::add_reg_reg: // add reg reg2
+        {
+          const auto sum = known{ true, reg(op[0].reg).value + reg(op[1].reg).value };
+          reg(op[0].reg) = reg(op[0].reg).is_known && reg(op[1].reg).is_known ? sum : known{};
+        }break;
+
+        case inst_t::add_reg_mem_ptr_reg_plus_val: // add reg reg2 val
+        case inst_t::mov_reg_mem_ptr_reg_plus_val: // mov reg reg2 val
+        case inst_t::adc_reg_reg: // adc reg reg2
+        case inst_t::sbb_reg_reg: // sbb reg reg2
+        case inst_t::in_reg_port: // in reg port
+        case inst_t::sumn: // sumn reg reg2 val reg3
+          reg(op[0].reg) = {};
+        break;
+
+        case inst_t::ins_reg_reg_port: // ins reg reg2 port
+          reg(op[1].reg) = {};
+        break;
+
+        case inst_t::xadd_mem_ptr_reg_plus_val_reg:
+        case inst_t::cmpxchg_mem_ptr_reg_plus_val_reg:
+        case inst_t::fence:
+        case inst_t::spawn_reg_ip:
+        return false;
+
+        default:
+        break;
+      }
+
+      return true;
+    }
+
+    constexpr void merge(size_t block, const known_regs& regs)
+    {
+      if(!m_reached[block])
+      {
+        m_reached[block] = 1u;
+        m_states[block] = regs;
+        m_worklist.push_back(block);
+        return;
+      }
+
+      auto joined = m_states[block];
+      for(size_t i = 0u; i < regs_count; ++i)
+      {
+        if(joined[i] != regs[i])
+        {
+          joined[i] = {};
+        }
+      }
+
+      if(joined != m_states[block])
+      {
+        m_states[block] = joined;
+        m_worklist.push_back(block);
+      }
+    }
+
+    //Registers at the entry of every block, over all paths
+    constexpr bool propagate()
+    {
+      m_states.resize(m_program.blocks.size());
+      m_reached.resize(m_program.blocks.size(), 0u);
+      merge(m_program.entry, m_initial);
+
+      while(!m_worklist.empty())
+      {
+        const auto index = m_worklist.back();
+        m_worklist.pop_back();
+
+        const auto& b = m_program.blocks[index];
+        auto regs = m_states[index];
+
+        for(size_t i = b.first; i < b.first + b.count; ++i)
+        {
+          if(!transfer(m_program.instructions[i], regs))
+          {
+            return false;
+          }
+        }
+
+        for(const auto next : { b.target, b.fallthrough })
+        {
+          if(next != ir::no_block)
+          {
+            merge(next, regs);
+          }
+        }
+      }
+
+      return true;
+    }
+
+    constexpr slot& get_slot(unit_t address)
+    {
+      for(auto& s : m_slots)
+      {
+        if(s.address == address)
+        {
+          return s;
+        }
+      }
+
+      m_slots.push_back(slot{ address });
+      return m_slots.back();
+    }
+
+    constexpr bool add_range(const known& first, const known& count)
+    {
+      if(!first.is_known || !count.is_known)
+      {
+        return false;
+      }
+
+      if(count.value != 0u)
+      {
+        m_ranges.push_back(range{ first.value, count.value });
+        m_lowest_access = std::min(m_lowest_access, first.value);
+      }
+
+      return true;
+    }
+
+    //First word of [ reg + offset ]
+    static constexpr known at(const known& base, unit_t offset)
+    {
+      return { base.is_known, base.value + offset };
+    }
+
+    //Addresses of all accesses. False when one of them is not known or touches the image
+    constexpr bool collect()
+    {
+      using inst_t = instructions::instruction;
+
+      m_addresses.resize(m_program.instructions.size());
+
+      for(size_t index = 0u; index < m_program.blocks.size(); ++index)
+      {
+        const auto& b = m_program.blocks[index];
+        auto regs = m_states[index];
+
+        for(size_t i = b.first; i < b.first + b.count; ++i)
+        {
+          const auto& inst = m_program.instructions[i];
+          const auto& op = inst.operands;
+          auto reg = [&regs](unit_t r) { return regs[static_cast<size_t>(r)]; };
+
+          switch(inst.opcode)
+          {
+            case inst_t::add_reg_mem_ptr_reg_plus_val: // add reg reg2 val
+            case inst_t::mov_reg_mem_ptr_reg_plus_val: // mov reg reg2 val
+            case inst_t::mov_mem_reg_ptr_reg_plus_val: // mov reg val reg2
+            case inst_t::mov_mem_val_ptr_reg_plus_val: // mov reg val val2
+            {
+              const auto is_load = inst.opcode == inst_t::add_reg_mem_ptr_reg_plus_val
+                                || inst.opcode == inst_t::mov_reg_mem_ptr_reg_plus_val;
+              const auto& mem = op[is_load ? 1u : 0u];
+              const auto base = reg(mem.reg);
+
+              if(!base.is_known)
+              {
+                return false;
+              }
+
+              const auto address = base.value + mem.value;
+              m_addresses[i] = { true, address };
+              m_lowest_access = std::min(m_lowest_access, address);
+
+              auto& s = get_slot(address);
+              ++s.accesses;
+              s.read = s.read || is_load;
+            }break;
+
+            case inst_t::addn: // addn reg reg2 reg3
+            case inst_t::subn: // subn reg reg2 reg3
+              if(!add_range(reg(op[0].reg), reg(op[2].reg)) || !add_range(reg(op[1].reg), reg(op[2].reg)))
+              {
+                return false;
+              }
+            break;
+
+            case inst_t::ins_reg_reg_port: // ins reg reg2 port
+              if(!add_range(reg(op[0].reg), reg(op[1].reg)))
+              {
+                return false;
+              }
+            break;
+
+            case inst_t::outs_port_reg_reg: // outs port reg reg2
+              if(!add_range(reg(op[1].reg), reg(op[2].reg)))
+              {
+                return false;
+              }
+            break;
+
+            case inst_t::copyn: // copyn reg val reg2 val2 reg3
+            case inst_t::cmpn: // cmpn reg val reg2 val2 reg3
+              if(!add_range(at(reg(op[0].reg), op[0].value), reg(op[2].reg)) || !add_range(at(reg(op[1].reg), op[1].value), reg(op[2].reg)))
+              {
+                return false;
+              }
+            break;
+
+            case inst_t::filln: // filln reg val reg2 reg3
+              if(!add_range(at(reg(op[0].reg), op[0].value), reg(op[2].reg)))
+              {
+                return false;
+              }
+            break;
+
+            case inst_t::sumn: // sumn reg reg2 val reg3
+              if(!add_range(at(reg(op[1].reg), op[1].value), reg(op[2].reg)))
+              {
+                return false;
+              }
+            break;
+
+            default:
+            break;
+          }
+
+          transfer(inst, regs);
+        }
+      }
+
+      //Moving the code is safe only when no access reads or writes it
+      if(m_lowest_access < m_machine.image_size)
+      {
+        return false;
+      }
+
+      for(auto& s : m_slots)
+      {
+        s.promotable = s.address < m_machine.ram.size();
+
+        for(const auto& r : m_ranges)
+        {
+          if(s.address - r.first < r.count)
+          {
+            s.promotable = false;
+          }
+        }
+      }
+
+      return true;
+    }
+
+    //Most accessed slots, as many as there are virtual registers. Slots which are read need
+    //a register known at the entry to load them. The closest one below the slot is taken,
+    //so the offset does not wrap around
+    constexpr std::vector<slot> choose()
+    {
+      std::vector<slot> chosen;
+
+      for(auto s : m_slots)
+      {
+        for(size_t i = 0u; i <= static_cast<size_t>(regs::reg::esp); ++i)
+        {
+          const auto& r = m_initial[i];
+          const auto closer = s.base == regs_count || r.value > m_initial[s.base].value;
+
+          if(r.is_known && r.value <= s.address && closer)
+          {
+            s.base = i;
+          }
+        }
+
+        if(s.promotable && (!s.read || s.base != regs_count))
+        {
+          chosen.push_back(s);
+        }
+      }
+
+      std::sort(chosen.begin(), chosen.end(), [](const slot& lhs, const slot& rhs) { return lhs.accesses > rhs.accesses; });
+      chosen.resize(std::min(chosen.size(), regs::virtual_regs_count));
+
+      return chosen;
+    }
+
+    constexpr size_t rewrite(const std::vector<slot>& chosen)
+    {
+      using inst_t = instructions::instruction;
+      using k = ir::operand_kind;
+
+      size_t rewritten{ 0u };
+
+      for(size_t i = 0u; i < m_program.instructions.size(); ++i)
+      {
+        if(!m_addresses[i].is_known)
+        {
+          continue;
+        }
+
+        const auto found = std::find_if(chosen.begin(), chosen.end(), [&](const slot& s) { return s.address == m_addresses[i].value; });
+        if(found == chosen.end())
+        {
+          continue;
+        }
+
+        const ir::operand v{ k::reg, virtual_reg(static_cast<size_t>(found - chosen.begin())) };
+        auto& inst = m_program.instructions[i];
+        const auto op = inst.operands;
+
+        switch(inst.opcode)
+        {
+          case inst_t::mov_reg_mem_ptr_reg_plus_val: // mov reg , v
+            inst.opcode = inst_t::mov_reg_reg;
+            inst.operands = { op[0], v };
+          break;
+
+          case inst_t::add_reg_mem_ptr_reg_plus_val: // add reg , v
+            inst.opcode = inst_t::add_reg_reg;
+            inst.operands = { op[0], v };
+          break;
+
+          case inst_t::mov_mem_reg_ptr_reg_plus_val: // mov v , reg2
+            inst.opcode = inst_t::mov_reg_reg;
+            inst.operands = { v, op[1] };
+          break;
+
+          case inst_t::mov_mem_val_ptr_reg_plus_val: // mov v , val2
+            inst.opcode = inst_t::mov_reg_val;
+            inst.operands = { v, op[1] };
+          break;
+
+          default:
+          break;
+        }
+
+        ++rewritten;
+      }
+
+      return rewritten;
+    }
+
+    //New first block loading the slots which are read, falling through to the entry
+    constexpr void add_prologue(const std::vector<slot>& chosen)
+    {
+      ir::block prologue{ m_program.instructions.size() };
+
+      for(size_t i = 0u; i < chosen.size(); ++i)
+      {
+        if(!chosen[i].read)
+        {
+          continue;
+        }
+
+        ir::instruction load{ instructions::instruction::mov_reg_mem_ptr_reg_plus_val };
+        load.operands[0] = { ir::operand_kind::reg, virtual_reg(i) };
+        load.operands[1] = { ir::operand_kind::mem,
+                             static_cast<unit_t>(chosen[i].base),
+                             chosen[i].address - m_initial[chosen[i].base].value };
+
+        m_program.instructions.push_back(load);
+        ++prologue.count;
+      }
+
+      if(prologue.count == 0u)
+      {
+        return;
+      }
+
+      for(auto& inst : m_program.instructions)
+      {
+        for(auto& o : inst.operands)
+        {
+          o.value += o.kind == ir::operand_kind::target ? 1u : 0u;
+        }
+      }
+
+      for(auto& b : m_program.blocks)
+      {
+        b.target += b.target != ir::no_block ? 1u : 0u;
+        b.fallthrough += b.fallthrough != ir::no_block ? 1u : 0u;
+      }
+
+      prologue.fallthrough = m_program.entry + 1u;
+      m_program.blocks.insert(m_program.blocks.begin(), prologue);
+      m_program.entry = 0u;
+    }
+
+    const machine_t& m_machine;
+    ir::program m_program;
+    known_regs m_initial{};
+    std::vector<known_regs> m_states;
+    std::vector<uint8_t> m_reached;
+    std::vector<size_t> m_worklist;
+    std::vector<known> m_addresses; //of the word accessed by every instruction
+    std::vector<slot> m_slots;
+    std::vector<range> m_ranges;
+    unit_t m_lowest_access{ static_cast<unit_t>(-1) };
+  };
+
+  //Registers given in unknown are inputs set before execution, so their values are not
+  //assumed at the entry
+  template <typename machine_t>
+  constexpr result<machine_t> promote(const machine_t& m, const partial::unknown_inputs& unknown = {})
+  {
+    return promoter<machine_t>{ m, unknown }.promote();
+  }
+}
+
+//Verifier run when a program is loaded. Registers are tracked as intervals of values over
+//all paths of the control flow. A program is verified when every reachable instruction
+//lies in the image, jumps land on instruction starts, all data accesses are proven to
+//be in ram and no store can hit the image. Verified programs run without bounds checks
+namespace verify
+{
+  struct interval
+  {
+    static constexpr interval unknown()
+    {
+      return { 0u, static_cast<unit_t>(-1) };
+    }
+
+    constexpr bool operator==(const interval&) const = default;
+
+    unit_t lo{ 0u };
+    unit_t hi{ 0u };
+  };
+
+  constexpr size_t regs_count = static_cast<size_t>(regs::reg::eip);
+
+  using intervals = std::array<interval, regs_count>;
+
+  struct report
+  {
+    constexpr bool verified() const
+    {
+      return code_in_range && memory_in_range && !writes_code;
+    }
+
+    constexpr execute::policy policy() const
+    {
+      return verified() ? execute::policy::unchecked : execute::policy::checked;
+    }
+
+    bool code_in_range{ true };
+    bool memory_in_range{ true };
+    bool writes_code{ false }; //stores may change instructions, which were verified as they are
+    size_t failed_ip{ 0u };    //first instruction a proof failed for
+  };
+
+  //States are kept only at branch destinations, straight line code between them is
+  //walked again each time its entry state changes
+  template <typename machine_t>
+  class verifier
+  {
+  public:
+    static constexpr size_t no_slot = static_cast<size_t>(-1);
+    static constexpr size_t widen_after = 4u; //changes of a state before changed registers become unknown
+
+    constexpr explicit verifier(const machine_t& m)
+      : m_machine{ m }
+      , m_image_size{ std::min<size_t>(m.image_size, m.ram.size()) }
+      , m_starts(m_image_size, 0u)
+      , m_slot_of(m_image_size, no_slot)
+    {}
+
+    //Proof for the instructions of region only, 1 per ip of its instructions. Jumps and
+    //fall through out of it end the walk. Stores must miss the words of code, 1 per word
+    //of any instruction, also of those outside of region
+    constexpr verifier(const machine_t& m, std::span<const uint8_t> region, std::span<const uint8_t> code)
+      : verifier{ m }
+    {
+      m_region = region;
+      m_code = code;
+    }
+
+    constexpr report check(const intervals& initial)
+    {
+      branch_to(m_machine.eip(), initial, m_machine.eip());
+
+      while(!m_worklist.empty() && m_report.code_in_range)
+      {
+        const auto slot = m_worklist.back();
+        m_worklist.pop_back();
+        m_slots[slot].queued = false;
+
+        walk(m_slots[slot].ip, m_slots[slot].regs);
+      }
+
+      if(m_report.code_in_range)
+      {
+        check_overlaps();
+        check_image_stores();
+      }
+
+      return m_report;
+    }
+
+    //Registers the proof holds for at ip, after check
+    constexpr intervals state_at(size_t ip) const
+    {
+      if(ip >= m_image_size || m_slot_of[ip] == no_slot)
+      {
+        intervals unknown{};
+        unknown.fill(interval::unknown());
+        return unknown;
+      }
+
+      return m_slots[m_slot_of[ip]].regs;
+    }
+
+  private:
+    struct slot
+    {
+      size_t ip{ 0u };
+      intervals regs{};
+      size_t changes{ 0u };
+      bool queued{ false };
+    };
+
+    constexpr void walk(size_t ip, intervals regs)
+    {
+      using inst_t = instructions::instruction;
+
+      while(m_report.code_in_range && !outside_region(ip))
+      {
+        const auto inst = static_cast<inst_t>(m_machine.ram[ip]);
+        const auto size = instructions::get_ip_change(inst);
+
+        if(size == 0u || ip + size > m_image_size || !operands_valid(inst, ip))
+        {
+          fail_code(ip);
+          return;
+        }
+
+        m_starts[ip] = 1u;
+
+        const auto word = [&](size_t i) { return m_machine.ram[ip + i]; };
+        auto reg = [&regs](unit_t r) -> interval& { return regs[static_cast<size_t>(r)]; };
+        const auto next = ip + size;
+
+        switch(inst)
+        {
+          case inst_t::exit:
+          return;
+
+          case inst_t::jmp:
+            branch_to(word(1), regs, ip);
+          return;
+
+          case inst_t::je:
+            branch_to(word(1), regs, ip);
+            branch_to(next, regs, ip);
+          return;
+
+          case inst_t::cmp:
+          break;
+
+          case inst_t::add_reg_mem_ptr_reg_plus_val: // add reg reg2 val
+            access(ip, reg(word(2)), word(3), { 1u, 1u }, false);
+            reg(word(1)) = interval::unknown();
+          break;
+
+          case inst_t::sub_reg_val: // sub reg val
+          {
+            auto& r = reg(word(1));
+            r = r.lo < word(2) ? interval::unknown() : interval{ r.lo - word(2), r.hi - word(2) };
+          }break;
+
+          case inst_t::inc: // inc reg
+          {
+            auto& r = reg(word(1));
+            r = r.hi == interval::unknown().hi ? interval::unknown() : interval{ r.lo + 1u, r.hi + 1u };
+          }break;
+
+          case inst_t::mov_mem_reg_ptr_reg_plus_val: // mov reg val reg2
+          case inst_t::mov_mem_val_ptr_reg_plus_val: // mov reg val val2
+            access(ip, reg(word(1)), word(2), { 1u, 1u }, true);
+          break;
+
+          case inst_t::mov_reg_mem_ptr_reg_plus_val: // mov reg reg2 val
+            access(ip, reg(word(2)), word(3), { 1u, 1u }, false);
+            reg(word(1)) = interval::unknown();
+          break;
+
+          case inst_t::mov_reg_reg: // mov reg reg2
+            reg(word(1)) = reg(word(2));
+          break;
+
+          case inst_t::mov_reg_val: // mov reg val
+            reg(word(1)) = { word(2), word(2) };
+          break;
+
+          case inst_t::adc_reg_reg: // adc reg reg2
+          case inst_t::sbb_reg_reg: // sbb reg reg2
+          case inst_t::add_reg_reg: // add reg reg2
+            reg(word(1)) = interval::unknown();
+          break;
+
+          case inst_t::addn: // addn reg reg2 reg3
+          case inst_t::subn: // subn reg reg2 reg3
+            access(ip, reg(word(1)), 0u, reg(word(3)), true);
+            access(ip, reg(word(2)), 0u, reg(word(3)), false);
+          break;
+
+          case inst_t::xadd_mem_ptr_reg_plus_val_reg: // xadd reg val reg2
+            access(ip, reg(word(1)), word(2), { 1u, 1u }, true);
+            reg(word(3)) = interval::unknown();
+          break;
+
+          case inst_t::cmpxchg_mem_ptr_reg_plus_val_reg: // cmpxchg reg val reg2
+            access(ip, reg(word(1)), word(2), { 1u, 1u }, true);
+            reg(regs::to_unit_t(regs::reg::eax)) = interval::unknown();
+          break;
+
+          case inst_t::fence:
+          case inst_t::yield:
+          case inst_t::out_port_reg:
+          break;
+
+          case inst_t::in_reg_port: // in reg port
+            reg(word(1)) = interval::unknown();
+          break;
+
+          case inst_t::ins_reg_reg_port: // ins reg reg2 port
+            access(ip, reg(word(1)), 0u, reg(word(2)), true);
+            reg(word(2)) = { 0u, reg(word(2)).hi };
+          break;
+
+          case inst_t::outs_port_reg_reg: // outs port reg reg2
+            access(ip, reg(word(2)), 0u, reg(word(3)), false);
+          break;
+
+          case inst_t::copyn: // copyn reg val reg2 val2 reg3
+          case inst_t::cmpn: // cmpn reg val reg2 val2 reg3
+            access(ip, reg(word(1)), word(2), reg(word(5)), inst == inst_t::copyn);
+            access(ip, reg(word(3)), word(4), reg(word(5)), false);
+          break;
+
+          case inst_t::filln: // filln reg val reg2 reg3
+            access(ip, reg(word(1)), word(2), reg(word(4)), true);
+          break;
+
+          case inst_t::sumn: // sumn reg reg2 val reg3
+            access(ip, reg(word(2)), word(3), reg(word(4)), false);
+            reg(word(1)) = interval::unknown();
+          break;
+
+          case inst_t::spawn_reg_ip: // spawn reg ip
+          {
+            auto child = regs;
+            child[static_cast<size_t>(regs::reg::esp)] = reg(word(1));
+            branch_to(word(2), child, ip);
+          }break;
+
+          default:
+            fail_code(ip);
+          return;
+        }
+
+        if(next >= m_image_size)
+        {
+          fail_code(ip);
+          return;
+        }
+
+        ip = next;
+      }
+    }
+
+    constexpr bool outside_region(size_t ip) const
+    {
+      return !m_region.empty() && (ip >= m_region.size() || m_region[ip] == 0u);
+    }
+
+    constexpr bool operands_valid(instructions::instruction inst, size_t ip) const
+    {
+      const auto layout = ir::get_operand_layout(inst);
+      auto word = ip + 1u;
+
+      for(const auto kind : layout)
+      {
+        const auto is_reg = kind == ir::operand_kind::reg || kind == ir::operand_kind::mem;
+        if(is_reg && m_machine.ram[word] >= regs_count)
+        {
+          return false;
+        }
+
+        word += ir::get_operand_words(kind);
+      }
+
+      const auto port_word = io::get_port_word(inst);
+      return port_word == 0u || m_machine.ram[ip + port_word] < io::ports::max_ports;
+    }
+
+    //Words [base + offset, base + offset + count) for every value of base and count
+    constexpr void access(size_t ip, const interval& base, unit_t offset, const interval& count, bool is_store)
+    {
+      if(count.hi == 0u)
+      {
+        return;
+      }
+
+      //Without wrapping around
+      const auto max = interval::unknown().hi;
+      const auto in_range = base.hi <= max - offset
+                            && count.hi - 1u <= max - (base.hi + offset)
+                            && base.hi + offset + (count.hi - 1u) < m_machine.ram.size();
+
+      if(!in_range)
+      {
+        fail(m_report.memory_in_range, ip);
+      }
+      else if(is_store && base.lo + offset < m_image_size)
+      {
+        //Checked against instructions once all of them are known, data in the image may be written
+        const auto last = std::min<size_t>(base.hi + offset + (count.hi - 1u), m_image_size - 1u);
+        m_image_stores.push_back({ ip, base.lo + offset, last });
+      }
+    }
+
+    constexpr void branch_to(size_t ip, const intervals& regs, size_t from)
+    {
+      if(ip >= m_image_size)
+      {
+        fail_code(from);
+        return;
+      }
+
+      if(outside_region(ip))
+      {
+        return;
+      }
+
+      if(m_slot_of[ip] == no_slot)
+      {
+        m_slot_of[ip] = m_slots.size();
+        m_slots.push_back(slot{ ip, regs });
+      }
+      else
+      {
+        auto& s = m_slots[m_slot_of[ip]];
+        auto changed = false;
+
+        for(size_t i = 0u; i < regs_count; ++i)
+        {
+          const interval joined{ std::min(s.regs[i].lo, regs[i].lo), std::max(s.regs[i].hi, regs[i].hi) };
+
+          if(!(joined == s.regs[i]))
+          {
+            s.regs[i] = s.changes >= widen_after ? interval::unknown() : joined;
+            changed = true;
+          }
+        }
+
+        if(!changed)
+        {
+          return;
+        }
+
+        ++s.changes;
+      }
+
+      auto& s = m_slots[m_slot_of[ip]];
+      if(!s.queued)
+      {
+        s.queued = true;
+        m_worklist.push_back(m_slot_of[ip]);
+      }
+    }
+
+    constexpr void check_overlaps()
+    {
+      size_t end_of_previous{ 0u };
+
+      for(size_t ip = 0u; ip < m_image_size; ++ip)
+      {
+        if(!m_starts[ip])
+        {
+          continue;
+        }
+
+        if(ip < end_of_previous)
+        {
+          fail_code(ip); // jump into the middle of an instruction
+          return;
+        }
+
+        end_of_previous = ip + instructions::get_ip_change(static_cast<instructions::instruction>(m_machine.ram[ip]));
+      }
+    }
+
+    //Stores into words of instructions
+    constexpr void check_image_stores()
+    {
+      std::vector<size_t> code_words(m_image_size + 1u, 0u); // instruction words before every word
+      size_t end_of_instruction{ 0u };
+
+      for(size_t ip = 0u; ip < m_image_size; ++ip)
+      {
+        if(m_starts[ip])
+        {
+          end_of_instruction = ip + instructions::get_ip_change(static_cast<instructions::instruction>(m_machine.ram[ip]));
+        }
+
+        const auto is_code = ip < end_of_instruction || (ip < m_code.size() && m_code[ip] != 0u);
+        code_words[ip + 1u] = code_words[ip] + (is_code ? 1u : 0u);
+      }
+
+      for(const auto& store : m_image_stores)
+      {
+        if(code_words[store.last + 1u] != code_words[store.first])
+        {
+          record_failure(store.ip);
+          m_report.writes_code = true;
+        }
+      }
+    }
+
+    constexpr void fail_code(size_t ip)
+    {
+      fail(m_report.code_in_range, ip);
+    }
+
+    constexpr void fail(bool& proof, size_t ip)
+    {
+      record_failure(ip);
+      proof = false;
+    }
+
+    constexpr void record_failure(size_t ip)
+    {
+      if(m_report.verified())
+      {
+        m_report.failed_ip = ip;
+      }
+    }
+
+    const machine_t& m_machine;
+    size_t m_image_size;
+    std::span<const uint8_t> m_region;
+    std::span<const uint8_t> m_code;
+    std::vector<uint8_t> m_starts;
+    std::vector<size_t> m_slot_of;
+    struct image_store
+    {
+      size_t ip{ 0u };
+      size_t first{ 0u };
+      size_t last{ 0u };
+    };
+
+    std::vector<slot> m_slots;
+    std::vector<size_t> m_worklist;
+    std::vector<image_store> m_image_stores;
+    report m_report;
+  };
+
+  //Registers of the machine as exact values
+  template <typename machine_t>
+  constexpr intervals get_registers(const machine_t& m)
+  {
+    intervals result{};
+    for(size_t i = 0u; i < regs_count; ++i)
+    {
+      const auto val = m.get_reg(static_cast<unit_t>(i));
+      result[i] = { val, val };
+    }
+
+    return result;
+  }
+
+  //Proof for every start with registers within initial, e.g. for copies of a program
+  //seeded with different values
+  template <typename machine_t>
+  constexpr report check(const machine_t& m, const intervals& initial)
+  {
+    return verifier<machine_t>{ m }.check(initial);
+  }
+
+  template <typename machine_t>
+  constexpr report check(const machine_t& m)
+  {
+    return check(m, get_registers(m));
+  }
+
+  //Proof for a region entered at the eip of m with registers within initial, e.g. a loop
+  //compiled once it is hot. Costs a walk of the region rather than of the program. entry
+  //receives the registers the proof holds for at eip, later entries have to be within them
+  template <typename machine_t>
+  constexpr report check_region(const machine_t& m, std::span<const uint8_t> region, std::span<const uint8_t> code, const intervals& initial, intervals& entry)
+  {
+    verifier<machine_t> v{ m, region, code };
+    const auto result = v.check(initial);
+    entry = v.state_at(m.eip());
+    return result;
+  }
+
+  constexpr bool within(const intervals& regs, const intervals& bounds)
+  {
+    for(size_t i = 0u; i < regs_count; ++i)
+    {
+      if(regs[i].lo < bounds[i].lo || regs[i].hi > bounds[i].hi)
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  //Checked unless the program is verified
+  template <typename machine_t>
+  constexpr auto execute(machine_t machine)
+  {
+    const auto policy = check(machine).policy();
+    return execute::execute(std::move(machine), policy);
+  }
+
+  //Checked unless the program is verified with the inputs seeded
+  template <typename machine_t>
+  constexpr auto execute(machine_t machine, const execute::inputs& in)
+  {
+    in.seed(machine);
+    return execute(std::move(machine));
+  }
+}
+
+//Assembling with storage allocated and freed within constant evaluation (C++20 constexpr
+//std::vector and std::string). Unlike tokenizer<tokens_count> and the other stages, these
+//functions are not templates, so they are instantiated once for all programs. Only the
+//final machine has a fixed size
+namespace transient
+{
+  using machine = basic_machine<std::vector<unit_t>>;
+
+  constexpr std::vector<std::string_view> tokenize(std::string_view code)
+  {
+    std::vector<std::string_view> tokens;
+
+    for(size_t pos = 0u; pos < code.size();)
+    {
+      const auto end = std::min(code.find(' ', pos), code.size());
+      if(end > pos)
+      {
+        tokens.push_back(code.substr(pos, end - pos));
+      }
+
+      pos = end + 1u;
+    }
+
+    return tokens;
+  }
+
+  struct label
+  {
+    std::string_view name;
+    size_t ip{ 0u }; // of the label, or of the word referencing it
+  };
+
+  //Words of the image, assembled in one walk of the tokens. References to labels declared
+  //later are patched when the label is declared
+  constexpr std::vector<unit_t> assemble(std::string_view code)
+  {
+    const auto tokens = tokenize(code);
+
+    std::vector<label> declared;
+    std::vector<label> forward_references;
+    std::vector<unit_t> image;
+
+    for(auto it = tokens.begin(); it != tokens.end();)
+    {
+      if(it->front() == ':')
+      {
+        const auto name = it->substr(1u);
+        if(std::any_of(declared.begin(), declared.end(), [&](const label& l) { return l.name == name; }))
+        {
+          throw std::invalid_argument{ "duplicate label" };
+        }
+
+        declared.push_back(label{ name, image.size() });
+
+        for(size_t i = 0u; i < forward_references.size();)
+        {
+          if(forward_references[i].name == name)
+          {
+            image[forward_references[i].ip] = image.size();
+            forward_references[i] = forward_references.back();
+            forward_references.pop_back();
+          }
+          else
+          {
+            ++i;
+          }
+        }
+
+        ++it;
+        continue;
+      }
+
+      if(const auto d = assemble::get_directive(it); d.valid())
+      {
+        const auto value = it[static_cast<std::ptrdiff_t>(d.token_count - 1u)];
+
+        if(value.front() != '.')
+        {
+          image.insert(image.end(), d.words, algo::stoui(value));
+        }
+        else
+        {
+          const auto name = value.substr(1u);
+          const auto found = std::find_if(declared.begin(), declared.end(), [&](const label& l) { return l.name == name; });
+
+          if(found == declared.end())
+          {
+            forward_references.push_back(label{ name, image.size() });
+          }
+          image.push_back(found != declared.end() ? found->ip : 0u);
+        }
+
+        it += static_cast<std::ptrdiff_t>(d.token_count);
+        continue;
+      }
+
+      const auto instruction = instructions::get_next_instruction(it);
+      if(instruction == instructions::instruction::none)
+      {
+        throw std::invalid_argument{ "unknown instruction" };
+      }
+
+      const auto ip = image.size();
+      const auto instruction_it = it;
+      const auto opcodes = assemble::get_next_opcodes(it, instruction);
+      image.insert(image.end(), opcodes.begin(), opcodes.end());
+
+      for(size_t i = 1u; i < instructions::get_token_count(instruction); ++i)
+      {
+        const auto token = instruction_it[static_cast<std::ptrdiff_t>(i)];
+        const auto slot = instructions::get_operand_slot(instruction, i);
+
+        if(token.front() != '.' || slot == 0u)
+        {
+          continue;
+        }
+
+        const auto name = token.substr(1u);
+        const auto found = std::find_if(declared.begin(), declared.end(), [&](const label& l) { return l.name == name; });
+
+        if(found != declared.end())
+        {
+          image[ip + slot] = found->ip;
+        }
+        else
+        {
+          forward_references.push_back(label{ name, ip + slot });
+        }
+      }
+    }
+
+    if(!forward_references.empty())
+    {
+      throw std::invalid_argument{ "unknown label" };
+    }
+
+    return image;
+  }
+
+  constexpr machine assemble_machine(std::string_view code, size_t amount_of_ram)
+  {
+    auto image = assemble(code);
+    const auto image_size = image.size();
+    image.resize(std::max(amount_of_ram, image_size));
+
+    machine m{ std::move(image) };
+    m.image_size = image_size;
+    m.esp() = m.ram.size() - 1u;
+    m.eip() = 0u;
+
+    return m;
+  }
+
+  //Words the assembled program can take, counted from its tokens without assembling it
+  constexpr size_t max_image_words(std::string_view code)
+  {
+    const auto code_tokens = tokenize(code);
+    size_t words{ 0u };
+
+    for(auto it = code_tokens.begin(); it != code_tokens.end(); ++it)
+    {
+      if(*it == tokens::times && std::distance(it, code_tokens.end()) > 1)
+      {
+        words += algo::stoui(*++it);
+      }
+      else
+      {
+        ++words;
+      }
+    }
+
+    return words;
+  }
+}
+
+namespace ctai
+{
+  //Program text usable as a class type non-type template parameter
+  template <size_t n>
+  struct program_string
+  {
+    constexpr program_string(const char (&str)[n])
+    {
+      algo::copy(str, str + n, data);
+    }
+
+    constexpr const char* begin() const
+    {
+      return data;
+    }
+
+    constexpr const char* end() const
+    {
+      return data + n - 1u; // -1 for '\0'
+    }
+
+    constexpr std::string_view view() const
+    {
+      return { begin(), end() };
+    }
+
+    char data[n]{};
+  };
+
+  //amount_of_ram computed by footprint analysis. It moves the initial esp to the top of
+  //the computed ram, so programs reading esp see other values than with default_ram
+  constexpr size_t automatic_ram = 0u;
+
+  //Amount of ram unless given, also used by automatic_ram when footprint of the program
+  //is not statically bounded
+  constexpr size_t default_ram = 1024u;
+
+  //Bigger footprints are treated as unbounded
+  constexpr size_t max_automatic_ram = 1u << 16;
+
+  //Where intermediate results of assembling live. fixed instantiates stages sized for every
+  //program, transient runs the same stages for all of them
+  enum class storage
+  {
+    fixed,
+    transient
+  };
+
+  //Ram required by a program assembled into ram just big enough for it
+  template <typename machine_t>
+  constexpr size_t required_ram(const machine_t& provisional)
+  {
+    const auto fp = footprint::analyze(provisional, max_automatic_ram);
+    return fp.bounded && fp.required_ram() <= max_automatic_ram ? fp.required_ram() : default_ram;
+  }
+
+  template <program_string code, size_t amount_of_ram>
+  constexpr auto assemble_transient()
+  {
+    if constexpr(amount_of_ram != automatic_ram)
+    {
+      return assemble::resize<amount_of_ram>(transient::assemble_machine(code.view(), amount_of_ram));
+    }
+    else
+    {
+      //Assembled once, the footprint is analyzed on the copy in fixed ram
+      constexpr auto words = transient::max_image_words(code.view()) + 1u;
+      constexpr auto provisional = assemble::resize<words>(transient::assemble_machine(code.view(), 0u));
+
+      return assemble::resize<required_ram(provisional)>(provisional);
+    }
+  }
+
+  template <program_string code, size_t amount_of_ram>
+  constexpr auto assemble_fixed()
+  {
+    constexpr auto tokens_count = algo::count(code.begin(), code.end(), ' ') + 1;
+    constexpr auto tokens = tokenizer<tokens_count>{}.tokenize(code);
+
+    constexpr auto labels_count = algo::count(code.begin(), code.end(), ':');
+    constexpr auto references_count = algo::count(code.begin(), code.end(), '.');
+
+    if constexpr(amount_of_ram != automatic_ram)
+    {
+      return assemble::assembler<amount_of_ram, labels_count, references_count>{}.assemble(tokens);
+    }
+    else
+    {
+      constexpr auto words = transient::max_image_words(code.view()) + 1u;
+      constexpr auto provisional = assemble::assembler<words, labels_count, references_count>{}.assemble(tokens);
+
+      return assemble::resize<required_ram(provisional)>(provisional);
+    }
+  }
+
+  template <program_string code, size_t amount_of_ram, storage s>
+  constexpr auto assemble_program()
+  {
+    if constexpr(s == storage::transient)
+    {
+      return assemble_transient<code, amount_of_ram>();
+    }
+    else
+    {
+      return assemble_fixed<code, amount_of_ram>();
+    }
+  }
+
+  //Variable templates are instantiated once per program, so every use of the same
+  //program text shares one assembled machine and one result
+  template <program_string code, size_t amount_of_ram = default_ram, storage s = storage::transient>
+  inline constexpr auto assembled = assemble_program<code, amount_of_ram, s>();
+
+  template <program_string code, size_t amount_of_ram = default_ram, storage s = storage::transient>
+  inline constexpr auto result = execute::execute(assembled<code, amount_of_ram, s>);
+
+  //ctai::run<"mov eax , 2 exit">(), ctai::run<code, ctai::automatic_ram>() for ram sized
+  //by footprint analysis
+  template <program_string code, size_t amount_of_ram = default_ram, storage s = storage::transient>
+  constexpr auto run()
+  {
+    return result<code, amount_of_ram, s>;
+  }
+
+  //Whether a program assembles at compile time, so programs which have to be rejected
+  //can be checked without breaking the build
+  template <program_string code, size_t amount_of_ram = default_ram, storage s = storage::transient>
+  concept assembles = requires { typename std::integral_constant<size_t, assemble_program<code, amount_of_ram, s>().image_size>; };
+
+  static_assert(run<"mov eax , 2 inc eax exit">() == 3);
+  static_assert(run<"mov eax , 2 inc eax exit", 64u, storage::fixed>() == 3);
+  static_assert(run<"mov eax , esp exit">() == default_ram - 1u);
+  static_assert(run<"mov eax , esp exit", automatic_ram>() == run<"mov eax , esp exit", automatic_ram, storage::fixed>());
+  static_assert(assembled<"sub esp , 2 mov [ esp + 1 ] , 5 mov eax , [ esp + 1 ] exit", automatic_ram>.ram.size() < default_ram);
+  static_assert(assembles<"mov eax , 5 times 12 dw 1 exit", 16u> && assembles<"mov eax , 5 times 12 dw 1 exit", 16u, storage::fixed>);
+  static_assert(!assembles<"mov eax , 5 times 40 dw 1 exit", 16u> && !assembles<"mov eax , 5 times 40 dw 1 exit", 16u, storage::fixed>);
+  static_assert(!assembles<"mov eax , 5 times 13 dw 1 exit", 16u> && !assembles<"mov eax , 5 times 13 dw 1 exit", 16u, storage::fixed>);
+  static_assert(!assembles<"mov eax x 7 exit"> && !assembles<"mov eax x 7 exit", default_ram, storage::fixed>);
+  static_assert(!assembles<"mov eax ] 7 exit"> && !assembles<"mov eax ] 7 exit", default_ram, storage::fixed>);
+  static_assert(!assembles<"mov [ esp - 1 ] , 7 exit"> && !assembles<"add eax , ( esp + 1 ] exit">);
+  static_assert(!assembles<"filln [ esp + 1 ] , eax eax exit">);
+}
@@ -0,0 +1,464 @@
+#pragma once
+
+#include "ctai.hpp"
+
+#include <cstdint>
+#include <memory>
+
+//Execution from a cache of decoded instructions, for programs which are not verified. It
+//runs with the checks of execute::checked, which are made once when an instruction is
+//decoded. Pages of ram holding decoded instructions are tracked. A store to one of them
+//updates the operand of the instructions overlapping the stored word, or drops them to
+//be decoded again when it replaced their opcode. So code which patches itself runs from
+//the cache as well. A decode costs about as much as one checked execution, so the cache
+//pays off for instructions executed many times, not for short runs like fib's
+namespace decoded
+{
+  constexpr size_t page_words = 64u;
+
+  constexpr size_t get_max_ip_change()
+  {
+    size_t result{ 0u };
+
+    for(size_t opcode = instructions::instruction::none + 1u; opcode < instructions::instruction::instruction_count; ++opcode)
+    {
+      result = std::max(result, instructions::get_ip_change(static_cast<instructions::instruction>(opcode)));
+    }
+
+    return result;
+  }
+
+  constexpr size_t max_ip_change = get_max_ip_change();
+
+  //Per opcode, mask of operand words naming registers
+  constexpr auto register_words = []
+  {
+    std::array<uint8_t, instructions::instruction::instruction_count> result{};
+
+    for(size_t opcode = instructions::instruction::none + 1u; opcode < instructions::instruction::instruction_count; ++opcode)
+    {
+      size_t word{ 0u };
+      for(const auto kind : ir::get_operand_layout(static_cast<instructions::instruction>(opcode)))
+      {
+        if(kind == ir::operand_kind::reg || kind == ir::operand_kind::mem)
+        {
+          result[opcode] |= static_cast<uint8_t>(1u << word);
+        }
+
+        word += ir::get_operand_words(kind);
+      }
+    }
+
+    return result;
+  }();
+
+  struct entry
+  {
+    instructions::instruction opcode{ instructions::instruction::none }; // none when not decoded
+    uint8_t size{ 0u };
+    bool fast{ false };                       // executed by the cache, otherwise by the interpreter
+    uint8_t register_words{ 0u };             // mask of operands naming registers
+    std::array<unit_t, max_ip_change - 1u> operands{};
+  };
+
+  //Also the machine seen by instructions left to the interpreter, whose stores have to
+  //drop decoded instructions as well
+  template <typename machine_t>
+  class cache
+  {
+  public:
+    explicit cache(machine_t& machine)
+      : ram{ machine.ram }
+      , zf{ machine.zf }
+      , cf{ machine.cf }
+      , ports{ execute::get_ports(machine) }
+      , m_machine{ machine }
+      , m_pages(std::min<size_t>(machine.image_size, machine.ram.size()) / page_words + 1u)
+      , m_code_pages(m_pages.size(), 0u)
+    {}
+
+    cache(const cache&) = delete;
+    cache& operator=(const cache&) = delete;
+
+    //Same results and errors as execute::execute_checked
+    unit_t run()
+    {
+      using inst_t = instructions::instruction;
+
+      execute::checked<cache> checked{ *this };
+
+      for(;;)
+      {
+        const auto ip = m_machine.eip();
+        const auto& e = fetch(ip);
+        const auto& op = e.operands;
+
+        switch(e.fast ? e.opcode : inst_t::none)
+        {
+          case inst_t::exit:
+          return m_machine.eax();
+
+          case inst_t::je: // je ip
+            m_machine.eip() = m_machine.zf ? op[0] : ip + e.size;
+          continue;
+
+          case inst_t::jmp: // jmp ip
+            m_machine.eip() = op[0];
+          continue;
+
+          case inst_t::cmp: // cmp reg val
+            m_machine.zf = m_machine.get_reg(op[0]) == op[1];
+          break;
+
+          case inst_t::add_reg_mem_ptr_reg_plus_val: // add reg reg2 val
+          {
+            const auto reg_val = m_machine.get_reg(op[0]);
+            const auto new_reg_val = reg_val + load(m_machine.get_reg(op[1]) + op[2]);
+            m_machine.set_reg(op[0], new_reg_val);
+            m_machine.cf = new_reg_val < reg_val;
+          }break;
+
+          case inst_t::add_reg_reg: // add reg reg2
+          {
+            const auto reg_val = m_machine.get_reg(op[0]);
+            const auto new_reg_val = reg_val + m_machine.get_reg(op[1]);
+            m_machine.set_reg(op[0], new_reg_val);
+            m_machine.cf = new_reg_val < reg_val;
+          }break;
+
+          case inst_t::sub_reg_val: // sub reg val
+          {
+            const auto reg_val = m_machine.get_reg(op[0]);
+            m_machine.set_reg(op[0], reg_val - op[1]);
+            m_machine.cf = op[1] > reg_val;
+          }break;
+
+          case inst_t::inc: // inc reg
+            m_machine.set_reg(op[0], m_machine.get_reg(op[0]) + 1u);
+          break;
+
+          case inst_t::mov_reg_reg: // mov reg reg2
+            m_machine.set_reg(op[0], m_machine.get_reg(op[1]));
+          break;
+
+          case inst_t::mov_reg_val: // mov reg val
+            m_machine.set_reg(op[0], op[1]);
+          break;
+
+          case inst_t::mov_reg_mem_ptr_reg_plus_val: // mov reg reg2 val
+            m_machine.set_reg(op[0], load(m_machine.get_reg(op[1]) + op[2]));
+          break;
+
+          //The store may have replaced this very instruction, its size is taken from
+          //ram as of execute::adjust_eip
+          case inst_t::mov_mem_reg_ptr_reg_plus_val: // mov reg val reg2
+            checked.store(m_machine.get_reg(op[0]) + op[1], m_machine.get_reg(op[2]));
+            execute::adjust_eip(m_machine);
+          continue;
+
+          case inst_t::mov_mem_val_ptr_reg_plus_val: // mov reg val val2
+            checked.store(m_machine.get_reg(op[0]) + op[1], op[2]);
+            execute::adjust_eip(m_machine);
+          continue;
+
+          case inst_t::copyn:
+          case inst_t::filln:
+          case inst_t::cmpn:
+          case inst_t::sumn:
+            if(run_block(e))
+            {
+              break;
+            }
+          [[fallthrough]];
+
+          default:
+          {
+            if(e.opcode == inst_t::exit)
+            {
+              return m_machine.eax();
+            }
+
+            if(execute::execute_next_instruction(checked))
+            {
+              execute::adjust_eip(m_machine);
+            }
+          }continue;
+        }
+
+        m_machine.eip() = ip + e.size;
+      }
+    }
+
+    size_t decodes() const
+    {
+      return m_decodes;
+    }
+
+    size_t invalidations() const
+    {
+      return m_invalidations;
+    }
+
+    size_t patches() const
+    {
+      return m_patches;
+    }
+
+    //Machine interface for execute::checked
+    template <typename reg_t>
+    reg_t get_reg(reg_t r)
+    {
+      return m_machine.get_reg(r);
+    }
+
+    template <typename reg_t>
+    void set_reg(reg_t r, reg_t val)
+    {
+      m_machine.set_reg(r, val);
+    }
+
+    decltype(auto) eip() { return m_machine.eip(); }
+
+    unit_t load(size_t address)
+    {
+      if(address >= ram.size())
+      {
+        throw std::out_of_range{ "access out of ram: " + std::to_string(address) };
+      }
+
+      return execute::load(m_machine, address);
+    }
+
+    void store(size_t address, unit_t value)
+    {
+      execute::store(m_machine, address, value);
+
+      if(address / page_words < m_code_pages.size() && m_code_pages[address / page_words] != 0u)
+      {
+        update(address, value);
+      }
+    }
+
+    void fence()
+    {
+      execute::fence(m_machine);
+    }
+
+    void spawn(unit_t ip, unit_t esp)
+    {
+      execute::spawn(m_machine, ip, esp);
+    }
+
+    decltype(machine_t::ram)& ram;
+    bool& zf;
+    bool& cf;
+    io::ports* ports;
+
+  private:
+    bool in_ram(size_t address, size_t count) const
+    {
+      return address < ram.size() && count <= ram.size() - address;
+    }
+
+    bool on_code_pages(size_t address, size_t count) const
+    {
+      const auto last = std::min((address + count - 1u) / page_words + 1u, m_code_pages.size());
+      for(auto page = address / page_words; page < last; ++page)
+      {
+        if(m_code_pages[page] != 0u)
+        {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    //Block instructions whose ranges are in ram and stores miss code run with native kernels.
+    //Others are left to the interpreter, which reports the first bad word or updates code
+    //word by word
+    bool run_block(const entry& e)
+    {
+      using inst_t = instructions::instruction;
+
+      const auto& op = e.operands;
+
+      switch(e.opcode)
+      {
+        case inst_t::copyn: // copyn reg val reg2 val2 reg3
+        case inst_t::cmpn: // cmpn reg val reg2 val2 reg3
+        {
+          const auto first = m_machine.get_reg(op[0]) + op[1];
+          const auto second = m_machine.get_reg(op[2]) + op[3];
+          const auto count = m_machine.get_reg(op[4]);
+          const auto is_copy = e.opcode == inst_t::copyn;
+
+          if(count == 0u || !in_ram(first, count) || !in_ram(second, count) || (is_copy && on_code_pages(first, count)))
+          {
+            return false;
+          }
+
+          if(is_copy)
+          {
+            execute::copy_words(m_machine, first, second, count);
+          }
+          else
+          {
+            m_machine.zf = execute::compare_words(m_machine, first, second, count);
+          }
+        }return true;
+
+        case inst_t::filln: // filln reg val reg2 reg3
+        {
+          const auto first = m_machine.get_reg(op[0]) + op[1];
+          const auto count = m_machine.get_reg(op[3]);
+
+          if(count == 0u || !in_ram(first, count) || on_code_pages(first, count))
+          {
+            return false;
+          }
+
+          execute::fill_words(m_machine, first, m_machine.get_reg(op[2]), count);
+        }return true;
+
+        case inst_t::sumn: // sumn reg reg2 val reg3
+        {
+          const auto first = m_machine.get_reg(op[1]) + op[2];
+          const auto count = m_machine.get_reg(op[3]);
+
+          if(count == 0u || !in_ram(first, count))
+          {
+            return false;
+          }
+
+          m_machine.set_reg(op[0], execute::sum_words(m_machine, first, count));
+        }return true;
+
+        default:
+        return false;
+      }
+    }
+
+    //Checked as of execute::checked::check_fetch
+    const entry& fetch(size_t ip)
+    {
+      if(ip >= ram.size())
+      {
+        throw std::out_of_range{ "eip out of ram: " + std::to_string(ip) };
+      }
+
+      if(ip / page_words >= m_pages.size())
+      {
+        m_pages.resize(ip / page_words + 1u);
+      }
+
+      auto& page = m_pages[ip / page_words];
+      if(!page)
+      {
+        page = std::make_unique<entries>();
+      }
+
+      auto& e = (*page)[ip % page_words];
+      if(e.opcode != instructions::instruction::none)
+      {
+        return e;
+      }
+
+      const auto opcode = static_cast<instructions::instruction>(ram[ip]);
+      const auto size = instructions::get_ip_change(opcode);
+      if(size == 0u || ip + size > ram.size())
+      {
+        throw std::out_of_range{ "invalid instruction at " + std::to_string(ip) };
+      }
+
+      e.opcode = opcode;
+      e.size = static_cast<uint8_t>(size);
+      for(size_t i = 1u; i < size; ++i)
+      {
+        e.operands[i - 1u] = ram[ip + i];
+      }
+      e.register_words = register_words[opcode];
+      e.fast = registers_valid(e);
+
+      m_code_pages.resize(std::max(m_code_pages.size(), (ip + size - 1u) / page_words + 1u), 0u);
+      for(auto page = ip / page_words; page <= (ip + size - 1u) / page_words; ++page)
+      {
+        m_code_pages[page] = 1u;
+      }
+
+      ++m_decodes;
+      return e;
+    }
+
+    //Fast paths do not check registers, instructions naming others are left to the
+    //interpreter, which reports them
+    static bool registers_valid(const entry& e)
+    {
+      for(size_t word = 0u; word < e.operands.size(); ++word)
+      {
+        if((e.register_words >> word & 1u) != 0u && e.operands[word] >= static_cast<unit_t>(regs::reg::eip))
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    //Instructions overlapping address get the stored operand, or are dropped when their
+    //opcode was overwritten
+    void update(size_t address, unit_t value)
+    {
+      const auto first = address >= max_ip_change - 1u ? address - (max_ip_change - 1u) : 0u;
+
+      for(auto ip = first; ip <= address && ip / page_words < m_pages.size(); ++ip)
+      {
+        const auto& page = m_pages[ip / page_words];
+        if(!page)
+        {
+          continue;
+        }
+
+        auto& e = (*page)[ip % page_words];
+        if(e.opcode == instructions::instruction::none || ip + e.size <= address)
+        {
+          continue;
+        }
+
+        if(ip == address)
+        {
+          e.opcode = instructions::instruction::none;
+          ++m_invalidations;
+        }
+        else
+        {
+          const auto word = address - ip - 1u;
+          e.operands[word] = value;
+          if((e.register_words >> word & 1u) != 0u)
+          {
+            e.fast = registers_valid(e);
+          }
+          ++m_patches;
+        }
+      }
+    }
+
+    //Entries are allocated per page on the first fetch from it, and both tables start
+    //at the image, growing to fetches past it. So the cache grows with code executed
+    //rather than with ram, which is set up on every run
+    using entries = std::array<entry, page_words>;
+
+    machine_t& m_machine;
+    std::vector<std::unique_ptr<entries>> m_pages;  // per page up to the last fetched, entries per ip
+    std::vector<uint8_t> m_code_pages;  // pages up to the last decoded word, 1 with decoded instructions in them
+    size_t m_decodes{ 0u };
+    size_t m_invalidations{ 0u };
+    size_t m_patches{ 0u };      // operands updated in place
+  };
+
+  template <typename machine_t>
+  unit_t execute(machine_t machine)
+  {
+    return cache<machine_t>{ machine }.run();
+  }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "ctai.hpp"
+
+//6th fibonacci number, computed at compile time and returned from main
+inline constexpr ctai::program_string asm_code =
+  "sub esp , 4 "
+  "mov ebp , esp "
+  "mov [ ebp + 2 ] , 0 "
+  "mov [ ebp + 3 ] , 1 "
+  "mov [ ebp + 4 ] , 1 "
+  "mov [ ebp + 1 ] , 1 "
+  "mov ecx , 1 "
+":loop "
+  "cmp ecx , 6 " //we want to get 6th fibonacci element
+  "je .end "
+  "mov eax , [ ebp + 3 ] "
+  "add eax , [ ebp + 2 ] "
+  "mov [ ebp + 4 ] , eax "
+  "mov eax , [ ebp + 3 ] "
+  "mov [ ebp + 2 ] , eax "
+  "mov eax , [ ebp + 4 ] "
+  "mov [ ebp + 3 ] , eax "
+  "mov eax , [ ebp + 1 ] "
+  "inc ecx "
+  "jmp .loop "
+":end "
+  "mov eax , [ ebp + 4 ] "
+  "exit";
+
+//n-th fibonacci number for n given in edx. Assembled and specialized at compile time,
+//so only the loop is left for runtime, with its frame slots promoted to registers
+inline constexpr auto fib_source = ctai::assembled<
+    "sub esp , 4 "
+    "mov ebp , esp "
+    "mov [ ebp + 2 ] , 0 "
+    "mov [ ebp + 3 ] , 1 "
+  ":loop "
+    "cmp edx , 0 "
+    "je .end "
+    "mov eax , [ ebp + 3 ] "
+    "add eax , [ ebp + 2 ] "
+    "mov ecx , [ ebp + 3 ] "
+    "mov [ ebp + 2 ] , ecx "
+    "mov [ ebp + 3 ] , eax "
+    "sub edx , 1 "
+    "jmp .loop "
+  ":end "
+    "mov eax , [ ebp + 2 ] "
+    "exit", 64u>;
+
+inline constexpr auto fib_specialized = partial::specialize(fib_source, partial::unknown_inputs{}.reg(regs::reg::edx));
+inline constexpr auto fib_promoted = promote::promote(fib_specialized.m, partial::unknown_inputs{}.reg(regs::reg::edx));
+inline constexpr auto fib_machine = fib_promoted.m;
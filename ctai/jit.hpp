@@ -0,0 +1,849 @@
+#pragma once
+
+#include "runtime.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <memory>
+#include <sys/mman.h>
+
+//Native x86-64 code for verified programs. Registers eax..esp live in r8..r13, zf in r14b,
+//cf in r15b and ram is addressed from rsi, with rdi pointing at the state the code enters
+//and leaves with. Virtual registers stay in the state. Multi word and block instructions
+//call the kernels the interpreter uses. Instructions without native code, exit included,
+//leave through a side exit and are executed by the interpreter, after which native code
+//is entered again at the next instruction
+namespace jit
+{
+#if defined(__x86_64__)
+  constexpr bool host_supported = true;
+#else
+  constexpr bool host_supported = false;
+#endif
+
+  //Read and written by the generated code
+  struct state
+  {
+    unit_t regs[static_cast<size_t>(regs::reg::eip)];
+    unit_t eip;
+    uint8_t zf;
+    uint8_t cf;
+  };
+
+  enum host : uint8_t
+  {
+    rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+    r8, r9, r10, r11, r12, r13, r14, r15
+  };
+
+  constexpr host state_base = rdi;
+  constexpr host ram_base = rsi;
+  constexpr host zf_reg = r14;
+  constexpr host cf_reg = r15;
+  constexpr size_t host_regs_count = static_cast<size_t>(regs::reg::v0); //eax..esp in r8..r13
+
+  //Multi word and block instructions called from native code: ram, then up to three
+  //words. The result goes to a register or a flag
+  namespace calls
+  {
+    using call_t = unit_t (*)(unit_t*, unit_t, unit_t, unit_t);
+
+    //Ram of a verified program, accessed without bounds checks as by the interpreter
+    struct plain_ram
+    {
+      unit_t* ram;
+    };
+
+    inline unit_t addn(unit_t* ram, unit_t dest, unit_t src, unit_t count)
+    {
+      plain_ram m{ ram };
+      return execute::add_words(m, dest, src, count);
+    }
+
+    inline unit_t subn(unit_t* ram, unit_t dest, unit_t src, unit_t count)
+    {
+      plain_ram m{ ram };
+      return execute::sub_words(m, dest, src, count);
+    }
+
+    inline unit_t copyn(unit_t* ram, unit_t dest, unit_t src, unit_t count)
+    {
+      plain_ram m{ ram };
+      execute::copy_words(m, dest, src, count);
+      return 0u;
+    }
+
+    inline unit_t cmpn(unit_t* ram, unit_t lhs, unit_t rhs, unit_t count)
+    {
+      plain_ram m{ ram };
+      return execute::compare_words(m, lhs, rhs, count);
+    }
+
+    inline unit_t filln(unit_t* ram, unit_t dest, unit_t value, unit_t count)
+    {
+      plain_ram m{ ram };
+      execute::fill_words(m, dest, value, count);
+      return 0u;
+    }
+
+    inline unit_t sumn(unit_t* ram, unit_t src, unit_t count, unit_t)
+    {
+      plain_ram m{ ram };
+      return execute::sum_words(m, src, count);
+    }
+  }
+
+  enum class alu : uint8_t
+  {
+    add = 0x01,
+    adc = 0x11,
+    sbb = 0x19,
+    sub = 0x29,
+    cmp = 0x39
+  };
+
+  //x86-64 encodings of the few instruction forms the compiler needs
+  class emitter
+  {
+  public:
+    size_t size() const { return m_code.size(); }
+    const std::vector<uint8_t>& bytes() const { return m_code; }
+
+    void byte(uint8_t b) { m_code.push_back(b); }
+
+    void imm32(uint32_t val)
+    {
+      for(size_t i = 0u; i < 4u; ++i)
+      {
+        byte(static_cast<uint8_t>(val >> (8u * i)));
+      }
+    }
+
+    void imm64(uint64_t val)
+    {
+      imm32(static_cast<uint32_t>(val));
+      imm32(static_cast<uint32_t>(val >> 32u));
+    }
+
+    // mov dst , src
+    void mov(host dst, host src)
+    {
+      rex(src, dst);
+      byte(0x89);
+      modrm_reg(src, dst);
+    }
+
+    // mov dst , imm
+    void mov_imm(host dst, unit_t imm)
+    {
+      byte(static_cast<uint8_t>(0x48 | (dst >> 3)));
+      byte(static_cast<uint8_t>(0xb8 + (dst & 7)));
+      imm64(imm);
+    }
+
+    // mov dst , [ base + disp ]
+    void load(host dst, host base, uint32_t disp)
+    {
+      rex(dst, base);
+      byte(0x8b);
+      modrm_disp32(dst, base, disp);
+    }
+
+    // mov [ base + disp ] , src
+    void store(host base, uint32_t disp, host src)
+    {
+      rex(src, base);
+      byte(0x89);
+      modrm_disp32(src, base, disp);
+    }
+
+    // movzx dst , byte [ base + disp ]
+    void load_byte(host dst, host base, uint32_t disp)
+    {
+      rex(dst, base);
+      byte(0x0f);
+      byte(0xb6);
+      modrm_disp32(dst, base, disp);
+    }
+
+    // mov byte [ base + disp ] , src
+    void store_byte(host base, uint32_t disp, host src)
+    {
+      byte(static_cast<uint8_t>(0x40 | ((src >> 3) << 2) | (base >> 3)));
+      byte(0x88);
+      modrm_disp32(src, base, disp);
+    }
+
+    // mov qword [ base + disp ] , imm sign extended
+    void store_imm32(host base, uint32_t disp, uint32_t imm)
+    {
+      rex(rax, base);
+      byte(0xc7);
+      modrm_disp32(rax, base, disp);
+      imm32(imm);
+    }
+
+    // mov dst , [ ram_base + index * 8 ]
+    void load_ram(host dst, host index)
+    {
+      rex_sib(dst, index);
+      byte(0x8b);
+      sib_ram(dst, index);
+    }
+
+    // mov [ ram_base + index * 8 ] , src
+    void store_ram(host index, host src)
+    {
+      rex_sib(src, index);
+      byte(0x89);
+      sib_ram(src, index);
+    }
+
+    // op dst , src
+    void alu_rr(alu op, host dst, host src)
+    {
+      rex(src, dst);
+      byte(static_cast<uint8_t>(op));
+      modrm_reg(src, dst);
+    }
+
+    // inc dst
+    void inc(host dst)
+    {
+      byte(static_cast<uint8_t>(0x48 | (dst >> 3)));
+      byte(0xff);
+      byte(static_cast<uint8_t>(0xc0 | (dst & 7)));
+    }
+
+    // setc dst8 / sete dst8
+    void setc(host dst) { setcc(0x92, dst); }
+    void sete(host dst) { setcc(0x94, dst); }
+
+    // bt src , 0 : cf of the host from bit 0
+    void bt0(host src)
+    {
+      byte(static_cast<uint8_t>(0x48 | (src >> 3)));
+      byte(0x0f);
+      byte(0xba);
+      byte(static_cast<uint8_t>(0xe0 | (src & 7)));
+      byte(0x00);
+    }
+
+    // test src8 , src8
+    void test8(host src)
+    {
+      byte(static_cast<uint8_t>(0x40 | ((src >> 3) << 2) | (src >> 3)));
+      byte(0x84);
+      modrm_reg(src, src);
+    }
+
+    //Jumps return the position of their rel32 to patch
+    size_t jnz() { byte(0x0f); byte(0x85); return rel32(); }
+    size_t jmp() { byte(0xe9); return rel32(); }
+
+    // jmp src
+    void jmp_reg(host src)
+    {
+      if(src >= r8)
+      {
+        byte(0x41);
+      }
+      byte(0xff);
+      byte(static_cast<uint8_t>(0xe0 | (src & 7)));
+    }
+
+    void push(host src)
+    {
+      if(src >= r8)
+      {
+        byte(0x41);
+      }
+      byte(static_cast<uint8_t>(0x50 + (src & 7)));
+    }
+
+    void pop(host dst)
+    {
+      if(dst >= r8)
+      {
+        byte(0x41);
+      }
+      byte(static_cast<uint8_t>(0x58 + (dst & 7)));
+    }
+
+    void ret() { byte(0xc3); }
+
+    // call src
+    void call(host src)
+    {
+      if(src >= r8)
+      {
+        byte(0x41);
+      }
+      byte(0xff);
+      byte(static_cast<uint8_t>(0xd0 | (src & 7)));
+    }
+
+    void patch(size_t position, size_t target)
+    {
+      const auto rel = static_cast<uint32_t>(target - (position + 4u));
+      for(size_t i = 0u; i < 4u; ++i)
+      {
+        m_code[position + i] = static_cast<uint8_t>(rel >> (8u * i));
+      }
+    }
+
+  private:
+    //reg goes to the reg field of modrm, rm to its rm field
+    void rex(host reg, host rm)
+    {
+      byte(static_cast<uint8_t>(0x48 | ((reg >> 3) << 2) | (rm >> 3)));
+    }
+
+    void rex_sib(host reg, host index)
+    {
+      byte(static_cast<uint8_t>(0x48 | ((reg >> 3) << 2) | ((index >> 3) << 1) | (ram_base >> 3)));
+    }
+
+    void modrm_reg(host reg, host rm)
+    {
+      byte(static_cast<uint8_t>(0xc0 | ((reg & 7) << 3) | (rm & 7)));
+    }
+
+    //base is never rsp or r12, which would need a sib byte
+    void modrm_disp32(host reg, host base, uint32_t disp)
+    {
+      byte(static_cast<uint8_t>(0x80 | ((reg & 7) << 3) | (base & 7)));
+      imm32(disp);
+    }
+
+    void sib_ram(host reg, host index)
+    {
+      byte(static_cast<uint8_t>(0x04 | ((reg & 7) << 3)));
+      byte(static_cast<uint8_t>(0xc0 | ((index & 7) << 3) | (ram_base & 7)));
+    }
+
+    void setcc(uint8_t op, host dst)
+    {
+      byte(static_cast<uint8_t>(0x40 | (dst >> 3)));
+      byte(0x0f);
+      byte(op);
+      byte(static_cast<uint8_t>(0xc0 | (dst & 7)));
+    }
+
+    size_t rel32()
+    {
+      const auto position = size();
+      imm32(0u);
+      return position;
+    }
+
+    std::vector<uint8_t> m_code;
+  };
+
+  //Anonymous mapping written once and then made executable
+  class executable_buffer
+  {
+  public:
+    explicit executable_buffer(const std::vector<uint8_t>& code)
+      : m_size{ runtime::ram::page_align(code.size()) }
+    {
+      auto data = ::mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(data == MAP_FAILED)
+      {
+        throw std::runtime_error{ "can not allocate code buffer" };
+      }
+
+      m_data = data;
+      std::memcpy(m_data, code.data(), code.size());
+
+      if(::mprotect(m_data, m_size, PROT_READ | PROT_EXEC) != 0)
+      {
+        ::munmap(m_data, m_size);
+        throw std::runtime_error{ "can not make code executable" };
+      }
+    }
+
+    ~executable_buffer()
+    {
+      ::munmap(m_data, m_size);
+    }
+
+    executable_buffer(const executable_buffer&) = delete;
+    executable_buffer& operator=(const executable_buffer&) = delete;
+
+    const uint8_t* data() const { return static_cast<const uint8_t*>(m_data); }
+
+  private:
+    void* m_data{ nullptr };
+    size_t m_size{ 0u };
+  };
+
+  //Compiles blocks of the program marked in blocks, all of them when it is empty. Jumps
+  //out of the compiled blocks are side exits
+  class compiler
+  {
+  public:
+    compiler(const ir::program& p, const std::vector<bool>& blocks)
+      : m_program{ p }
+    {
+      for(size_t b = 0u; b < p.blocks.size(); ++b)
+      {
+        if(blocks.empty() || blocks[b])
+        {
+          for(size_t i = 0u; i < p.blocks[b].count; ++i)
+          {
+            m_instructions.push_back(&p.instructions[p.blocks[b].first + i]);
+          }
+        }
+      }
+    }
+
+    //Native code and offset of every instruction in it
+    std::pair<std::vector<uint8_t>, std::unordered_map<size_t, size_t>> compile()
+    {
+      emit_entry();
+
+      const auto& insts = m_instructions;
+      for(size_t i = 0u; i < insts.size(); ++i)
+      {
+        const auto& inst = *insts[i];
+        m_offsets[inst.address] = m_code.size();
+
+        if(!emit(inst))
+        {
+          side_exit(inst.address);
+          continue;
+        }
+
+        //Lifted code is not contiguous where unreachable words were skipped
+        const auto next = inst.address + inst.size();
+        if(inst.falls_through() && (i + 1u == insts.size() || insts[i + 1u]->address != next))
+        {
+          m_jumps.push_back({ m_code.jmp(), next });
+        }
+      }
+
+      for(const auto& [position, ip] : m_jumps)
+      {
+        if(m_offsets.find(ip) == m_offsets.end())
+        {
+          m_offsets[ip] = m_code.size();
+          side_exit(ip);
+        }
+
+        m_code.patch(position, m_offsets.at(ip));
+      }
+
+      const auto exit = m_code.size();
+      emit_exit();
+
+      for(const auto position : m_exits)
+      {
+        m_code.patch(position, exit);
+      }
+
+      return { m_code.bytes(), std::move(m_offsets) };
+    }
+
+  private:
+    static host host_of(unit_t reg)
+    {
+      return static_cast<host>(r8 + reg);
+    }
+
+    void get(host dst, unit_t reg)
+    {
+      if(reg < host_regs_count)
+      {
+        m_code.mov(dst, host_of(reg));
+      }
+      else
+      {
+        m_code.load(dst, state_base, static_cast<uint32_t>(reg * sizeof(unit_t)));
+      }
+    }
+
+    void put(unit_t reg, host src)
+    {
+      if(reg < host_regs_count)
+      {
+        m_code.mov(host_of(reg), src);
+      }
+      else
+      {
+        m_code.store(state_base, static_cast<uint32_t>(reg * sizeof(unit_t)), src);
+      }
+    }
+
+    //Leaves native code with eip at ip, for the interpreter to go on from
+    void side_exit(size_t ip)
+    {
+      m_code.store_imm32(state_base, offsetof(state, eip), static_cast<uint32_t>(ip));
+      m_exits.push_back(m_code.jmp());
+    }
+
+    // rax = reg + val
+    void address(const ir::operand& mem)
+    {
+      get(rax, mem.reg);
+
+      if(mem.value != 0u)
+      {
+        m_code.mov_imm(rcx, mem.value);
+        m_code.alu_rr(alu::add, rax, rcx);
+      }
+    }
+
+    // dst = reg + val, for mem operands, or reg. Uses rbx
+    void argument(host dst, const ir::operand& op)
+    {
+      get(dst, op.reg);
+
+      if(op.kind == ir::operand_kind::mem && op.value != 0u)
+      {
+        m_code.mov_imm(rbx, op.value);
+        m_code.alu_rr(alu::add, dst, rbx);
+      }
+    }
+
+    //rax = f(ram, a, b, c). Registers the callee may clobber are kept, the stack is 16
+    //bytes aligned by the pushes of the entry and the six here
+    void call(calls::call_t f, const ir::operand& a, const ir::operand& b, const ir::operand& c)
+    {
+      for(const auto r : caller_saved)
+      {
+        m_code.push(r);
+      }
+
+      argument(rax, a);
+      argument(rdx, b);
+      argument(rcx, c);
+      m_code.mov(rdi, ram_base);
+      m_code.mov(rsi, rax);
+      m_code.mov_imm(rax, static_cast<unit_t>(reinterpret_cast<uintptr_t>(f)));
+      m_code.call(rax);
+
+      for(auto r = std::rbegin(caller_saved); r != std::rend(caller_saved); ++r)
+      {
+        m_code.pop(*r);
+      }
+    }
+
+    void jump_to_block(size_t position, unit_t block)
+    {
+      m_jumps.push_back({ position, m_program.blocks[block].address });
+    }
+
+    //(state*, ram*, native entry). Callee saved registers used by the code are kept
+    void emit_entry()
+    {
+      for(const auto r : callee_saved)
+      {
+        m_code.push(r);
+      }
+
+      for(unit_t reg = 0u; reg < host_regs_count; ++reg)
+      {
+        m_code.load(host_of(reg), state_base, static_cast<uint32_t>(reg * sizeof(unit_t)));
+      }
+
+      m_code.load_byte(zf_reg, state_base, offsetof(state, zf));
+      m_code.load_byte(cf_reg, state_base, offsetof(state, cf));
+      m_code.jmp_reg(rdx);
+    }
+
+    void emit_exit()
+    {
+      for(unit_t reg = 0u; reg < host_regs_count; ++reg)
+      {
+        m_code.store(state_base, static_cast<uint32_t>(reg * sizeof(unit_t)), host_of(reg));
+      }
+
+      m_code.store_byte(state_base, offsetof(state, zf), zf_reg);
+      m_code.store_byte(state_base, offsetof(state, cf), cf_reg);
+
+      for(auto r = std::rbegin(callee_saved); r != std::rend(callee_saved); ++r)
+      {
+        m_code.pop(*r);
+      }
+
+      m_code.ret();
+    }
+
+    //False for instructions left to the interpreter
+    bool emit(const ir::instruction& inst)
+    {
+      using inst_t = instructions::instruction;
+
+      const auto& op = inst.operands;
+
+      switch(inst.opcode)
+      {
+        case inst_t::je: // je ip
+          m_code.test8(zf_reg);
+          jump_to_block(m_code.jnz(), op[0].value);
+        return true;
+
+        case inst_t::jmp: // jmp ip
+          jump_to_block(m_code.jmp(), op[0].value);
+        return true;
+
+        case inst_t::cmp: // cmp reg val
+          get(rax, op[0].reg);
+          m_code.mov_imm(rcx, op[1].value);
+          m_code.alu_rr(alu::cmp, rax, rcx);
+          m_code.sete(zf_reg);
+        return true;
+
+        case inst_t::add_reg_mem_ptr_reg_plus_val: // add reg reg2 val
+          address(op[1]);
+          m_code.load_ram(rdx, rax);
+          get(rax, op[0].reg);
+          m_code.alu_rr(alu::add, rax, rdx);
+          m_code.setc(cf_reg);
+          put(op[0].reg, rax);
+        return true;
+
+        case inst_t::sub_reg_val: // sub reg val
+          get(rax, op[0].reg);
+          m_code.mov_imm(rcx, op[1].value);
+          m_code.alu_rr(alu::sub, rax, rcx);
+          m_code.setc(cf_reg);
+          put(op[0].reg, rax);
+        return true;
+
+        case inst_t::mov_mem_reg_ptr_reg_plus_val: // mov reg val reg2
+          address(op[0]);
+          get(rdx, op[1].reg);
+          m_code.store_ram(rax, rdx);
+        return true;
+
+        case inst_t::mov_mem_val_ptr_reg_plus_val: // mov reg val val2
+          address(op[0]);
+          m_code.mov_imm(rdx, op[1].value);
+          m_code.store_ram(rax, rdx);
+        return true;
+
+        case inst_t::mov_reg_mem_ptr_reg_plus_val: // mov reg reg2 val
+          address(op[1]);
+          m_code.load_ram(rdx, rax);
+          put(op[0].reg, rdx);
+        return true;
+
+        case inst_t::mov_reg_reg: // mov reg reg2
+          get(rax, op[1].reg);
+          put(op[0].reg, rax);
+        return true;
+
+        case inst_t::mov_reg_val: // mov reg val
+          m_code.mov_imm(rax, op[1].value);
+          put(op[0].reg, rax);
+        return true;
+
+        case inst_t::inc: // inc reg
+          get(rax, op[0].reg);
+          m_code.inc(rax);
+          put(op[0].reg, rax);
+        return true;
+
+        case inst_t::add_reg_reg: // add reg reg2
+        case inst_t::adc_reg_reg: // adc reg reg2
+        case inst_t::sbb_reg_reg: // sbb reg reg2
+        {
+          get(rax, op[0].reg);
+          get(rdx, op[1].reg);
+
+          if(inst.opcode != inst_t::add_reg_reg)
+          {
+            m_code.bt0(cf_reg);
+          }
+
+          const auto a = inst.opcode == inst_t::add_reg_reg ? alu::add
+                       : inst.opcode == inst_t::adc_reg_reg ? alu::adc
+                       : alu::sbb;
+          m_code.alu_rr(a, rax, rdx);
+          m_code.setc(cf_reg);
+          put(op[0].reg, rax);
+        }return true;
+
+        case inst_t::addn: // addn reg reg2 reg3
+          call(calls::addn, op[0], op[1], op[2]);
+          m_code.mov(cf_reg, rax);
+        return true;
+
+        case inst_t::subn: // subn reg reg2 reg3
+          call(calls::subn, op[0], op[1], op[2]);
+          m_code.mov(cf_reg, rax);
+        return true;
+
+        case inst_t::copyn: // copyn reg val reg2 val2 reg3
+          call(calls::copyn, op[0], op[1], op[2]);
+        return true;
+
+        case inst_t::cmpn: // cmpn reg val reg2 val2 reg3
+          call(calls::cmpn, op[0], op[1], op[2]);
+          m_code.mov(zf_reg, rax);
+        return true;
+
+        case inst_t::filln: // filln reg val reg2 reg3
+          call(calls::filln, op[0], op[1], op[2]);
+        return true;
+
+        case inst_t::sumn: // sumn reg reg2 val reg3
+          call(calls::sumn, op[1], op[2], {});
+          put(op[0].reg, rax);
+        return true;
+
+        default:
+        return false;
+      }
+    }
+
+    //rbx makes the pushes of the entry keep the stack 16 bytes aligned for calls
+    static constexpr host callee_saved[] = { rbx, r12, r13, r14, r15 };
+    static constexpr host caller_saved[] = { r8, r9, r10, r11, rsi, rdi };
+
+    const ir::program& m_program;
+    std::vector<const ir::instruction*> m_instructions;
+    emitter m_code;
+    std::unordered_map<size_t, size_t> m_offsets;                  // ip -> offset of native code
+    std::vector<size_t> m_exits;                                   // rel32 of side exits
+    std::vector<std::pair<size_t, size_t>> m_jumps;                // rel32, target ip
+  };
+
+  class code
+  {
+  public:
+    code(std::vector<uint8_t> native, const std::unordered_map<size_t, size_t>& offsets)
+      : m_buffer{ native }
+    {
+      for(const auto& [ip, offset] : offsets)
+      {
+        if(ip >= m_entries.size())
+        {
+          m_entries.resize(ip + 1u, no_entry);
+        }
+
+        m_entries[ip] = static_cast<uint32_t>(offset);
+      }
+    }
+
+    bool contains(size_t ip) const
+    {
+      return ip < m_entries.size() && m_entries[ip] != no_entry;
+    }
+
+    //Runs native code from eip, which has to be compiled, up to the first side exit
+    template <typename machine_t>
+    void enter(machine_t& machine) const
+    {
+      using entry_t = void (*)(state*, unit_t*, const void*);
+      const auto entry = reinterpret_cast<entry_t>(reinterpret_cast<uintptr_t>(m_buffer.data()));
+
+      state s{};
+      save(machine, s);
+      entry(&s, &machine.ram[0], m_buffer.data() + m_entries[machine.eip()]);
+      restore(s, machine);
+    }
+
+    //Runs until exit, the result is eax as of execute::execute
+    template <typename machine_t>
+    unit_t run(machine_t& machine) const
+    {
+      while(execute::get_next_instruction(machine) != instructions::instruction::exit)
+      {
+        if(contains(machine.eip()))
+        {
+          enter(machine);
+
+          if(execute::get_next_instruction(machine) == instructions::instruction::exit)
+          {
+            break;
+          }
+        }
+
+        if(execute::execute_next_instruction(machine))
+        {
+          execute::adjust_eip(machine);
+        }
+      }
+
+      return machine.eax();
+    }
+
+  private:
+    template <typename machine_t>
+    static void save(const machine_t& machine, state& s)
+    {
+      for(size_t i = 0u; i < static_cast<size_t>(regs::reg::eip); ++i)
+      {
+        s.regs[i] = machine.get_reg(static_cast<unit_t>(i));
+      }
+
+      s.zf = machine.zf;
+      s.cf = machine.cf;
+    }
+
+    template <typename machine_t>
+    static void restore(const state& s, machine_t& machine)
+    {
+      for(size_t i = 0u; i < static_cast<size_t>(regs::reg::eip); ++i)
+      {
+        machine.set_reg(static_cast<unit_t>(i), s.regs[i]);
+      }
+
+      machine.eip() = s.eip;
+      machine.zf = s.zf != 0u;
+      machine.cf = s.cf != 0u;
+    }
+
+    static constexpr uint32_t no_entry = UINT32_MAX;
+
+    executable_buffer m_buffer;
+    std::vector<uint32_t> m_entries; // per ip, offset of its native code
+  };
+
+  //Blocks of a lifted program, all of them when blocks is empty. The program has to be
+  //verified
+  inline std::unique_ptr<code> compile(const ir::program& p, const std::vector<bool>& blocks)
+  {
+    auto [native, offsets] = compiler{ p, blocks }.compile();
+    return std::make_unique<code>(std::move(native), offsets);
+  }
+
+  //Null when the program can not be compiled: the host is not x86-64, ram is observed, or
+  //the program is not verified, so its accesses would need bounds checks
+  template <typename machine_t>
+  std::unique_ptr<code> compile(const machine_t& m)
+  {
+    if constexpr(!execute::has_plain_ram<machine_t>)
+    {
+      return nullptr;
+    }
+
+    if(!host_supported || !verify::check(m).verified())
+    {
+      return nullptr;
+    }
+
+    const auto p = ir::lift(m);
+    if(!p.valid)
+    {
+      return nullptr;
+    }
+
+    return compile(p, {});
+  }
+
+  //Falls back to the interpreter for programs which can not be compiled
+  template <typename machine_t>
+  unit_t execute(machine_t machine)
+  {
+    if(const auto compiled = compile(machine))
+    {
+      return compiled->run(machine);
+    }
+
+    return verify::execute(std::move(machine));
+  }
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "runtime.hpp"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <exception>
+
+//Cores with registers and flags of their own executing on one shared ram, each in its
+//own thread. Plain loads and stores are relaxed atomics, so cores can poll ram written
+//by others. xadd and cmpxchg are sequentially consistent, fence orders everything
+//around it. Code is not expected to be written while cores are running
+namespace multicore
+{
+  //Non owning view of ram of the machine the cores were started from
+  class shared_ram
+  {
+  public:
+    shared_ram(unit_t* data, size_t size)
+      : m_data{ data }
+      , m_size{ size }
+    {}
+
+    unit_t& operator[](size_t i) const { return m_data[i]; }
+    unit_t* begin() const { return m_data; }
+    unit_t* end() const { return m_data + m_size; }
+    size_t size() const { return m_size; }
+
+  private:
+    unit_t* m_data;
+    size_t m_size;
+  };
+
+  class system;
+
+  class core : public basic_machine<shared_ram>
+  {
+  public:
+    core(shared_ram ram, system& sys)
+      : basic_machine{ ram }
+      , m_system{ &sys }
+    {}
+
+    unit_t load(size_t address)
+    {
+      return std::atomic_ref<unit_t>{ ram[address] }.load(std::memory_order_relaxed);
+    }
+
+    void store(size_t address, unit_t value)
+    {
+      std::atomic_ref<unit_t>{ ram[address] }.store(value, std::memory_order_relaxed);
+    }
+
+    unit_t exchange_add(size_t address, unit_t value)
+    {
+      return std::atomic_ref<unit_t>{ ram[address] }.fetch_add(value);
+    }
+
+    bool compare_exchange(size_t address, unit_t& expected, unit_t desired)
+    {
+      return std::atomic_ref<unit_t>{ ram[address] }.compare_exchange_strong(expected, desired);
+    }
+
+    void fence()
+    {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void spawn(unit_t ip, unit_t esp);
+
+  private:
+    system* m_system;
+  };
+
+  //Runs a machine as core 0 on the calling thread. Cores it spawns run in new threads
+  class system
+  {
+  public:
+    static constexpr size_t max_cores = 256u;
+
+    //Programs are verified once for all cores, spawned ones included
+    explicit system(runtime::machine& m)
+      : m_machine{ m }
+      , m_policy{ verify::check(m).policy() }
+    {}
+
+    system(const system&) = delete;
+    system& operator=(const system&) = delete;
+
+    //Waits for all cores and returns eax of core 0. Ram of the machine is left as the
+    //cores wrote it. The first error of any core is rethrown
+    unit_t run()
+    {
+      core main{ shared_ram{ m_machine.ram.begin(), m_machine.ram.size() }, *this };
+      main.zf = m_machine.zf;
+      main.cf = m_machine.cf;
+      for(size_t i = 0u; i < static_cast<size_t>(regs::reg::undef); ++i)
+      {
+        main.set_reg(static_cast<unit_t>(i), m_machine.get_reg(static_cast<unit_t>(i)));
+      }
+
+      unit_t result{ 0u };
+      run_core(main, result);
+      join_all();
+
+      if(m_error)
+      {
+        std::rethrow_exception(m_error);
+      }
+
+      return result;
+    }
+
+    void spawn(const core& parent, unit_t ip, unit_t esp)
+    {
+      core child{ parent };
+      child.eip() = ip;
+      child.esp() = esp;
+
+      std::lock_guard lock{ m_mutex };
+
+      if(++m_cores >= max_cores)
+      {
+        throw std::runtime_error{ "too many cores" };
+      }
+
+      m_threads.emplace_back([this, child]
+      {
+        unit_t ignored;
+        run_core(child, ignored);
+      });
+    }
+
+  private:
+    void run_core(const core& c, unit_t& result)
+    {
+      try
+      {
+        result = execute::execute(c, m_policy);
+      }
+      catch(...)
+      {
+        std::lock_guard lock{ m_mutex };
+        if(!m_error)
+        {
+          m_error = std::current_exception();
+        }
+      }
+    }
+
+    //Joined cores may have spawned more of them in the meantime
+    void join_all()
+    {
+      for(;;)
+      {
+        std::vector<std::thread> threads;
+        {
+          std::lock_guard lock{ m_mutex };
+          threads.swap(m_threads);
+        }
+
+        if(threads.empty())
+        {
+          return;
+        }
+
+        for(auto& t : threads)
+        {
+          t.join();
+        }
+      }
+    }
+
+    runtime::machine& m_machine;
+    execute::policy m_policy;
+    std::mutex m_mutex;
+    std::vector<std::thread> m_threads;
+    size_t m_cores{ 0u };
+    std::exception_ptr m_error;
+  };
+
+  inline void core::spawn(unit_t ip, unit_t esp)
+  {
+    m_system->spawn(*this, ip, esp);
+  }
+
+  inline unit_t execute(runtime::machine& m)
+  {
+    return system{ m }.run();
+  }
+}
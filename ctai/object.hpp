@@ -0,0 +1,237 @@
+#pragma once
+
+#include "runtime.hpp"
+
+#include <cstdint>
+
+//Assembled machines stored on disk.
+//Layout: header, sections table, sections. Every section is a page aligned run of ram
+//words stored at a page aligned file offset, so the loader maps it straight into ram.
+//Words not covered by any section are zero.
+namespace object
+{
+  constexpr char magic[4] = { 'c', 't', 'a', 'i' };
+  constexpr uint32_t version = 1u;
+  constexpr size_t file_page_size = 4096u;
+  constexpr size_t page_words = file_page_size / sizeof(unit_t);
+
+  struct header
+  {
+    char magic[4];
+    uint32_t version;
+    uint64_t amount_of_ram;
+    uint64_t image_size;  //words of code at the beginning of ram
+    uint64_t entry_eip;
+    uint64_t initial_esp;
+    uint64_t sections_count;
+  };
+
+  struct section
+  {
+    uint64_t first;       //first ram word
+    uint64_t words;
+    uint64_t file_offset;
+  };
+
+  inline bool is_object(std::string_view content)
+  {
+    return content.size() >= sizeof(header)
+        && algo::equal(std::begin(magic), std::end(magic), content.begin());
+  }
+
+  //First section is the code page(s), the rest are runs of non zero pages (initial data)
+  template <typename ram_t>
+  std::vector<section> get_sections(const ram_t& ram, size_t image_size)
+  {
+    std::vector<section> sections;
+    const auto size = static_cast<size_t>(ram.size());
+    const auto code_pages = std::max<size_t>((image_size + page_words - 1u) / page_words, 1u);
+
+    sections.push_back(section{ 0u, std::min(code_pages * page_words, size), 0u });
+
+    for(auto first = sections.back().words; first < size; first += page_words)
+    {
+      const auto last = std::min(first + page_words, size);
+      const auto page_begin = algo::next(ram.begin(), static_cast<int>(first));
+      const auto page_end = algo::next(ram.begin(), static_cast<int>(last));
+      const auto is_zero_page = std::all_of(page_begin, page_end, [](unit_t word) { return word == 0u; });
+
+      if(is_zero_page)
+      {
+        continue;
+      }
+
+      if(sections.back().first + sections.back().words == first)
+      {
+        sections.back().words += last - first;
+      }
+      else
+      {
+        sections.push_back(section{ first, last - first, 0u });
+      }
+    }
+
+    return sections;
+  }
+
+  template <typename machine_t>
+  void write(const char* path, const machine_t& m)
+  {
+    const auto padding = [](size_t bytes) { return (file_page_size - bytes % file_page_size) % file_page_size; };
+
+    auto sections = get_sections(m.ram, m.image_size);
+
+    auto offset = sizeof(header) + sections.size() * sizeof(section);
+    for(auto& sec : sections)
+    {
+      offset += padding(offset);
+      sec.file_offset = offset;
+      offset += sec.words * sizeof(unit_t);
+    }
+
+    header h{};
+    algo::copy(std::begin(magic), std::end(magic), h.magic);
+    h.version = version;
+    h.amount_of_ram = m.ram.size();
+    h.image_size = m.image_size;
+    h.entry_eip = m.eip();
+    h.initial_esp = m.esp();
+    h.sections_count = sections.size();
+
+    std::vector<char> content;
+    content.reserve(offset + padding(offset));
+
+    const auto append = [&content](const void* data, size_t bytes)
+    {
+      const auto first = static_cast<const char*>(data);
+      content.insert(content.end(), first, first + bytes);
+    };
+
+    append(&h, sizeof(h));
+    append(sections.data(), sections.size() * sizeof(section));
+
+    for(const auto& sec : sections)
+    {
+      content.resize(sec.file_offset, '\0');
+      append(&m.ram[sec.first], sec.words * sizeof(unit_t));
+    }
+
+    //Last page is complete, so mapping it never reaches past the end of file
+    content.resize(content.size() + padding(content.size()), '\0');
+
+    const auto fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+      throw std::runtime_error{ std::string{ "can not create " } + path };
+    }
+
+    const auto written = ::write(fd, content.data(), content.size());
+    ::close(fd);
+
+    if(written != static_cast<ssize_t>(content.size()))
+    {
+      throw std::runtime_error{ std::string{ "can not write " } + path };
+    }
+  }
+
+  //Descriptor closed when it goes out of scope, -1 when there is none
+  class descriptor
+  {
+  public:
+    explicit descriptor(int fd)
+      : m_fd{ fd }
+    {}
+
+    ~descriptor()
+    {
+      if(m_fd >= 0)
+      {
+        ::close(m_fd);
+      }
+    }
+
+    descriptor(const descriptor&) = delete;
+    descriptor& operator=(const descriptor&) = delete;
+
+    int get() const
+    {
+      return m_fd;
+    }
+
+  private:
+    int m_fd;
+  };
+
+  //Sections are privately mapped over anonymous ram: nothing is read until the engine
+  //touches a page, and pages written by the program are copied on write
+  inline runtime::machine load(const char* path)
+  {
+    const runtime::mapped_file file{ path };
+    const auto content = file.view();
+
+    if(!is_object(content))
+    {
+      throw std::runtime_error{ std::string{ path } + " is not a ctai object" };
+    }
+
+    header h;
+    std::memcpy(&h, content.data(), sizeof(h));
+
+    if(h.version != version)
+    {
+      throw std::runtime_error{ std::string{ path } + ": unsupported object version " + std::to_string(h.version) };
+    }
+
+    if(h.sections_count > (content.size() - sizeof(h)) / sizeof(section))
+    {
+      throw std::runtime_error{ std::string{ path } + ": truncated object" };
+    }
+
+    if(h.image_size > h.amount_of_ram || h.entry_eip >= h.amount_of_ram || h.initial_esp >= h.amount_of_ram)
+    {
+      throw std::runtime_error{ std::string{ path } + ": image, entry or stack out of ram" };
+    }
+
+    std::vector<section> sections(h.sections_count);
+    std::memcpy(sections.data(), content.data() + sizeof(h), sections.size() * sizeof(section));
+
+    //Sections are whole pages of the file, as written by object::write, so mapping
+    //them never reaches past its end
+    for(const auto& sec : sections)
+    {
+      const auto words_in_file = (content.size() - std::min<size_t>(sec.file_offset, content.size())) / sizeof(unit_t);
+
+      if(sec.first > h.amount_of_ram || sec.words > h.amount_of_ram - sec.first
+         || sec.file_offset > content.size() || sec.words > words_in_file
+         || sec.file_offset % file_page_size != 0u || sec.first % page_words != 0u
+         || (sec.words + page_words - 1u) / page_words * file_page_size > content.size() - sec.file_offset)
+      {
+        throw std::runtime_error{ std::string{ path } + ": section out of range" };
+      }
+    }
+
+    runtime::machine m{ runtime::ram{ h.amount_of_ram } };
+    const auto can_map = runtime::ram::page_size() <= file_page_size
+                      && file_page_size % runtime::ram::page_size() == 0u;
+
+    const descriptor fd{ can_map ? ::open(path, O_RDONLY) : -1 };
+
+    for(const auto& sec : sections)
+    {
+      if(fd.get() >= 0)
+      {
+        m.ram.map(fd.get(), sec.file_offset, sec.first, sec.words);
+      }
+      else
+      {
+        std::memcpy(&m.ram[sec.first], content.data() + sec.file_offset, sec.words * sizeof(unit_t));
+      }
+    }
+
+    m.image_size = h.image_size;
+    m.eip() = h.entry_eip;
+    m.esp() = h.initial_esp;
+
+    return m;
+  }
+}
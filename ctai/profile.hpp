@@ -0,0 +1,428 @@
+#pragma once
+
+#include "runtime.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <chrono>
+#include <atomic>
+#include <csignal>
+#include <sys/time.h>
+
+//Data accesses per ram word and the working set over time. Only loads and stores are
+//counted, reads of instructions are not. Usable at compile time, where the results are
+//copied out of the recorder into arrays.
+//Sampling of eip, by a counter of executed instructions or by a SIGPROF timer, reported
+//per source line and label against runtime::source_map
+namespace profile
+{
+  constexpr uint64_t never = static_cast<uint64_t>(-1);
+
+  struct cell
+  {
+    constexpr bool touched() const
+    {
+      return loads + stores != 0u;
+    }
+
+    uint64_t loads{ 0u };
+    uint64_t stores{ 0u };
+    uint64_t first_step{ never };
+    uint64_t last_step{ 0u };
+  };
+
+  //Observer of execute::observed. The working set is the count of distinct words accessed
+  //within each window of steps, recorded when the window ends
+  class recorder
+  {
+  public:
+    constexpr recorder(size_t amount_of_ram, size_t window)
+      : m_cells(amount_of_ram)
+      , m_window{ std::max<size_t>(window, 1u) }
+    {}
+
+    constexpr void on_load(size_t address)
+    {
+      if(auto c = touch(address))
+      {
+        ++c->loads;
+      }
+    }
+
+    constexpr void on_store(size_t address, unit_t)
+    {
+      if(auto c = touch(address))
+      {
+        ++c->stores;
+      }
+    }
+
+    //After every executed instruction
+    constexpr void step()
+    {
+      ++m_step;
+
+      if(m_step - m_window_start == m_window)
+      {
+        end_window();
+      }
+    }
+
+    //Closes the last window, which may be shorter
+    constexpr void finish()
+    {
+      if(m_step != m_window_start)
+      {
+        end_window();
+      }
+    }
+
+    constexpr const std::vector<cell>& cells() const
+    {
+      return m_cells;
+    }
+
+    constexpr const std::vector<size_t>& working_set() const
+    {
+      return m_working_set;
+    }
+
+    constexpr size_t window() const
+    {
+      return m_window;
+    }
+
+    constexpr uint64_t steps() const
+    {
+      return m_step;
+    }
+
+    //Cells of words_per_bucket consecutive words summed into one
+    constexpr std::vector<cell> buckets(size_t words_per_bucket) const
+    {
+      words_per_bucket = std::max<size_t>(words_per_bucket, 1u);
+      std::vector<cell> result((m_cells.size() + words_per_bucket - 1u) / words_per_bucket);
+
+      for(size_t i = 0u; i < m_cells.size(); ++i)
+      {
+        const auto& c = m_cells[i];
+        auto& b = result[i / words_per_bucket];
+
+        b.loads += c.loads;
+        b.stores += c.stores;
+        b.first_step = std::min(b.first_step, c.first_step);
+        b.last_step = std::max(b.last_step, c.touched() ? c.last_step : 0u);
+      }
+
+      return result;
+    }
+
+  private:
+    //Null for accesses out of ram, which checked execution reports anyway
+    constexpr cell* touch(size_t address)
+    {
+      if(address >= m_cells.size())
+      {
+        return nullptr;
+      }
+
+      auto& c = m_cells[address];
+      if(!c.touched() || c.last_step < m_window_start)
+      {
+        ++m_window_words;
+      }
+
+      c.first_step = std::min<uint64_t>(c.first_step, m_step);
+      c.last_step = m_step;
+      return &c;
+    }
+
+    constexpr void end_window()
+    {
+      m_working_set.push_back(m_window_words);
+      m_window_words = 0u;
+      m_window_start = m_step;
+    }
+
+    std::vector<cell> m_cells;
+    std::vector<size_t> m_working_set;
+    size_t m_window;
+    uint64_t m_step{ 0u };
+    uint64_t m_window_start{ 0u };
+    size_t m_window_words{ 0u };
+  };
+
+  template <typename machine_t>
+  constexpr auto run(machine_t& machine, recorder& rec)
+  {
+    while(execute::get_next_instruction(machine) != instructions::instruction::exit)
+    {
+      execute::observed<machine_t, recorder> view{ machine, rec };
+      if(execute::execute_next_instruction(view))
+      {
+        execute::adjust_eip(machine);
+      }
+
+      rec.step();
+    }
+
+    rec.finish();
+    return machine.eax();
+  }
+
+  template <typename machine_t>
+  constexpr auto execute(machine_t machine, recorder& rec)
+  {
+    return run(machine, rec);
+  }
+
+  //Compile time heatmap of a machine with fixed ram
+  template <size_t amount_of_ram>
+  constexpr std::array<cell, amount_of_ram> heatmap(const machine<amount_of_ram>& m)
+  {
+    recorder rec{ amount_of_ram, 1u };
+    profile::execute(m, rec);
+
+    std::array<cell, amount_of_ram> result{};
+    algo::copy(rec.cells().begin(), rec.cells().end(), result.begin());
+    return result;
+  }
+
+  //Compile time working set of the first samples_count windows, zero after the last one
+  template <size_t samples_count, size_t amount_of_ram>
+  constexpr std::array<size_t, samples_count> working_set(const machine<amount_of_ram>& m, size_t window)
+  {
+    recorder rec{ amount_of_ram, window };
+    profile::execute(m, rec);
+
+    std::array<size_t, samples_count> result{};
+    const auto& ws = rec.working_set();
+    algo::copy(ws.begin(), ws.begin() + static_cast<std::ptrdiff_t>(std::min(ws.size(), samples_count)), result.begin());
+    return result;
+  }
+
+  //eip samples of an execution counted per ip
+  class samples
+  {
+  public:
+    explicit samples(size_t amount_of_ram)
+      : m_hits(amount_of_ram, 0u)
+    {}
+
+    //Also called from the SIGPROF handler, so it does not allocate
+    void add(size_t ip)
+    {
+      if(ip < m_hits.size())
+      {
+        ++m_hits[ip];
+      }
+
+      ++m_total;
+    }
+
+    const std::vector<uint64_t>& hits() const
+    {
+      return m_hits;
+    }
+
+    uint64_t total() const
+    {
+      return m_total;
+    }
+
+  private:
+    std::vector<uint64_t> m_hits;
+    uint64_t m_total{ 0u };
+  };
+
+  //Interpreted, checked unless the program is verified. on_step is called before every
+  //instruction
+  template <typename machine_t, typename on_step_t>
+  unit_t execute_stepped(machine_t& machine, on_step_t on_step)
+  {
+    if(verify::check(machine).verified())
+    {
+      while(execute::get_next_instruction(machine) != instructions::instruction::exit)
+      {
+        on_step();
+
+        if(execute::execute_next_instruction(machine))
+        {
+          execute::adjust_eip(machine);
+        }
+      }
+    }
+    else
+    {
+      execute::checked<machine_t> view{ machine };
+
+      for(view.check_fetch(); execute::get_next_instruction(machine) != instructions::instruction::exit; view.check_fetch())
+      {
+        on_step();
+
+        if(execute::execute_next_instruction(view))
+        {
+          execute::adjust_eip(machine);
+        }
+      }
+    }
+
+    return machine.eax();
+  }
+
+  //Samples eip every period executed instructions
+  template <typename machine_t>
+  unit_t execute_sampled(machine_t machine, size_t period, samples& out)
+  {
+    period = std::max<size_t>(period, 1u);
+    size_t countdown{ period };
+
+    return execute_stepped(machine, [&]
+    {
+      if(--countdown == 0u)
+      {
+        out.add(machine.eip());
+        countdown = period;
+      }
+    });
+  }
+
+  //Read by the SIGPROF handler, which interrupts the thread executing the machine
+  inline std::atomic<const unit_t*> timed_eip{ nullptr };
+  inline std::atomic<samples*> timed_samples{ nullptr };
+
+  inline void on_sigprof(int)
+  {
+    const auto eip = timed_eip.load(std::memory_order_relaxed);
+    const auto out = timed_samples.load(std::memory_order_relaxed);
+
+    if(eip != nullptr && out != nullptr)
+    {
+      out->add(*static_cast<const volatile unit_t*>(eip));
+    }
+  }
+
+  //Installs the handler and a profiling timer, restores both when destroyed
+  class profiling_timer
+  {
+  public:
+    explicit profiling_timer(std::chrono::microseconds interval)
+    {
+      struct sigaction action{};
+      action.sa_handler = on_sigprof;
+      action.sa_flags = SA_RESTART;
+      sigemptyset(&action.sa_mask);
+
+      if(::sigaction(SIGPROF, &action, &m_previous_action) != 0)
+      {
+        throw std::runtime_error{ "can not install SIGPROF handler" };
+      }
+
+      const auto usec = std::max<long long>(interval.count(), 1);
+      itimerval timer{};
+      timer.it_interval.tv_sec = static_cast<time_t>(usec / 1000000);
+      timer.it_interval.tv_usec = static_cast<suseconds_t>(usec % 1000000);
+      timer.it_value = timer.it_interval;
+
+      if(::setitimer(ITIMER_PROF, &timer, &m_previous_timer) != 0)
+      {
+        ::sigaction(SIGPROF, &m_previous_action, nullptr);
+        throw std::runtime_error{ "can not start profiling timer" };
+      }
+    }
+
+    ~profiling_timer()
+    {
+      ::setitimer(ITIMER_PROF, &m_previous_timer, nullptr);
+      ::sigaction(SIGPROF, &m_previous_action, nullptr);
+    }
+
+    profiling_timer(const profiling_timer&) = delete;
+    profiling_timer& operator=(const profiling_timer&) = delete;
+
+  private:
+    struct sigaction m_previous_action{};
+    itimerval m_previous_timer{};
+  };
+
+  //Samples eip every interval of cpu time. One machine at a time
+  template <typename machine_t>
+  unit_t execute_timed(machine_t machine, std::chrono::microseconds interval, samples& out)
+  {
+    timed_samples = &out;
+    timed_eip = &machine.eip();
+
+    unit_t result{ 0u };
+    {
+      profiling_timer timer{ interval };
+
+      //eip has to be in memory whenever the signal arrives
+      result = execute_stepped(machine, [] { std::atomic_signal_fence(std::memory_order_seq_cst); });
+    }
+
+    timed_eip = nullptr;
+    timed_samples = nullptr;
+    return result;
+  }
+
+  struct hot_line
+  {
+    size_t line{ 0u };
+    uint64_t samples{ 0u };
+  };
+
+  struct hot_label
+  {
+    std::string label; // empty for code before the first label
+    uint64_t samples{ 0u };
+  };
+
+  //Samples summed per source line and per enclosing label, hottest first
+  struct report
+  {
+    std::vector<hot_line> lines;
+    std::vector<hot_label> labels;
+    uint64_t unmapped{ 0u }; // ips not assembled from the source, e.g. out of ram
+  };
+
+  inline report summarize(const samples& s, const runtime::source_map& map)
+  {
+    report result;
+    std::unordered_map<size_t, uint64_t> lines;
+    std::unordered_map<std::string_view, uint64_t> labels;
+
+    const auto& hits = s.hits();
+    uint64_t mapped{ 0u };
+
+    for(size_t ip = 0u; ip < hits.size(); ++ip)
+    {
+      if(hits[ip] == 0u)
+      {
+        continue;
+      }
+
+      if(const auto location = map.find(ip))
+      {
+        lines[location->line] += hits[ip];
+        labels[map.label(*location)] += hits[ip];
+        mapped += hits[ip];
+      }
+    }
+
+    for(const auto& [line, count] : lines)
+    {
+      result.lines.push_back({ line, count });
+    }
+
+    for(const auto& [label, count] : labels)
+    {
+      result.labels.push_back({ std::string{ label }, count });
+    }
+
+    std::sort(result.lines.begin(), result.lines.end(), [](const auto& a, const auto& b) { return a.samples > b.samples; });
+    std::sort(result.labels.begin(), result.labels.end(), [](const auto& a, const auto& b) { return a.samples > b.samples; });
+    result.unmapped = s.total() - mapped;
+
+    return result;
+  }
+}
@@ -0,0 +1,539 @@
+#pragma once
+
+#include "ctai.hpp"
+
+#include <unordered_map>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace runtime
+{
+  //Ram living in its own anonymous mapping, so untouched words cost nothing and parts
+  //of it can be replaced with private mappings of a file (see object::load)
+  class ram
+  {
+  public:
+    ram() = default;
+
+    explicit ram(size_t size)
+      : m_size{ size }
+      , m_mapped_bytes{ page_align(size * sizeof(unit_t)) }
+    {
+      if(size > (static_cast<size_t>(-1) - page_size()) / sizeof(unit_t))
+      {
+        throw std::runtime_error{ "can not allocate " + std::to_string(size) + " words of ram" };
+      }
+
+      if(m_mapped_bytes == 0u)
+      {
+        return;
+      }
+
+      auto data = ::mmap(nullptr, m_mapped_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if(data == MAP_FAILED)
+      {
+        throw std::runtime_error{ "can not allocate " + std::to_string(size) + " words of ram" };
+      }
+
+      m_data = static_cast<unit_t*>(data);
+    }
+
+    ram(const ram& rhs)
+      : ram{ rhs.size() }
+    {
+      std::copy(rhs.begin(), rhs.end(), begin());
+    }
+
+    ram(ram&& rhs) noexcept
+    {
+      swap(rhs);
+    }
+
+    //Ram of the same size is overwritten in place, without mapping new pages
+    ram& operator=(const ram& rhs)
+    {
+      if(this != &rhs && m_size == rhs.m_size)
+      {
+        std::copy(rhs.begin(), rhs.end(), begin());
+        return *this;
+      }
+
+      ram copy{ rhs };
+      swap(copy);
+      return *this;
+    }
+
+    ram& operator=(ram&& rhs) noexcept
+    {
+      swap(rhs);
+      return *this;
+    }
+
+    ~ram()
+    {
+      if(m_data != nullptr)
+      {
+        ::munmap(m_data, m_mapped_bytes);
+      }
+    }
+
+    void swap(ram& rhs) noexcept
+    {
+      std::swap(m_data, rhs.m_data);
+      std::swap(m_size, rhs.m_size);
+      std::swap(m_mapped_bytes, rhs.m_mapped_bytes);
+    }
+
+    //Privately maps bytes of fd starting at file_offset over ram starting at word first.
+    //Both the file offset and the address of word first have to be page aligned
+    void map(int fd, size_t file_offset, size_t first, size_t words)
+    {
+      const auto address = m_data + first;
+      const auto bytes = page_align(words * sizeof(unit_t));
+
+      if(::mmap(address, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, static_cast<off_t>(file_offset)) == MAP_FAILED)
+      {
+        throw std::runtime_error{ "can not map ram from file" };
+      }
+    }
+
+    unit_t& operator[](size_t i) { return m_data[i]; }
+    const unit_t& operator[](size_t i) const { return m_data[i]; }
+
+    unit_t* begin() { return m_data; }
+    const unit_t* begin() const { return m_data; }
+    unit_t* end() { return m_data + m_size; }
+    const unit_t* end() const { return m_data + m_size; }
+    size_t size() const { return m_size; }
+
+    static size_t page_size()
+    {
+      static const auto size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+      return size;
+    }
+
+    static size_t page_align(size_t bytes)
+    {
+      return (bytes + page_size() - 1u) / page_size() * page_size();
+    }
+
+  private:
+    unit_t* m_data{ nullptr };
+    size_t m_size{ 0u };
+    size_t m_mapped_bytes{ 0u };
+  };
+
+  using machine = basic_machine<ram>;
+
+  //Read-only, private mapping of a whole file
+  class mapped_file
+  {
+  public:
+    explicit mapped_file(const char* path)
+    {
+      const auto fd = ::open(path, O_RDONLY);
+      if(fd < 0)
+      {
+        throw std::runtime_error{ std::string{ "can not open " } + path };
+      }
+
+      struct stat st{};
+      if(::fstat(fd, &st) < 0)
+      {
+        ::close(fd);
+        throw std::runtime_error{ std::string{ "can not stat " } + path };
+      }
+
+      m_size = static_cast<size_t>(st.st_size);
+
+      if(m_size > 0u)
+      {
+        m_data = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      }
+
+      ::close(fd);
+
+      if(m_data == MAP_FAILED)
+      {
+        m_data = nullptr;
+        throw std::runtime_error{ std::string{ "can not map " } + path };
+      }
+
+      if(m_data != nullptr)
+      {
+        ::madvise(m_data, m_size, MADV_SEQUENTIAL);
+      }
+    }
+
+    ~mapped_file()
+    {
+      if(m_data != nullptr)
+      {
+        ::munmap(m_data, m_size);
+      }
+    }
+
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    std::string_view view() const
+    {
+      return { static_cast<const char*>(m_data), m_size };
+    }
+
+  private:
+    void* m_data{ nullptr };
+    size_t m_size{ 0u };
+  };
+
+  //Splits source on any whitespace. Tokens are views into the source, nothing is copied
+  class tokenizer
+  {
+  public:
+    explicit tokenizer(std::string_view source)
+      : m_source{ source }
+    {}
+
+    //Returns empty view when there are no more tokens
+    std::string_view next()
+    {
+      while(m_pos < m_source.size() && is_space(m_source[m_pos]))
+      {
+        ++m_pos;
+      }
+
+      const auto begin = m_pos;
+
+      while(m_pos < m_source.size() && !is_space(m_source[m_pos]))
+      {
+        ++m_pos;
+      }
+
+      return m_source.substr(begin, m_pos - begin);
+    }
+
+  private:
+    static bool is_space(char c)
+    {
+      return c == ' ' || c == '\n' || c == '\t' || c == '\r';
+    }
+
+    std::string_view m_source;
+    size_t m_pos{ 0u };
+  };
+
+  //Holds just enough tokens to decode the longest instruction, so the constexpr
+  //instructions:: and assemble:: helpers can look ahead into the stream
+  class tokens_window
+  {
+  public:
+    static constexpr auto capacity = instructions::get_max_token_count();
+
+    explicit tokens_window(std::string_view source)
+      : m_tokenizer{ source }
+    {
+      for(auto& token : m_tokens)
+      {
+        token = m_tokenizer.next();
+      }
+    }
+
+    bool empty() const
+    {
+      return m_tokens[0].empty();
+    }
+
+    std::string_view* begin()
+    {
+      return m_tokens.data();
+    }
+
+    std::string_view* end()
+    {
+      return m_tokens.data() + capacity;
+    }
+
+    void consume(size_t n)
+    {
+      algo::copy(algo::next(begin(), n), end(), begin());
+
+      for(auto it = algo::prev(end(), n); it != end(); ++it)
+      {
+        *it = m_tokenizer.next();
+      }
+    }
+
+  private:
+    tokenizer m_tokenizer;
+    std::array<std::string_view, capacity> m_tokens{};
+  };
+
+  using labels_t = std::unordered_map<std::string_view, size_t>;
+
+  inline auto get_instruction(tokens_window& window)
+  {
+    const auto instruction = instructions::get_next_instruction(window.begin());
+
+    if(instruction == instructions::instruction::none)
+    {
+      throw std::runtime_error{ "unknown instruction: " + std::string{ *window.begin() } };
+    }
+
+    return instruction;
+  }
+
+  //Where an instruction was assembled from
+  struct source_location
+  {
+    size_t ip{ 0u };
+    size_t words{ 0u };
+    size_t offset{ 0u };   // of the first token in the source
+    size_t length{ 0u };   // up to the end of the last token
+    size_t line{ 0u };     // 1 based
+    size_t label{ 0u };    // index in source_map labels, no_label before the first label
+  };
+
+  //Instructions in order of their ips
+  class source_map
+  {
+  public:
+    static constexpr size_t no_label = static_cast<size_t>(-1);
+
+    void add_label(std::string_view name)
+    {
+      m_labels.emplace_back(name);
+    }
+
+    void add(size_t ip, size_t words, size_t offset, size_t length, size_t line)
+    {
+      m_locations.push_back({ ip, words, offset, length, line, m_labels.empty() ? no_label : m_labels.size() - 1u });
+    }
+
+    //Instruction covering ip, null when ip was not assembled from the source
+    const source_location* find(size_t ip) const
+    {
+      const auto it = std::upper_bound(m_locations.begin(), m_locations.end(), ip,
+                                       [](size_t val, const source_location& l) { return val < l.ip; });
+
+      if(it == m_locations.begin() || ip >= algo::prev(it, 1u)->ip + algo::prev(it, 1u)->words)
+      {
+        return nullptr;
+      }
+
+      return &*algo::prev(it, 1u);
+    }
+
+    //Empty before the first label
+    std::string_view label(const source_location& l) const
+    {
+      return l.label == no_label ? std::string_view{} : std::string_view{ m_labels[l.label] };
+    }
+
+    const std::vector<source_location>& locations() const
+    {
+      return m_locations;
+    }
+
+  private:
+    std::vector<source_location> m_locations;
+    std::vector<std::string> m_labels;
+  };
+
+  class assembler
+  {
+  public:
+    explicit assembler(size_t amount_of_ram)
+      : m_amount_of_ram{ amount_of_ram }
+    {}
+
+    //One walk of the source. References to labels declared later are patched when the
+    //label is declared. Fills map when given. Errors name the line they were found at
+    machine assemble(std::string_view source, source_map* map = nullptr) const
+    {
+      machine m{ ram{ m_amount_of_ram } };
+      tokens_window window{ source };
+      labels_t declared;
+      std::unordered_multimap<std::string_view, reference> forward_references;
+      size_t ip{ 0u };
+      size_t line{ 1u };
+      size_t line_scanned{ 0u }; // source offset lines are counted up to
+
+      while(!window.empty())
+      {
+        //Tokens are views of the source
+        const auto offset = static_cast<size_t>(window.begin()->data() - source.data());
+        line += static_cast<size_t>(std::count(source.begin() + line_scanned, source.begin() + offset, '\n'));
+        line_scanned = offset;
+
+        try
+        {
+          ip = assemble_next(m, window, declared, forward_references, ip, line, offset, source, map);
+        }
+        catch(const std::exception& e)
+        {
+          throw std::runtime_error{ "line " + std::to_string(line) + ": " + e.what() };
+        }
+      }
+
+      if(!forward_references.empty())
+      {
+        const auto first = std::min_element(forward_references.begin(), forward_references.end(),
+                                            [](const auto& lhs, const auto& rhs) { return lhs.second.line < rhs.second.line; });
+        throw std::runtime_error{ "line " + std::to_string(first->second.line) + ": unknown label: ." + std::string{ first->first } };
+      }
+
+      m.image_size = ip;
+      m.esp() = m_amount_of_ram - 1;
+      m.eip() = 0u;
+
+      return m;
+    }
+
+  private:
+    struct reference
+    {
+      size_t word{ 0u }; // to patch
+      size_t line{ 0u };
+    };
+
+    //Assembles the label, directive or instruction the window starts with, returns the ip after it
+    size_t assemble_next(machine& m, tokens_window& window, labels_t& declared,
+                         std::unordered_multimap<std::string_view, reference>& forward_references,
+                         size_t ip, size_t line, size_t offset, std::string_view source, source_map* map) const
+    {
+      if(const auto token = *window.begin(); token.front() == ':')
+      {
+        const auto name = token.substr(1);
+        if(!declared.emplace(name, ip).second)
+        {
+          throw std::runtime_error{ "duplicate label: " + std::string{ token } };
+        }
+
+        if(map != nullptr)
+        {
+          map->add_label(name);
+        }
+
+        const auto [first, last] = forward_references.equal_range(name);
+        for(auto it = first; it != last; ++it)
+        {
+          m.ram[it->second.word] = ip;
+        }
+        forward_references.erase(first, last);
+
+        window.consume(1u);
+        return ip;
+      }
+
+      if(const auto d = assemble::get_directive(window.begin()); d.valid())
+      {
+        if(ip + d.words >= m_amount_of_ram)
+        {
+          throw std::runtime_error{ "program does not fit in " + std::to_string(m_amount_of_ram) + " words of ram" };
+        }
+
+        const auto value = window.begin()[d.token_count - 1u];
+
+        if(value.front() != '.')
+        {
+          std::fill_n(m.ram.begin() + ip, d.words, algo::stoui(value));
+        }
+        else if(const auto found = declared.find(value.substr(1)); found != declared.end())
+        {
+          m.ram[ip] = found->second;
+        }
+        else
+        {
+          forward_references.emplace(value.substr(1), reference{ ip, line });
+        }
+
+        window.consume(d.token_count);
+        return ip + d.words;
+      }
+
+      const auto instruction = get_instruction(window);
+      const auto token_count = instructions::get_token_count(instruction);
+
+      if(ip + instructions::get_ip_change(instruction) >= m_amount_of_ram)
+      {
+        throw std::runtime_error{ "program does not fit in " + std::to_string(m_amount_of_ram) + " words of ram" };
+      }
+
+      auto token_it = window.begin();
+      const auto opcodes = assemble::get_next_opcodes(token_it, instruction);
+      std::copy(opcodes.begin(), opcodes.end(), m.ram.begin() + ip);
+
+      if(map != nullptr)
+      {
+        const auto last = window.begin()[token_count - 1u];
+        const auto end = static_cast<size_t>(last.data() - source.data()) + last.size();
+        map->add(ip, opcodes.size(), offset, end - offset, line);
+      }
+
+      for(size_t i = 1u; i < token_count; ++i)
+      {
+        const auto token = window.begin()[i];
+        const auto slot = instructions::get_operand_slot(instruction, i);
+
+        if(token.empty() || token.front() != '.' || slot == 0u)
+        {
+          continue;
+        }
+
+        if(const auto found = declared.find(token.substr(1)); found != declared.end())
+        {
+          m.ram[ip + slot] = found->second;
+        }
+        else
+        {
+          forward_references.emplace(token.substr(1), reference{ ip + slot, line });
+        }
+      }
+
+      window.consume(token_count);
+      return ip + opcodes.size();
+    }
+
+    size_t m_amount_of_ram;
+  };
+
+  inline machine load(const char* path, size_t amount_of_ram)
+  {
+    const mapped_file file{ path };
+    return assembler{ amount_of_ram }.assemble(file.view());
+  }
+
+  //Words the assembled program can take, a word per token or the count of a times
+  //directive, without assembling it
+  inline size_t max_image_words(std::string_view source)
+  {
+    tokenizer t{ source };
+    size_t words{ 0u };
+
+    for(auto token = t.next(); !token.empty(); token = t.next())
+    {
+      if(token == tokens::times)
+      {
+        const auto count = t.next();
+        words += algo::is_number(count) ? algo::stoui(count) : 2u; // malformed, reported by the assembler
+      }
+      else
+      {
+        ++words;
+      }
+    }
+
+    return words;
+  }
+
+  //Also for program strings compiled in, e.g. map_source(code.view()): all assemblers
+  //place instructions at the same ips
+  inline source_map map_source(std::string_view source)
+  {
+    source_map map;
+    assembler{ max_image_words(source) + 1u }.assemble(source, &map); // and a word of stack
+    return map;
+  }
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "runtime.hpp"
+
+#include <memory>
+#include <exception>
+#include <coroutine>
+
+//Cooperative scheduling of many machines on one thread. Every machine is executed by a
+//coroutine, which suspends after a slice of instructions or after yield. Machine state
+//stays where it is, so a switch costs a coroutine suspend and resume
+namespace scheduler
+{
+  class task
+  {
+  public:
+    struct promise_type
+    {
+      task get_return_object()
+      {
+        return task{ std::coroutine_handle<promise_type>::from_promise(*this) };
+      }
+
+      std::suspend_always initial_suspend() noexcept { return {}; }
+      std::suspend_always final_suspend() noexcept { return {}; }
+
+      void return_value(unit_t value)
+      {
+        result = value;
+      }
+
+      void unhandled_exception()
+      {
+        error = std::current_exception();
+      }
+
+      unit_t result{ 0u };
+      std::exception_ptr error;
+    };
+
+    using handle_t = std::coroutine_handle<promise_type>;
+
+    explicit task(handle_t handle)
+      : m_handle{ handle }
+    {}
+
+    task(task&& rhs) noexcept
+      : m_handle{ std::exchange(rhs.m_handle, nullptr) }
+    {}
+
+    task& operator=(task&& rhs) noexcept
+    {
+      std::swap(m_handle, rhs.m_handle);
+      return *this;
+    }
+
+    ~task()
+    {
+      if(m_handle)
+      {
+        m_handle.destroy();
+      }
+    }
+
+    bool done() const
+    {
+      return m_handle.done();
+    }
+
+    void resume()
+    {
+      m_handle.resume();
+    }
+
+    //eax of the finished machine. Rethrows what stopped it
+    unit_t result() const
+    {
+      if(m_handle.promise().error)
+      {
+        std::rethrow_exception(m_handle.promise().error);
+      }
+
+      return m_handle.promise().result;
+    }
+
+  private:
+    handle_t m_handle;
+  };
+
+  //machine has to outlive the task
+  template <typename machine_t>
+  task run(machine_t& machine, size_t slice, execute::policy policy)
+  {
+    execute::checked<machine_t> view{ machine };
+    const auto checked = policy == execute::policy::checked;
+
+    for(;;)
+    {
+      for(size_t i = 0u; i < slice; ++i)
+      {
+        if(checked)
+        {
+          view.check_fetch();
+        }
+
+        const auto instruction = execute::get_next_instruction(machine);
+        if(instruction == instructions::instruction::exit)
+        {
+          co_return machine.eax();
+        }
+
+        const auto need_to_change_eip = checked
+                                        ? execute::execute_next_instruction(view)
+                                        : execute::execute_next_instruction(machine);
+        if(need_to_change_eip)
+        {
+          execute::adjust_eip(machine);
+        }
+
+        if(instruction == instructions::instruction::yield)
+        {
+          break;
+        }
+      }
+
+      co_await std::suspend_always{};
+    }
+  }
+
+  //Resumes live machines in the order they were added, until all of them exit
+  class round_robin
+  {
+  public:
+    explicit round_robin(size_t slice = 1000u)
+      : m_slice{ slice }
+    {
+      if(slice == 0u)
+      {
+        throw std::invalid_argument{ "slice has to be at least one instruction" };
+      }
+    }
+
+    //Returns id of the machine
+    size_t add(runtime::machine m)
+    {
+      const auto policy = verify::check(m).policy();
+      return add(std::move(m), policy);
+    }
+
+    //For machines already verified, e.g. copies of one program checked with verify::check
+    //for every value they are seeded with
+    size_t add(runtime::machine m, execute::policy policy)
+    {
+      auto stored = std::make_unique<runtime::machine>(std::move(m));
+      auto t = scheduler::run(*stored, m_slice, policy);
+
+      m_machines.push_back(std::move(stored));
+      m_tasks.push_back(std::move(t));
+      m_live.push_back(m_tasks.size() - 1u);
+
+      return m_tasks.size() - 1u;
+    }
+
+    //One slice of every live machine. Returns false when there are none left
+    bool step()
+    {
+      size_t still_live{ 0u };
+
+      for(const auto id : m_live)
+      {
+        m_tasks[id].resume();
+        ++m_switches;
+
+        if(!m_tasks[id].done())
+        {
+          m_live[still_live++] = id;
+        }
+      }
+
+      m_live.resize(still_live);
+      return !m_live.empty();
+    }
+
+    void run()
+    {
+      while(step())
+      {}
+    }
+
+    unit_t result(size_t id) const
+    {
+      return m_tasks[id].result();
+    }
+
+    const runtime::machine& machine(size_t id) const
+    {
+      return *m_machines[id];
+    }
+
+    size_t switches() const
+    {
+      return m_switches;
+    }
+
+  private:
+    size_t m_slice;
+    std::vector<std::unique_ptr<runtime::machine>> m_machines;
+    std::vector<task> m_tasks;
+    std::vector<size_t> m_live;
+    size_t m_switches{ 0u };
+  };
+}
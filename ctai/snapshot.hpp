@@ -0,0 +1,241 @@
+#pragma once
+
+#include "ctai.hpp"
+
+#include <memory>
+#include <optional>
+
+//Copy on write machines. Ram is split into pages shared between copies, so a snapshot
+//costs the page table and then every page written after it
+namespace snapshot
+{
+  constexpr size_t page_words = 512u;
+  using page_t = std::array<unit_t, page_words>;
+
+  class cow_ram
+  {
+  public:
+    explicit cow_ram(size_t size)
+      : m_pages((size + page_words - 1u) / page_words, zero_page())
+      , m_size{ size }
+    {}
+
+    template <typename ram_t>
+    static cow_ram from(const ram_t& ram)
+    {
+      cow_ram result{ static_cast<size_t>(ram.size()) };
+
+      for(size_t i = 0u; i < result.m_size; ++i)
+      {
+        if(ram[i] != 0u)
+        {
+          result.store(i, ram[i]);
+        }
+      }
+
+      return result;
+    }
+
+    unit_t operator[](size_t i) const
+    {
+      return (*m_pages[i / page_words])[i % page_words];
+    }
+
+    void store(size_t i, unit_t value)
+    {
+      auto& page = m_pages[i / page_words];
+
+      if(page.use_count() > 1)
+      {
+        page = std::make_shared<page_t>(*page);
+      }
+
+      (*page)[i % page_words] = value;
+    }
+
+    size_t size() const
+    {
+      return m_size;
+    }
+
+    //Pages not shared with any other copy
+    size_t private_pages() const
+    {
+      return static_cast<size_t>(std::count_if(m_pages.begin(), m_pages.end(), [](const auto& page) { return page.use_count() == 1; }));
+    }
+
+  private:
+    static const std::shared_ptr<page_t>& zero_page()
+    {
+      static const auto page = std::make_shared<page_t>();
+      return page;
+    }
+
+    std::vector<std::shared_ptr<page_t>> m_pages;
+    size_t m_size;
+  };
+
+  using machine = basic_machine<cow_ram>;
+
+  template <typename machine_t>
+  machine from(const machine_t& m)
+  {
+    machine result{ cow_ram::from(m.ram) };
+
+    for(auto r = regs::reg::eax; r != regs::reg::undef; r = static_cast<regs::reg>(static_cast<size_t>(r) + 1u))
+    {
+      result.set_reg(regs::to_unit_t(r), m.get_reg(regs::to_unit_t(r)));
+    }
+
+    result.zf = m.zf;
+    result.cf = m.cf;
+    result.image_size = m.image_size;
+
+    return result;
+  }
+
+  //Execution with a checkpoint every interval steps. Any earlier step is reached by
+  //restoring the closest checkpoint and executing forward from it
+  class timeline
+  {
+  public:
+    timeline(machine m, size_t interval)
+      : m_current{ std::move(m) }
+      , m_interval{ interval }
+    {
+      if(interval == 0u)
+      {
+        throw std::invalid_argument{ "interval has to be at least one step" };
+      }
+
+      m_checkpoints.push_back(m_current);
+    }
+
+    const machine& current() const
+    {
+      return m_current;
+    }
+
+    size_t step() const
+    {
+      return m_step;
+    }
+
+    bool halted() const
+    {
+      return execute::get_next_instruction(m_current) == instructions::instruction::exit;
+    }
+
+    //Returns false when machine is halted
+    bool step_forward()
+    {
+      if(halted())
+      {
+        return false;
+      }
+
+      if(execute::execute_next_instruction(m_current))
+      {
+        execute::adjust_eip(m_current);
+      }
+
+      ++m_step;
+
+      if(m_step % m_interval == 0u && m_step / m_interval == m_checkpoints.size())
+      {
+        m_checkpoints.push_back(m_current);
+      }
+
+      return true;
+    }
+
+    void run()
+    {
+      while(step_forward())
+      {}
+    }
+
+    void seek(size_t target)
+    {
+      if(target < m_step || target - m_step > m_interval)
+      {
+        const auto index = std::min(target / m_interval, m_checkpoints.size() - 1u);
+        m_current = m_checkpoints[index];
+        m_step = index * m_interval;
+      }
+
+      while(m_step < target && step_forward())
+      {}
+    }
+
+    void step_back()
+    {
+      if(m_step > 0u)
+      {
+        seek(m_step - 1u);
+      }
+    }
+
+    //First step at which pred(machine) holds, assuming it keeps holding afterwards.
+    //Checkpoints are bisected, then the last interval is replayed step by step. When pred
+    //does not keep holding, a step at which it holds is found, not necessarily the first
+    template <typename predicate_t>
+    std::optional<size_t> bisect(predicate_t pred)
+    {
+      const auto end = m_step;
+
+      if(!pred(m_current))
+      {
+        return std::nullopt;
+      }
+
+      size_t low{ 0u };
+      size_t high{ std::min((end + m_interval - 1u) / m_interval, m_checkpoints.size()) };
+
+      //checkpoints[low] does not satisfy pred (unless low is 0), checkpoints[high] does or is past the end
+      while(high - low > 1u)
+      {
+        const auto mid = (low + high) / 2u;
+
+        if(pred(m_checkpoints[mid]))
+        {
+          high = mid;
+        }
+        else
+        {
+          low = mid;
+        }
+      }
+
+      seek(low * m_interval);
+
+      while(!pred(m_current) && m_step < end)
+      {
+        step_forward();
+      }
+
+      return m_step;
+    }
+
+    //Independent copy of the machine at given step, sharing unchanged pages
+    machine fork(size_t at)
+    {
+      const auto back = m_step;
+      seek(at);
+      auto result = m_current;
+      seek(back);
+      return result;
+    }
+
+    size_t checkpoints() const
+    {
+      return m_checkpoints.size();
+    }
+
+  private:
+    machine m_current;
+    size_t m_interval;
+    size_t m_step{ 0u };
+    std::vector<machine> m_checkpoints;
+  };
+}
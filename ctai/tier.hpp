@@ -0,0 +1,392 @@
+#pragma once
+
+#include "decoded.hpp"
+#include "jit.hpp"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+//Interprets checked with counters on targets of backward jumps. When one of them reaches
+//the threshold the loop it heads is verified, from the registers it is entered with, and
+//compiled by jit. It is entered at the header on the next iterations whose registers are
+//within those the proof holds for. So code executed a few times is never verified or
+//compiled. Stores of the interpreter into code drop what was lifted and compiled from it,
+//loops which are not verified are not tried again
+namespace tier
+{
+  constexpr size_t default_threshold = 1000u;
+
+  //Counters of backward jumps, shared by targets with the same remainder. Sharing only
+  //makes loops hot earlier, and keeps cold runs free of allocations
+  constexpr size_t counters_count = 64u;
+
+  //Blocks reachable from header which reach header again
+  inline std::vector<bool> loop_blocks(const ir::program& p, size_t header)
+  {
+    const auto count = p.blocks.size();
+    std::vector<std::vector<size_t>> predecessors(count);
+    for(size_t b = 0u; b < count; ++b)
+    {
+      for(const auto s : { p.blocks[b].target, p.blocks[b].fallthrough })
+      {
+        if(s != ir::no_block)
+        {
+          predecessors[s].push_back(b);
+        }
+      }
+    }
+
+    std::vector<bool> forward(count, false);
+    std::vector<size_t> worklist{ header };
+    forward[header] = true;
+    while(!worklist.empty())
+    {
+      const auto b = worklist.back();
+      worklist.pop_back();
+
+      for(const auto s : { p.blocks[b].target, p.blocks[b].fallthrough })
+      {
+        if(s != ir::no_block && !forward[s])
+        {
+          forward[s] = true;
+          worklist.push_back(s);
+        }
+      }
+    }
+
+    std::vector<bool> result(count, false);
+    worklist.push_back(header);
+    result[header] = true;
+    while(!worklist.empty())
+    {
+      const auto b = worklist.back();
+      worklist.pop_back();
+
+      for(const auto pred : predecessors[b])
+      {
+        if(forward[pred] && !result[pred])
+        {
+          result[pred] = true;
+          worklist.push_back(pred);
+        }
+      }
+    }
+
+    return result;
+  }
+
+  //The machine needs plain ram, it does not have to be verified
+  template <typename machine_t>
+  class runner
+  {
+  public:
+    runner(machine_t& machine, size_t threshold)
+      : m_machine{ machine }
+      , m_threshold{ threshold }
+      , m_image_size{ std::min<size_t>(machine.image_size, machine.ram.size()) }
+    {}
+
+    //Same results and errors as execute::execute_checked
+    unit_t run()
+    {
+      auto& machine = m_machine;
+      execute::checked<machine_t> checked{ machine };
+
+      //Stores are observed only once code was lifted, before that none can change it
+      execute::observed<machine_t, runner> observed{ machine, *this };
+      execute::checked<execute::observed<machine_t, runner>> checked_observed{ observed };
+
+      for(checked.check_fetch(); execute::get_next_instruction(machine) != instructions::instruction::exit; checked.check_fetch())
+      {
+        const auto ip = machine.eip();
+        if((is_block(execute::get_next_instruction(machine)) && run_block()) || (m_program ? execute::execute_next_instruction(checked_observed) : execute::execute_next_instruction(checked)))
+        {
+          execute::adjust_eip(machine);
+        }
+        else if(machine.eip() <= ip)
+        {
+          if(const auto code = back_edge(machine.eip()))
+          {
+            run_native(*code, checked_observed);
+          }
+        }
+      }
+
+      return machine.eax();
+    }
+
+    size_t compiled_loops() const
+    {
+      return static_cast<size_t>(std::count_if(m_loops.begin(), m_loops.end(), [](const auto& l) { return l.code != nullptr; }));
+    }
+
+    //Observer of the interpreter
+    void on_load(size_t)
+    {}
+
+    void on_store(size_t address, unit_t)
+    {
+      if(address < m_code_words.size() && m_code_words[address] != 0u)
+      {
+        m_program.reset();
+        m_code_words.clear();
+        m_loops.clear();
+      }
+    }
+
+  private:
+    bool in_ram(size_t address, size_t count) const
+    {
+      return address < m_machine.ram.size() && count <= m_machine.ram.size() - address;
+    }
+
+    bool writes_code(size_t address, size_t count) const
+    {
+      for(auto i = address; i < std::min(address + count, m_code_words.size()); ++i)
+      {
+        if(m_code_words[i] != 0u)
+        {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    static constexpr bool is_block(instructions::instruction inst)
+    {
+      using inst_t = instructions::instruction;
+      return inst == inst_t::addn || inst == inst_t::subn || inst == inst_t::copyn || inst == inst_t::cmpn || inst == inst_t::filln || inst == inst_t::sumn;
+    }
+
+    //Block instructions whose words are in ram and whose stores miss lifted
+    //code run unchecked, with the kernels of plain ram. Others are left to the checked
+    //interpreter, which reports the first bad word or drops code word by word
+    bool run_block()
+    {
+      using inst_t = instructions::instruction;
+
+      const auto ip = m_machine.eip();
+      const auto inst = execute::get_next_instruction(m_machine);
+      const auto word = [&](size_t i) { return m_machine.ram[ip + i]; };
+
+      size_t stored{ 0u };
+      size_t store_count{ 0u };
+      const auto regs_valid = [&](std::initializer_list<size_t> words)
+      {
+        return std::all_of(words.begin(), words.end(), [&](size_t i) { return word(i) < static_cast<unit_t>(regs::reg::undef); });
+      };
+      const auto reg = [&](size_t i) { return m_machine.get_reg(word(i)); };
+
+      switch(inst)
+      {
+        case inst_t::addn: // addn reg reg2 reg3
+        case inst_t::subn: // subn reg reg2 reg3
+          if(!regs_valid({ 1u, 2u, 3u }) || !in_ram(reg(1u), reg(3u)) || !in_ram(reg(2u), reg(3u)))
+          {
+            return false;
+          }
+          stored = reg(1u);
+          store_count = reg(3u);
+        break;
+
+        case inst_t::copyn: // copyn reg val reg2 val2 reg3
+        case inst_t::cmpn: // cmpn reg val reg2 val2 reg3
+          if(!regs_valid({ 1u, 3u, 5u }) || !in_ram(reg(1u) + word(2u), reg(5u)) || !in_ram(reg(3u) + word(4u), reg(5u)))
+          {
+            return false;
+          }
+          stored = reg(1u) + word(2u);
+          store_count = inst == inst_t::copyn ? reg(5u) : 0u;
+        break;
+
+        case inst_t::filln: // filln reg val reg2 reg3
+          if(!regs_valid({ 1u, 3u, 4u }) || !in_ram(reg(1u) + word(2u), reg(4u)))
+          {
+            return false;
+          }
+          stored = reg(1u) + word(2u);
+          store_count = reg(4u);
+        break;
+
+        case inst_t::sumn: // sumn reg reg2 val reg3
+          if(!regs_valid({ 1u, 2u, 4u }) || !in_ram(reg(2u) + word(3u), reg(4u)))
+          {
+            return false;
+          }
+        break;
+
+        default:
+        return false;
+      }
+
+      if(writes_code(stored, store_count))
+      {
+        return false;
+      }
+
+      return execute::execute_next_instruction(m_machine);
+    }
+
+    //Enters code at eip and again after every side exit which stays in it, until a store
+    //into code drops it
+    template <typename view_t>
+    void run_native(const jit::code& code, view_t& view)
+    {
+      while(true)
+      {
+        code.enter(m_machine);
+        view.check_fetch();
+        if(execute::get_next_instruction(m_machine) == instructions::instruction::exit)
+        {
+          return;
+        }
+
+        if(execute::execute_next_instruction(view))
+        {
+          execute::adjust_eip(m_machine);
+        }
+
+        if(!m_program || !code.contains(m_machine.eip()))
+        {
+          return;
+        }
+      }
+    }
+
+    struct loop
+    {
+      std::unique_ptr<jit::code> code;
+      verify::intervals entry{}; // registers the proof holds for at the header
+    };
+
+    //Native code of the loop headed by target once it is hot, if the registers are within
+    //those it was verified for
+    const jit::code* back_edge(size_t target)
+    {
+      if(target >= m_image_size)
+      {
+        return nullptr;
+      }
+
+      if(target < m_loops.size() && m_loops[target].code)
+      {
+        auto& l = m_loops[target];
+        const auto regs = verify::get_registers(m_machine);
+        if(verify::within(regs, l.entry))
+        {
+          return l.code.get();
+        }
+
+        //Verified again for both the registers of before and the current ones
+        auto joined = l.entry;
+        for(size_t i = 0u; i < verify::regs_count; ++i)
+        {
+          joined[i] = { std::min(joined[i].lo, regs[i].lo), std::max(joined[i].hi, regs[i].hi) };
+        }
+
+        l.code.reset();
+        return compile(target, joined);
+      }
+
+      auto& counter = m_counters[target % counters_count];
+      if(++counter < m_threshold)
+      {
+        return nullptr;
+      }
+
+      counter = 0u;
+      if(std::find(m_rejected.begin(), m_rejected.end(), target) != m_rejected.end())
+      {
+        return nullptr;
+      }
+
+      return compile(target, verify::get_registers(m_machine));
+    }
+
+    const jit::code* compile(size_t target, const verify::intervals& initial)
+    {
+      //Lifted once, when the first loop gets hot, and again after stores into code
+      if(!m_program)
+      {
+        m_program = ir::lift(m_machine);
+        m_code_words.assign(m_image_size, 0u);
+        for(const auto& inst : m_program->instructions)
+        {
+          std::fill_n(m_code_words.begin() + static_cast<std::ptrdiff_t>(inst.address), inst.size(), uint8_t{ 1u });
+        }
+      }
+
+      const auto& blocks = m_program->blocks;
+      const auto header = std::find_if(blocks.begin(), blocks.end(), [&](const auto& b) { return b.address == target; });
+      if(!m_program->valid || header == blocks.end())
+      {
+        return reject(target);
+      }
+
+      const auto in_loop = loop_blocks(*m_program, static_cast<size_t>(header - blocks.begin()));
+      std::vector<uint8_t> region(m_image_size, 0u);
+      for(size_t b = 0u; b < blocks.size(); ++b)
+      {
+        for(size_t i = 0u; in_loop[b] && i < blocks[b].count; ++i)
+        {
+          region[m_program->instructions[blocks[b].first + i].address] = 1u;
+        }
+      }
+
+      verify::intervals entry{};
+      if(!verify::check_region(m_machine, region, m_code_words, initial, entry).verified())
+      {
+        return reject(target);
+      }
+
+      m_loops.resize(std::max(m_loops.size(), target + 1u));
+      m_loops[target] = loop{ jit::compile(*m_program, in_loop), entry };
+      return m_loops[target].code.get();
+    }
+
+    //Without compiled loops stores need not be observed, what is lifted is dropped
+    const jit::code* reject(size_t target)
+    {
+      m_rejected.push_back(target);
+      if(compiled_loops() == 0u)
+      {
+        m_program.reset();
+        m_code_words.clear();
+        m_loops.clear();
+      }
+
+      return nullptr;
+    }
+
+    machine_t& m_machine;
+    size_t m_threshold;
+    size_t m_image_size;
+    std::array<uint32_t, counters_count> m_counters{};
+    std::vector<size_t> m_rejected;       // headers which are not verified or lifted
+    std::vector<loop> m_loops;            // per ip, the loop it heads once compiled
+    std::optional<ir::program> m_program;
+    std::vector<uint8_t> m_code_words;    // per word of the image, 1 for words of lifted instructions
+  };
+
+  //On hosts jit does not support programs which are not verified run from decoded::cache
+  template <typename machine_t>
+  unit_t execute(machine_t machine, size_t threshold = default_threshold)
+  {
+    if constexpr(execute::has_plain_ram<machine_t>)
+    {
+      if(jit::host_supported)
+      {
+        return runner<machine_t>{ machine, threshold }.run();
+      }
+
+      return verify::check(machine).verified() ? execute::execute(std::move(machine)) : decoded::execute(std::move(machine));
+    }
+    else
+    {
+      return verify::execute(std::move(machine));
+    }
+  }
+}
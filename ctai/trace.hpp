@@ -0,0 +1,555 @@
+#pragma once
+
+#include "ctai.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <fstream>
+#include <bit>
+
+//Execution trace. Every executed instruction is one record:
+//  opcode, flags (zf, jump, cf, written registers mask), [eip after jump],
+//  deltas of written registers, count of memory writes, (address delta, value) per write
+//All numbers are LEB128 varints, deltas are zigzag encoded. Traces of a whole run start
+//with magic. Traces kept by a ring start with anchored_magic and an anchor, the state
+//at their first step: the step, registers, eip, flags, the address of the last store
+//and the ram words which differ from the initial machine as (address delta, value)
+namespace trace
+{
+  constexpr char magic[4] = { 'c', 't', 'r', 'c' };
+  constexpr char anchored_magic[4] = { 'c', 't', 'r', 'a' };
+  constexpr size_t traced_regs_count = static_cast<size_t>(regs::reg::eip);
+
+  //Flags first, so records writing eax..edx keep them in one byte
+  constexpr unsigned zf_flag = 1u;
+  constexpr unsigned jump_flag = 2u;
+  constexpr unsigned cf_flag = 4u;
+  constexpr unsigned first_reg_flag = 8u;
+
+  inline uint64_t zigzag(unit_t delta)
+  {
+    return (delta << 1u) ^ (0u - (delta >> 63u));
+  }
+
+  inline unit_t unzigzag(uint64_t val)
+  {
+    return (val >> 1u) ^ (0u - (val & 1u));
+  }
+
+  //Records every step with every store. Registers are recorded as they are written, so
+  //a step costs little more than encoding what it changed. Whole runs grow with the
+  //steps executed, ring keeps a bounded part of them
+  class recorder
+  {
+  public:
+    static constexpr size_t flush_size = 1u << 16u;
+
+    //Keeps the whole trace in memory
+    recorder()
+    {
+      reserve(sizeof(magic));
+      for(const auto c : magic)
+      {
+        m_buffer[m_size++] = static_cast<uint8_t>(c);
+      }
+
+      m_header_size = m_size;
+    }
+
+    //Appends records to file, flushing every flush_size bytes
+    explicit recorder(const char* path)
+      : m_file{ std::make_unique<std::ofstream>(path, std::ios::binary) }
+    {
+      if(!*m_file)
+      {
+        throw std::runtime_error{ std::string{ "can not create " } + path };
+      }
+
+      m_file->write(magic, sizeof(magic));
+    }
+
+    ~recorder()
+    {
+      flush();
+    }
+
+    void on_load(size_t)
+    {}
+
+    void on_store(size_t address, unit_t value)
+    {
+      m_stores.push_back({ address, value });
+    }
+
+    //Written registers are collected as the instruction runs, so nothing is compared
+    //for registers it does not write
+    void on_set_reg(unit_t r, unit_t before, unit_t after)
+    {
+      m_written |= 1u << r;
+      m_deltas[r] += after - before;
+    }
+
+    template <typename machine_t>
+    void record(instructions::instruction inst, unit_t ip, machine_t& machine)
+    {
+      //worst case: opcode, flags, eip, registers, stores count
+      constexpr auto max_record_size = 1u + (traced_regs_count + 3u) * max_varint_size;
+
+      reserve(max_record_size + m_stores.size() * 2u * max_varint_size);
+
+      const auto jumped = machine.eip() != ip + instructions::get_ip_change(inst);
+      auto flags = m_written * first_reg_flag;
+      flags |= machine.zf ? zf_flag : 0u;
+      flags |= jumped ? jump_flag : 0u;
+      flags |= machine.cf ? cf_flag : 0u;
+
+      //Written through a local pointer, stores through the buffer could alias members
+      auto out = m_buffer.data() + m_size;
+
+      *out++ = static_cast<uint8_t>(inst);
+      put(out, flags);
+
+      if(jumped)
+      {
+        put(out, machine.eip());
+      }
+
+      for(; m_written != 0u; m_written &= m_written - 1u)
+      {
+        const auto i = static_cast<size_t>(std::countr_zero(m_written));
+        put(out, zigzag(m_deltas[i]));
+        m_deltas[i] = 0u;
+      }
+
+      put(out, m_stores.size());
+      for(const auto& [address, value] : m_stores)
+      {
+        put(out, zigzag(address - m_last_store_address));
+        put(out, value);
+        m_last_store_address = address;
+      }
+
+      m_size = static_cast<size_t>(out - m_buffer.data());
+
+      m_stores.clear();
+      ++m_steps;
+
+      if(m_file && m_size >= flush_size)
+      {
+        flush();
+      }
+    }
+
+    void flush()
+    {
+      if(m_file)
+      {
+        m_file->write(reinterpret_cast<const char*>(m_buffer.data()), static_cast<std::streamsize>(m_size));
+        m_size = 0u;
+      }
+    }
+
+    //Starts the records in memory over with an anchor: the state of machine at the
+    //current step, against initial
+    template <typename machine_t>
+    void anchor(const machine_t& machine, const machine_t& initial)
+    {
+      m_size = 0u;
+      reserve(sizeof(anchored_magic) + (traced_regs_count + 6u) * max_varint_size);
+
+      auto out = m_buffer.data();
+      for(const auto c : anchored_magic)
+      {
+        *out++ = static_cast<uint8_t>(c);
+      }
+
+      put(out, m_steps);
+      for(size_t i = 0u; i < traced_regs_count; ++i)
+      {
+        put(out, machine.get_reg(static_cast<unit_t>(i)));
+      }
+
+      put(out, machine.eip());
+      put(out, (machine.zf ? zf_flag : 0u) | (machine.cf ? cf_flag : 0u));
+      put(out, m_last_store_address);
+
+      size_t changed{ 0u };
+      for(size_t i = 0u; i < machine.ram.size(); ++i)
+      {
+        changed += machine.ram[i] != initial.ram[i];
+      }
+
+      put(out, changed);
+      m_size = static_cast<size_t>(out - m_buffer.data());
+
+      size_t last{ 0u };
+      for(size_t i = 0u; i < machine.ram.size(); ++i)
+      {
+        if(machine.ram[i] != initial.ram[i])
+        {
+          reserve(2u * max_varint_size);
+          out = m_buffer.data() + m_size;
+          put(out, zigzag(i - last));
+          put(out, machine.ram[i]);
+          m_size = static_cast<size_t>(out - m_buffer.data());
+          last = i;
+        }
+      }
+
+      m_header_size = m_size;
+    }
+
+    //Records not flushed to file yet, or the whole trace when recording in memory
+    std::string_view buffer() const
+    {
+      return { reinterpret_cast<const char*>(m_buffer.data()), m_size };
+    }
+
+    //Bytes of the buffer before the first record, magic and anchor
+    size_t header_size() const
+    {
+      return m_header_size;
+    }
+
+    size_t steps() const
+    {
+      return m_steps;
+    }
+
+  private:
+    static constexpr size_t max_varint_size = 10u;
+
+    void reserve(size_t bytes)
+    {
+      if(m_size + bytes > m_buffer.size())
+      {
+        m_buffer.resize(std::max(m_buffer.size() * 2u, flush_size + bytes));
+      }
+    }
+
+    static void put(uint8_t*& out, uint64_t val)
+    {
+      while(val >= 0x80u)
+      {
+        *out++ = static_cast<uint8_t>(val | 0x80u);
+        val >>= 7u;
+      }
+
+      *out++ = static_cast<uint8_t>(val);
+    }
+
+    std::unique_ptr<std::ofstream> m_file;
+    std::vector<uint8_t> m_buffer;
+    size_t m_size{ 0u };
+    size_t m_header_size{ 0u };
+    std::vector<std::pair<size_t, unit_t>> m_stores;
+    size_t m_last_store_address{ 0u };
+    unsigned m_written{ 0u };
+    std::array<unit_t, traced_regs_count> m_deltas{};
+    size_t m_steps{ 0u };
+  };
+
+  //Records to a recorder or a ring
+  template <typename machine_t, typename recorder_t>
+  auto run(machine_t& machine, recorder_t& rec)
+  {
+    for(auto inst = execute::get_next_instruction(machine); inst != instructions::instruction::exit; inst = execute::get_next_instruction(machine))
+    {
+      const auto ip = machine.eip();
+
+      execute::observed<machine_t, recorder_t> view{ machine, rec };
+      if(execute::execute_next_instruction(view))
+      {
+        execute::adjust_eip(machine);
+      }
+
+      rec.record(inst, ip, machine);
+    }
+
+    return machine.eax();
+  }
+
+  template <typename machine_t, typename recorder_t>
+  auto execute(machine_t machine, recorder_t& rec)
+  {
+    return run(machine, rec);
+  }
+
+  //Reconstructs machine state from initial machine and records
+  class replayer
+  {
+  public:
+    explicit replayer(std::string_view records)
+      : m_records{ records }
+      , m_pos{ sizeof(magic) }
+    {
+      const auto starts_with = [&](const char (&m)[sizeof(magic)])
+      {
+        return m_records.size() >= sizeof(m) && algo::equal(std::begin(m), std::end(m), m_records.begin());
+      };
+
+      if(starts_with(anchored_magic))
+      {
+        m_anchored = true;
+        m_first_step = get();
+      }
+      else if(!starts_with(magic))
+      {
+        throw std::runtime_error{ "not a trace" };
+      }
+    }
+
+    bool done() const
+    {
+      return m_pos >= m_records.size();
+    }
+
+    //Applies one record. Returns opcode of the replayed instruction
+    template <typename machine_t>
+    instructions::instruction step(machine_t& machine)
+    {
+      const auto inst = static_cast<instructions::instruction>(byte());
+      const auto ip = machine.eip();
+      if(ip >= machine.ram.size() || machine.ram[ip] != static_cast<unit_t>(inst))
+      {
+        throw std::runtime_error{ "trace does not match machine" };
+      }
+
+      const auto flags = get();
+
+      machine.eip() = (flags & jump_flag) != 0u
+                      ? get()
+                      : ip + instructions::get_ip_change(inst);
+      machine.zf = (flags & zf_flag) != 0u;
+      machine.cf = (flags & cf_flag) != 0u;
+
+      for(size_t i = 0u; i < traced_regs_count; ++i)
+      {
+        if((flags & (first_reg_flag << i)) != 0u)
+        {
+          const auto r = static_cast<unit_t>(i);
+          machine.set_reg(r, static_cast<unit_t>(machine.get_reg(r) + unzigzag(get())));
+        }
+      }
+
+      for(auto stores = get(); stores > 0u; --stores)
+      {
+        m_last_store_address += unzigzag(get());
+        if(m_last_store_address >= machine.ram.size())
+        {
+          throw std::runtime_error{ "trace does not match machine" };
+        }
+
+        machine.ram[m_last_store_address] = get();
+      }
+
+      return inst;
+    }
+
+    //Replays records until machine, the initial one, is at given step counted from the
+    //start of the run. Returns the step reached, lower when the trace ends before
+    template <typename machine_t>
+    size_t replay(machine_t& machine, size_t to_step)
+    {
+      if(m_anchored && m_step < m_first_step)
+      {
+        if(to_step < m_first_step)
+        {
+          throw std::out_of_range{ "step " + std::to_string(to_step) + " is before the first step of the trace, " + std::to_string(m_first_step) };
+        }
+
+        apply_anchor(machine);
+      }
+
+      for(; m_step < to_step && !done(); ++m_step)
+      {
+        step(machine);
+      }
+
+      return m_step;
+    }
+
+    //Step of the first record
+    size_t first_step() const
+    {
+      return m_first_step;
+    }
+
+  private:
+    template <typename machine_t>
+    void apply_anchor(machine_t& machine)
+    {
+      for(size_t i = 0u; i < traced_regs_count; ++i)
+      {
+        machine.set_reg(static_cast<unit_t>(i), get());
+      }
+
+      machine.eip() = get();
+
+      const auto flags = get();
+      machine.zf = (flags & zf_flag) != 0u;
+      machine.cf = (flags & cf_flag) != 0u;
+
+      m_last_store_address = get();
+
+      size_t address{ 0u };
+      for(auto words = get(); words > 0u; --words)
+      {
+        address += unzigzag(get());
+        if(address >= machine.ram.size())
+        {
+          throw std::runtime_error{ "trace does not match machine" };
+        }
+
+        machine.ram[address] = get();
+      }
+
+      m_step = m_first_step;
+    }
+
+    uint8_t byte()
+    {
+      if(done())
+      {
+        throw std::runtime_error{ "truncated trace" };
+      }
+
+      return static_cast<uint8_t>(m_records[m_pos++]);
+    }
+
+    uint64_t get()
+    {
+      uint64_t val{ 0u };
+
+      for(unsigned shift = 0u;; shift += 7u)
+      {
+        const auto b = byte();
+
+        //The last of ten bytes holds only the top bit
+        if(shift >= 64u || (shift == 63u && (b & 0x7fu) > 1u))
+        {
+          throw std::runtime_error{ "corrupt trace" };
+        }
+
+        val |= static_cast<uint64_t>(b & 0x7fu) << shift;
+
+        if((b & 0x80u) == 0u)
+        {
+          return val;
+        }
+      }
+    }
+
+    std::string_view m_records;
+    size_t m_pos{ 0u };
+    size_t m_last_store_address{ 0u };
+    bool m_anchored{ false };
+    size_t m_first_step{ 0u };
+    size_t m_step{ 0u };
+  };
+
+  //Bounded history of a run, cheap enough to be kept on for whole runs. Records go to
+  //memory. When they reach chunk_size bytes they become the older chunk, dropping the
+  //one before, and recording starts over anchored at the state of the machine. So the
+  //last chunk_size to 2 * chunk_size bytes of records are kept, and the state at any of
+  //their steps is rebuilt from the initial machine. An anchor costs a pass over ram
+  template <typename machine_t>
+  class ring
+  {
+  public:
+    ring(const machine_t& initial, size_t chunk_size)
+      : m_initial{ initial }
+      , m_chunk_size{ chunk_size }
+    {
+      if(chunk_size == 0u)
+      {
+        throw std::invalid_argument{ "chunk size has to be at least one byte" };
+      }
+    }
+
+    void on_load(size_t)
+    {}
+
+    void on_store(size_t address, unit_t value)
+    {
+      m_recorder.on_store(address, value);
+    }
+
+    void on_set_reg(unit_t r, unit_t before, unit_t after)
+    {
+      m_recorder.on_set_reg(r, before, after);
+    }
+
+    void record(instructions::instruction inst, unit_t ip, const machine_t& machine)
+    {
+      m_recorder.record(inst, ip, machine);
+
+      if(m_recorder.buffer().size() >= m_chunk_size)
+      {
+        m_older.assign(m_recorder.buffer());
+        m_older_first_step = m_newer_first_step;
+        m_newer_first_step = m_recorder.steps();
+        m_recorder.anchor(machine, m_initial);
+      }
+    }
+
+    //Steps are counted from the start of the run
+    size_t first_step() const
+    {
+      return m_older.empty() ? m_newer_first_step : m_older_first_step;
+    }
+
+    size_t steps() const
+    {
+      return m_recorder.steps();
+    }
+
+    //State after given step
+    machine_t at(size_t step) const
+    {
+      if(step < first_step() || step > steps())
+      {
+        throw std::out_of_range{ "step not kept: " + std::to_string(step) };
+      }
+
+      auto m = m_initial;
+      replayer{ !m_older.empty() && step < m_newer_first_step ? std::string_view{ m_older } : m_recorder.buffer() }.replay(m, step);
+      return m;
+    }
+
+    //Kept records as one trace, replayed against the initial machine
+    void write(const char* path) const
+    {
+      std::ofstream file{ path, std::ios::binary };
+      if(!file)
+      {
+        throw std::runtime_error{ std::string{ "can not create " } + path };
+      }
+
+      const auto newer = m_recorder.buffer();
+      if(m_older.empty())
+      {
+        file.write(newer.data(), static_cast<std::streamsize>(newer.size()));
+      }
+      else
+      {
+        file.write(m_older.data(), static_cast<std::streamsize>(m_older.size()));
+        file.write(newer.data() + m_recorder.header_size(), static_cast<std::streamsize>(newer.size() - m_recorder.header_size()));
+      }
+
+      file.close();
+      if(!file)
+      {
+        throw std::runtime_error{ std::string{ "can not write " } + path };
+      }
+    }
+
+  private:
+    machine_t m_initial;
+    size_t m_chunk_size;
+    recorder m_recorder;
+    std::string m_older;
+    size_t m_older_first_step{ 0u };
+    size_t m_newer_first_step{ 0u };
+  };
+}